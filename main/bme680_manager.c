@@ -1,6 +1,9 @@
 #include "bme680_manager.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
 #include "nvs.h"
@@ -9,13 +12,61 @@
 #include <sys/time.h>
 #include "bsec_config.h"
 #include "common_data.h"
+#include "wake_trace.h"
 
-#define BSEC_STATE_SAVE_INTERVAL 1000 * 60 * 1 // Save every 1 minute for test
+#define BSEC_STATE_SAVE_INTERVAL (1000LL * 60 * 60 * 6) // Write NVS at most every 6 hours
+#define BSEC_STATE_RTC_MAGIC 0x42534543                 // "BSEC"
+#define BSEC_CONFIG_RTC_MAGIC 0x47464342                // "BCFG"
+#define BSEC_RUN_TASK_STACK 8192                        // bsec_do_steps is stack hungry
 
 static const char *TAG = "BME680_MGR";
+
+// Latest BSEC state, kept across deep sleep so warm wakes skip NVS
+typedef struct
+{
+  uint32_t magic;
+  uint32_t crc;            // CRC32 of blob
+  uint32_t nvs_crc;        // CRC32 of the blob last written to NVS
+  int64_t nvs_saved_at_ms; // Time of the last NVS write
+  uint8_t blob[BSEC_MAX_STATE_BLOB_SIZE];
+} bsec_rtc_state_t;
+
+static RTC_DATA_ATTR bsec_rtc_state_t rtc_state;
+
+// Configuration in use, so warm wakes come back up in the same one
+typedef struct
+{
+  uint32_t magic;
+  bsec_config_id_t id;
+} bsec_rtc_config_t;
+
+static RTC_DATA_ATTR bsec_rtc_config_t rtc_config;
+static bsec_config_id_t current_config = BSEC_CONFIG_ULP;
+
+static const bsec_sensor_t sensor_list[] = {
+    BSEC_OUTPUT_IAQ,
+    BSEC_OUTPUT_RAW_TEMPERATURE,
+    BSEC_OUTPUT_RAW_PRESSURE,
+    BSEC_OUTPUT_RAW_HUMIDITY,
+    BSEC_OUTPUT_RAW_GAS,
+    BSEC_OUTPUT_STABILIZATION_STATUS,
+    BSEC_OUTPUT_RUN_IN_STATUS,
+    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
+    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
+};
 static bsec2_t bsec;
 static bsec_outputs_t latest_outputs;
 static bool new_outputs_available = false;
+static bool state_loaded = false; // Load attempted with a valid clock
+
+// Background bsec2_run, see bme680_manager_run_start()
+static TaskHandle_t run_task = NULL;
+static SemaphoreHandle_t run_done = NULL;
+static esp_err_t run_result;
+static bool run_pending;
+
+static int64_t get_time_ms(void);
+static bool is_time_synced(void);
 
 static void bsec_callback(const bme68x_data_t data, const bsec_outputs_t outputs, bsec2_t bsec2)
 {
@@ -46,6 +97,14 @@ static void bsec_callback(const bme68x_data_t data, const bsec_outputs_t outputs
   }
 }
 
+static bool subscribe(bsec2_t *bsec, float sample_rate)
+{
+  // bsec2_update_subscription() takes a mutable list but only reads it
+  return bsec2_update_subscription(bsec, (bsec_sensor_t *)sensor_list,
+                                   sizeof(sensor_list) / sizeof(sensor_list[0]),
+                                   sample_rate);
+}
+
 esp_err_t bme680_manager_init(i2c_master_bus_handle_t bus_handle)
 {
   if (bus_handle == NULL)
@@ -57,31 +116,33 @@ esp_err_t bme680_manager_init(i2c_master_bus_handle_t bus_handle)
   ESP_LOGI(TAG, "Initializing BSEC2...");
 
   // Initialize the library with the I2C bus handle
-  if (!bsec2_init(&bsec, (void *)bus_handle, BME68X_I2C_INTF))
+  wake_trace_begin(WAKE_PHASE_BSEC_INIT);
+  bool ok = bsec2_init(&bsec, (void *)bus_handle, BME68X_I2C_INTF);
+  wake_trace_end(WAKE_PHASE_BSEC_INIT);
+  if (!ok)
   {
     ESP_LOGE(TAG, "BSEC2 initialization failed");
     return ESP_FAIL;
   }
 
+  if (rtc_config.magic == BSEC_CONFIG_RTC_MAGIC &&
+      bsec_config_get(rtc_config.id) != NULL)
+    current_config = rtc_config.id;
+
+  wake_trace_begin(WAKE_PHASE_BSEC_CONFIG);
   bme68x_set_config(&bsec);
+  wake_trace_end(WAKE_PHASE_BSEC_CONFIG);
 
   bsec2_attach_callback(&bsec, bsec_callback);
 
+  wake_trace_begin(WAKE_PHASE_STATE_LOAD);
   bme68x_load_state(&bsec);
+  wake_trace_end(WAKE_PHASE_STATE_LOAD);
 
-  bsec_sensor_t sensor_list[] = {
-      BSEC_OUTPUT_IAQ,
-      BSEC_OUTPUT_RAW_TEMPERATURE,
-      BSEC_OUTPUT_RAW_PRESSURE,
-      BSEC_OUTPUT_RAW_HUMIDITY,
-      BSEC_OUTPUT_RAW_GAS,
-      BSEC_OUTPUT_STABILIZATION_STATUS,
-      BSEC_OUTPUT_RUN_IN_STATUS,
-      BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
-      BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
-  };
-
-  if (!bsec2_update_subscription(&bsec, sensor_list, sizeof(sensor_list) / sizeof(sensor_list[0]), BSEC_SAMPLE_RATE_ULP))
+  wake_trace_begin(WAKE_PHASE_BSEC_SUBSCRIBE);
+  ok = subscribe(&bsec, bsec_config_get(current_config)->sample_rate);
+  wake_trace_end(WAKE_PHASE_BSEC_SUBSCRIBE);
+  if (!ok)
   {
     ESP_LOGE(TAG, "BSEC2 subscription failed. Status: %d", bsec.status);
     return ESP_FAIL;
@@ -94,7 +155,14 @@ esp_err_t bme680_manager_init(i2c_master_bus_handle_t bus_handle)
 
 esp_err_t bme680_manager_run()
 {
-    if (!bsec2_run(&bsec))
+    // The clock was unset at init, pick the state up once a sync set it
+    if (!state_loaded && is_time_synced())
+        bme68x_load_state(&bsec);
+
+    wake_trace_begin(WAKE_PHASE_BSEC_RUN);
+    bool ok = bsec2_run(&bsec);
+    wake_trace_end(WAKE_PHASE_BSEC_RUN);
+    if (!ok)
     {
         ESP_LOGW(TAG, "BSEC2 run failed");
         ESP_LOGW(TAG, "BSEC2 run error: %d", bsec.status);
@@ -108,8 +176,48 @@ esp_err_t bme680_manager_run()
     return ESP_OK;
 }
 
+static void bsec_run_task(void *arg)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    run_result = bme680_manager_run();
+    xSemaphoreGive(run_done);
+  }
+}
+
+void bme680_manager_run_start(void)
+{
+  if (run_done == NULL)
+    run_done = xSemaphoreCreateBinary();
+  // Above the caller, so sensor I/O isn't held up by the work in between
+  if (run_done != NULL && run_task == NULL &&
+      xTaskCreate(bsec_run_task, "bsec_run", BSEC_RUN_TASK_STACK, NULL,
+                  uxTaskPriorityGet(NULL) + 1, &run_task) != pdPASS)
+  {
+    ESP_LOGW(TAG, "No BSEC run task, running inline");
+    run_task = NULL;
+  }
 
+  run_pending = true;
+  if (run_task == NULL)
+  {
+    run_result = bme680_manager_run();
+    return;
+  }
+  xSemaphoreTake(run_done, 0); // Drop a stale completion
+  xTaskNotifyGive(run_task);
+}
 
+esp_err_t bme680_manager_run_join(void)
+{
+  if (!run_pending)
+    return ESP_ERR_INVALID_STATE;
+  run_pending = false;
+  if (run_task != NULL)
+    xSemaphoreTake(run_done, portMAX_DELAY);
+  return run_result;
+}
 
 esp_err_t bme680_manager_read()
 {
@@ -161,16 +269,64 @@ esp_err_t bme680_manager_read()
 
 esp_err_t bme68x_set_config(bsec2_t *bsec)
 {
-  if (!bsec2_set_config(bsec, bsec_config_iaq))
+  const bsec_config_entry_t *config = bsec_config_get(current_config);
+  if (config == NULL || !bsec2_set_config(bsec, config->blob))
   {
     ESP_LOGE(TAG, "Failed to set BSEC configuration");
     return ESP_FAIL;
   }
   else
   {
-    ESP_LOGI(TAG, "BSEC configuration applied");
+    ESP_LOGI(TAG, "BSEC configuration %s applied", config->name);
+    return ESP_OK;
+  }
+}
+
+bsec_config_id_t bme680_manager_get_config(void)
+{
+  return current_config;
+}
+
+esp_err_t bme680_manager_select_config(bsec_config_id_t id)
+{
+  if (id == current_config)
+    return ESP_OK;
+  const bsec_config_entry_t *config = bsec_config_get(id);
+  if (config == NULL)
+    return ESP_ERR_NOT_FOUND;
+  if (run_pending)
+    return ESP_ERR_INVALID_STATE;
+
+  // set_config resets the algorithm, carry the calibration over in the state
+  uint8_t bsec_state[BSEC_MAX_STATE_BLOB_SIZE];
+  memset(bsec_state, 0, sizeof(bsec_state));
+  if (!bsec2_get_state(&bsec, bsec_state))
+  {
+    ESP_LOGE(TAG, "Failed to get BSEC state");
+    return ESP_FAIL;
+  }
+
+  bsec_config_id_t old = current_config;
+  current_config = id;
+  if (bme68x_set_config(&bsec) == ESP_OK && bsec2_set_state(&bsec, bsec_state) &&
+      subscribe(&bsec, config->sample_rate))
+  {
+    rtc_config.id = id;
+    rtc_config.magic = BSEC_CONFIG_RTC_MAGIC;
+    // The pending call was scheduled for the old rate, run the new one now
+    bsec.bme_conf.next_call = get_time_ms() * 1000000LL;
+    ESP_LOGI(TAG, "Switched BSEC configuration to %s", config->name);
     return ESP_OK;
   }
+
+  ESP_LOGE(TAG, "Switching BSEC configuration failed. Status: %d", bsec.status);
+  current_config = old;
+  if (bme68x_set_config(&bsec) == ESP_OK)
+  {
+    bsec2_set_state(&bsec, bsec_state);
+    subscribe(&bsec, bsec_config_get(old)->sample_rate);
+  }
+  return ESP_FAIL;
 }
 
 // Helper to check time validity
@@ -183,6 +339,43 @@ static bool is_time_synced(void)
   return (timeinfo.tm_year > (2024 - 1900));
 }
 
+static int64_t get_time_ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000LL + tv.tv_usec / 1000LL;
+}
+
+static uint32_t state_crc(const uint8_t *blob)
+{
+  return esp_rom_crc32_le(0, blob, BSEC_MAX_STATE_BLOB_SIZE);
+}
+
+// NVS is only needed on cold boots and for the occasional state write, so it
+// is brought up on first use instead of on every wake
+static esp_err_t nvs_ready(void)
+{
+  static bool nvs_initialized = false;
+  if (nvs_initialized)
+    return ESP_OK;
+
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+  {
+    nvs_flash_erase();
+    err = nvs_flash_init();
+  }
+  if (err == ESP_OK)
+    nvs_initialized = true;
+  return err;
+}
+
+static bool rtc_state_valid(void)
+{
+  return rtc_state.magic == BSEC_STATE_RTC_MAGIC &&
+         rtc_state.crc == state_crc(rtc_state.blob);
+}
+
 void bme68x_load_state(bsec2_t *bsec)
 {
   if (!is_time_synced())
@@ -190,12 +383,29 @@ void bme68x_load_state(bsec2_t *bsec)
     ESP_LOGW(TAG, "Time not synced (Year <= 2024). Skipping BSEC state load.");
     return;
   }
+  state_loaded = true;
+
+  uint8_t bsec_state[BSEC_MAX_STATE_BLOB_SIZE];
+
+  // Warm wake: the state saved before deep sleep is still in RTC memory
+  if (rtc_state_valid())
+  {
+    memcpy(bsec_state, rtc_state.blob, sizeof(bsec_state));
+    if (bsec2_set_state(bsec, bsec_state))
+    {
+      ESP_LOGI(TAG, "BSEC state restored from RTC memory");
+      return;
+    }
+    ESP_LOGW(TAG, "RTC state rejected, falling back to NVS");
+  }
 
   nvs_handle_t my_handle;
   esp_err_t err;
 
   // Open
-  err = nvs_open("bsec_storage", NVS_READWRITE, &my_handle);
+  err = nvs_ready();
+  if (err == ESP_OK)
+    err = nvs_open("bsec_storage", NVS_READWRITE, &my_handle);
   if (err != ESP_OK)
   {
     ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(err));
@@ -203,7 +413,6 @@ void bme68x_load_state(bsec2_t *bsec)
   }
 
   // Read blob
-  uint8_t bsec_state[BSEC_MAX_STATE_BLOB_SIZE];
   size_t required_size = sizeof(bsec_state);
 
   err = nvs_get_blob(my_handle, "bsec_state", bsec_state, &required_size);
@@ -216,6 +425,14 @@ void bme68x_load_state(bsec2_t *bsec)
     else
     {
       ESP_LOGI(TAG, "BSEC state loaded from NVS (Size: %d)", required_size);
+
+      // Seed the RTC copy, NVS already holds this blob
+      memset(rtc_state.blob, 0, sizeof(rtc_state.blob));
+      memcpy(rtc_state.blob, bsec_state, required_size);
+      rtc_state.crc = state_crc(rtc_state.blob);
+      rtc_state.nvs_crc = rtc_state.crc;
+      rtc_state.nvs_saved_at_ms = get_time_ms();
+      rtc_state.magic = BSEC_STATE_RTC_MAGIC;
     }
   }
   else
@@ -226,7 +443,7 @@ void bme68x_load_state(bsec2_t *bsec)
   nvs_close(my_handle);
 }
 
-void bme68x_save_state(bsec2_t *bsec)
+void bme68x_save_state(bsec2_t *bsec, bool force_nvs)
 {
   if (!is_time_synced())
   {
@@ -234,18 +451,50 @@ void bme68x_save_state(bsec2_t *bsec)
     return;
   }
 
+  // The clock was unset at init and no run has loaded the state since: load
+  // it now, or the fresh state would replace the calibrated one in NVS
+  if (!state_loaded)
+    bme68x_load_state(bsec);
+
   nvs_handle_t my_handle;
   esp_err_t err;
 
   uint8_t bsec_state[BSEC_MAX_STATE_BLOB_SIZE];
+  memset(bsec_state, 0, sizeof(bsec_state));
   if (!bsec2_get_state(bsec, bsec_state))
   {
     ESP_LOGE(TAG, "Failed to get BSEC state");
     return;
   }
 
+  // Always refresh the RTC copy, it costs nothing
+  if (rtc_state.magic != BSEC_STATE_RTC_MAGIC)
+  {
+    rtc_state.nvs_crc = 0;
+    rtc_state.nvs_saved_at_ms = 0;
+    rtc_state.magic = BSEC_STATE_RTC_MAGIC;
+  }
+  memcpy(rtc_state.blob, bsec_state, sizeof(bsec_state));
+  rtc_state.crc = state_crc(bsec_state);
+
+  // Only write NVS when the state changed and the save interval has passed
+  if (rtc_state.crc == rtc_state.nvs_crc)
+  {
+    ESP_LOGI(TAG, "BSEC state unchanged, NVS write skipped");
+    return;
+  }
+  int64_t now_ms = get_time_ms();
+  if (!force_nvs &&
+      now_ms - rtc_state.nvs_saved_at_ms < BSEC_STATE_SAVE_INTERVAL)
+  {
+    ESP_LOGI(TAG, "BSEC state kept in RTC memory");
+    return;
+  }
+
   // Open
-  err = nvs_open("bsec_storage", NVS_READWRITE, &my_handle);
+  err = nvs_ready();
+  if (err == ESP_OK)
+    err = nvs_open("bsec_storage", NVS_READWRITE, &my_handle);
   if (err != ESP_OK)
     return;
 
@@ -255,15 +504,19 @@ void bme68x_save_state(bsec2_t *bsec)
     err = nvs_commit(my_handle);
     if (err == ESP_OK)
     {
+      rtc_state.nvs_crc = rtc_state.crc;
+      rtc_state.nvs_saved_at_ms = now_ms;
       ESP_LOGI(TAG, "BSEC state saved to NVS");
     }
   }
   nvs_close(my_handle);
 }
 
-void bme680_manager_save_state(void)
+void bme680_manager_save_state(bool force_nvs)
 {
-  bme68x_save_state(&bsec);
+  wake_trace_begin(WAKE_PHASE_STATE_SAVE);
+  bme68x_save_state(&bsec, force_nvs);
+  wake_trace_end(WAKE_PHASE_STATE_SAVE);
 }
 
 int64_t bme680_manager_get_next_call_ms(void)
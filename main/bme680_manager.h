@@ -2,6 +2,7 @@
 #define BME680_MANAGER_H
 
 #include "bsec2.h"
+#include "bsec_config.h"
 #include "driver/i2c_master.h"
 #include "esp_err.h"
 
@@ -19,13 +20,31 @@ extern "C"
     esp_err_t bme680_manager_init(i2c_master_bus_handle_t bus_handle);
 
     /**
-     * @brief Set the BSEC configuration from header file
+     * @brief Apply the selected entry of the BSEC configuration registry
      *
      * @param bsec The BSEC instance
      * @return esp_err_t ESP_OK on success, ESP_FAIL otherwise
      */
     esp_err_t bme68x_set_config(bsec2_t *bsec);
 
+    /**
+     * @brief Switch to another BSEC configuration
+     *
+     * Keeps the algorithm state (baseline, calibration) across the switch
+     * and moves the subscription to the new sample rate. The next BSEC call
+     * becomes due right away. The choice survives deep sleep.
+     *
+     * @param id Registry entry
+     * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the entry
+     *         isn't built in, ESP_ERR_INVALID_STATE while a run is pending
+     */
+    esp_err_t bme680_manager_select_config(bsec_config_id_t id);
+
+    /**
+     * @brief BSEC configuration in use
+     */
+    bsec_config_id_t bme680_manager_get_config(void);
+
 #include "common_data.h"
 
     /**
@@ -37,19 +56,24 @@ extern "C"
     esp_err_t bme680_manager_read();
 
     /**
-     * @brief Load BSEC state from NVS
+     * @brief Load BSEC state from RTC memory, or from NVS after a cold boot
      */
     void bme68x_load_state(bsec2_t *bsec);
 
     /**
-     * @brief Save BSEC state to NVS
+     * @brief Save BSEC state to RTC memory, and to NVS when it changed and
+     *        the save interval has passed
+     *
+     * @param force_nvs Write a changed state to NVS regardless of the interval
      */
-    void bme68x_save_state(bsec2_t *bsec);
+    void bme68x_save_state(bsec2_t *bsec, bool force_nvs);
 
     /**
-     * @brief Force save BSEC state (Wrapper for internal BSEC instance)
+     * @brief Save BSEC state (Wrapper for internal BSEC instance)
+     *
+     * @param force_nvs Write a changed state to NVS regardless of the interval
      */
-    void bme680_manager_save_state(void);
+    void bme680_manager_save_state(bool force_nvs);
 
     /**
      * @brief Run the BSEC algorithm (poll sensor)
@@ -57,6 +81,22 @@ extern "C"
      */
     esp_err_t bme680_manager_run();
 
+    /**
+     * @brief Start bme680_manager_run() on the BSEC task and return
+     *
+     * The TPH and gas conversion takes most of a run, work that doesn't
+     * touch the sensor or latest_data's BSEC fields can go on meanwhile.
+     * Must be paired with bme680_manager_run_join().
+     */
+    void bme680_manager_run_start(void);
+
+    /**
+     * @brief Wait for the run started by bme680_manager_run_start()
+     *
+     * @return esp_err_t Result of the run, ESP_ERR_INVALID_STATE if none
+     */
+    esp_err_t bme680_manager_run_join(void);
+
     /**
      * @brief Get the next BSEC call timestamp in milliseconds
      * @return int64_t Timestamp in ms
@@ -0,0 +1,325 @@
+#include "export_manager.h"
+#include "driver/usb_serial_jtag.h"
+#include "driver/usb_serial_jtag_vfs.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "log_manager.h"
+#include "wake_trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "EXPORT_MGR";
+
+/*
+ * Protocol
+ * --------
+ * The host sends one request per line:
+ *
+ *   HLX INFO            INFO frame
+ *   HLX EXPORT <seq>    BLOCK frames from the block holding <seq>, then END
+ *   HLX EXPORT @<time>  The same from the oldest block with a sample at or
+ *                       after Unix time <time>
+ *   HLX TRACE           TRACE frames with the wake trace JSON, then END
+ *
+ * Every answer is a frame, all integers little endian:
+ *
+ *   A5 5A, u8 type, u16 payload length, payload,
+ *   u32 CRC32 (esp_rom_crc32_le(0, ...)) of type, length and payload
+ *
+ *   INFO   u32 version, u32 first_seq, u32 next_seq, u32 staged, u8 mac[6],
+ *          u16 reserved, u32 log epoch
+ *   BLOCK  u32 first_seq, u16 count, u16 reserved, ts_codec data
+ *   TRACE  a piece of the text of wake_trace_dump()
+ *   END    u32 next_seq, where the next export picks up; after a trace the
+ *          length of the text
+ *   ERROR  i32 esp_err_t
+ *
+ * Blocks go out as they are on flash, so a sample costs the same ~10 bytes
+ * on the wire; the host decodes them with the ts_codec rules. Log output
+ * shares the port, the host finds frames by their sync bytes and CRC and
+ * drops everything else. Sequence numbers start over with a new log epoch,
+ * so a host keeping a cursor keeps the epoch with it. tools/export has the
+ * host side.
+ */
+#define EXPORT_SYNC0 0xA5
+#define EXPORT_SYNC1 0x5A
+#define EXPORT_HDR_SIZE 5
+#define EXPORT_BLOCK_HDR_SIZE 8
+#define EXPORT_PAYLOAD_MAX (EXPORT_BLOCK_HDR_SIZE + LOG_BLOCK_DATA_MAX)
+#define EXPORT_TX_BUFFER 4096
+#define EXPORT_RX_BUFFER 256
+#define EXPORT_LINE_MAX 48
+#define EXPORT_WRITE_TIMEOUT_MS 500 // Host stopped reading, give up
+
+static bool driver_ready;
+static bool exporting;
+static uint32_t export_end; // next_seq when the export was requested
+static log_iter_t iter;
+static uint8_t frame[EXPORT_HDR_SIZE + EXPORT_PAYLOAD_MAX + 4];
+static char line[EXPORT_LINE_MAX];
+static size_t line_len;
+static size_t trace_len;  // Text in the payload of the next TRACE frame
+static size_t trace_sent; // Text sent in TRACE frames
+static esp_err_t trace_err;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  put_u16(p, v & 0xFFFF);
+  put_u16(p + 2, v >> 16);
+}
+
+// The payload is already in place behind the header
+static esp_err_t send_frame(uint8_t type, size_t len)
+{
+  frame[0] = EXPORT_SYNC0;
+  frame[1] = EXPORT_SYNC1;
+  frame[2] = type;
+  put_u16(&frame[3], (uint16_t)len);
+  put_u32(&frame[EXPORT_HDR_SIZE + len],
+          esp_rom_crc32_le(0, &frame[2], 3 + len));
+
+  size_t size = EXPORT_HDR_SIZE + len + 4;
+  int n = usb_serial_jtag_write_bytes(frame, size,
+                                      pdMS_TO_TICKS(EXPORT_WRITE_TIMEOUT_MS));
+  return n == (int)size ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t send_error(esp_err_t err)
+{
+  put_u32(&frame[EXPORT_HDR_SIZE], (uint32_t)err);
+  return send_frame(EXPORT_FRAME_ERROR, 4);
+}
+
+static esp_err_t send_info(void)
+{
+  uint8_t *p = &frame[EXPORT_HDR_SIZE];
+  uint32_t first_seq, next_seq;
+  log_manager_get_range(&first_seq, &next_seq);
+  put_u32(p, EXPORT_VERSION);
+  put_u32(p + 4, first_seq);
+  put_u32(p + 8, next_seq);
+  put_u32(p + 12, log_manager_get_staged_count());
+  if (esp_efuse_mac_get_default(p + 16) != ESP_OK)
+    memset(p + 16, 0, 6);
+  put_u16(p + 22, 0);
+  put_u32(p + 24, log_manager_get_epoch());
+  return send_frame(EXPORT_FRAME_INFO, 28);
+}
+
+static void start_export(uint32_t from)
+{
+  // Staged samples are only readable once they are a block on flash
+  log_manager_flush();
+  uint32_t first_seq;
+  log_manager_get_range(&first_seq, &export_end);
+
+  esp_err_t err = log_manager_iter_init(&iter, from);
+  if (err != ESP_OK)
+  {
+    send_error(err);
+    return;
+  }
+  ESP_LOGI(TAG, "Exporting records %lu..%lu", (unsigned long)iter.seq,
+           (unsigned long)export_end - 1);
+  exporting = true;
+}
+
+// Flushed first, so staged samples can be found too. Nothing that new
+// gives an empty export.
+static void start_export_at(uint32_t t)
+{
+  log_manager_flush();
+  uint32_t seq;
+  esp_err_t err = log_manager_find_time(t, &seq);
+  if (err == ESP_ERR_NOT_FOUND)
+    log_manager_get_range(NULL, &seq);
+  else if (err != ESP_OK)
+  {
+    send_error(err);
+    return;
+  }
+  start_export(seq);
+}
+
+// Fills the payload and sends it whenever it is full
+static void trace_write(const char *text, size_t len, void *arg)
+{
+  while (len > 0 && trace_err == ESP_OK)
+  {
+    size_t n = EXPORT_PAYLOAD_MAX - trace_len;
+    if (n > len)
+      n = len;
+    memcpy(&frame[EXPORT_HDR_SIZE + trace_len], text, n);
+    trace_len += n;
+    text += n;
+    len -= n;
+    if (trace_len == EXPORT_PAYLOAD_MAX)
+    {
+      trace_err = send_frame(EXPORT_FRAME_TRACE, trace_len);
+      trace_sent += trace_len;
+      trace_len = 0;
+    }
+  }
+}
+
+// In one go, unlike an export it is only a handful of frames
+static void send_trace(void)
+{
+  trace_len = 0;
+  trace_sent = 0;
+  trace_err = ESP_OK;
+  wake_trace_dump(trace_write, NULL);
+  if (trace_err == ESP_OK && trace_len > 0)
+  {
+    trace_err = send_frame(EXPORT_FRAME_TRACE, trace_len);
+    trace_sent += trace_len;
+  }
+  if (trace_err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Host stopped reading, trace dropped");
+    return;
+  }
+  put_u32(&frame[EXPORT_HDR_SIZE], (uint32_t)trace_sent);
+  send_frame(EXPORT_FRAME_END, 4);
+}
+
+static void finish_export(uint32_t next_seq)
+{
+  exporting = false;
+  put_u32(&frame[EXPORT_HDR_SIZE], next_seq);
+  send_frame(EXPORT_FRAME_END, 4);
+}
+
+// One block per call, so the deadline is checked in between
+static void export_step(void)
+{
+  if ((int32_t)(iter.seq - export_end) >= 0)
+  {
+    finish_export(export_end);
+    return;
+  }
+
+  uint32_t first_seq, count;
+  size_t len;
+  esp_err_t err = log_manager_iter_next_block(&iter, &first_seq, &count, &len);
+  if (err == ESP_ERR_INVALID_CRC)
+    return; // Torn block, the host sees the gap
+  if (err == ESP_ERR_NOT_FOUND)
+  {
+    finish_export(iter.seq);
+    return;
+  }
+  if (err != ESP_OK)
+  {
+    exporting = false;
+    send_error(err);
+    return;
+  }
+
+  uint8_t *p = &frame[EXPORT_HDR_SIZE];
+  put_u32(p, first_seq);
+  put_u16(p + 4, (uint16_t)count);
+  put_u16(p + 6, 0);
+  memcpy(p + EXPORT_BLOCK_HDR_SIZE, iter.data, len);
+  if (send_frame(EXPORT_FRAME_BLOCK, EXPORT_BLOCK_HDR_SIZE + len) != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Host stopped reading, export dropped");
+    exporting = false;
+  }
+}
+
+static void handle_line(void)
+{
+  line[line_len] = '\0';
+  if (line_len > 0 && line[line_len - 1] == '\r')
+    line[line_len - 1] = '\0';
+
+  if (strcmp(line, "HLX INFO") == 0)
+    send_info();
+  else if (strcmp(line, "HLX TRACE") == 0)
+    send_trace();
+  else if (strncmp(line, "HLX EXPORT ", 11) == 0)
+  {
+    bool by_time = line[11] == '@';
+    const char *arg = &line[by_time ? 12 : 11];
+    char *end;
+    unsigned long from = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0')
+      send_error(ESP_ERR_INVALID_ARG);
+    else if (by_time)
+      start_export_at((uint32_t)from);
+    else
+      start_export((uint32_t)from);
+  }
+  else if (strncmp(line, "HLX", 3) == 0)
+    send_error(ESP_ERR_NOT_SUPPORTED);
+  // Anything else is not meant for us
+}
+
+static esp_err_t driver_init(void)
+{
+  if (driver_ready)
+    return ESP_OK;
+  if (!usb_serial_jtag_is_driver_installed())
+  {
+    usb_serial_jtag_driver_config_t config = {
+        .tx_buffer_size = EXPORT_TX_BUFFER,
+        .rx_buffer_size = EXPORT_RX_BUFFER,
+    };
+    esp_err_t err = usb_serial_jtag_driver_install(&config);
+    if (err != ESP_OK)
+      return err;
+    // Console output must go through the driver too, or it races the frames
+    usb_serial_jtag_vfs_use_driver();
+  }
+  driver_ready = true;
+  return ESP_OK;
+}
+
+esp_err_t export_manager_serve(int timeout_ms)
+{
+  esp_err_t err = driver_init();
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to install USB Serial/JTAG driver: %s",
+             esp_err_to_name(err));
+    return err;
+  }
+
+  int64_t deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000LL;
+  for (;;)
+  {
+    int64_t left_ms = (deadline_us - esp_timer_get_time()) / 1000LL;
+    if (left_ms <= 0)
+      break;
+
+    if (exporting)
+    {
+      export_step();
+      continue;
+    }
+
+    uint8_t c;
+    if (usb_serial_jtag_read_bytes(&c, 1, pdMS_TO_TICKS(left_ms)) != 1)
+      continue;
+    if (c == '\n')
+    {
+      handle_line();
+      line_len = 0;
+    }
+    else if (line_len < sizeof(line) - 1)
+      line[line_len++] = (char)c;
+    else
+      line_len = 0; // Too long for a request, drop it
+  }
+  return ESP_OK;
+}
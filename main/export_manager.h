@@ -0,0 +1,38 @@
+#ifndef EXPORT_MANAGER_H
+#define EXPORT_MANAGER_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frame types, see export_manager.c for the layout */
+#define EXPORT_FRAME_INFO 1
+#define EXPORT_FRAME_BLOCK 2
+#define EXPORT_FRAME_END 3
+#define EXPORT_FRAME_ERROR 4
+#define EXPORT_FRAME_TRACE 5
+
+#define EXPORT_VERSION 2
+
+/**
+ * @brief Answer export requests on the USB Serial/JTAG port
+ *
+ * Installs the driver on the first call and then reads request lines
+ * until the timeout. An export streams the log blocks as they are on
+ * flash, without decoding them; if it runs past the timeout it goes on
+ * from the same block on the next call. Only call this while USB is
+ * connected, it keeps the CPU out of sleep for the whole timeout.
+ *
+ * @param timeout_ms How long to serve requests
+ * @return esp_err_t ESP_OK, or the error installing the driver
+ */
+esp_err_t export_manager_serve(int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EXPORT_MANAGER_H
@@ -0,0 +1,197 @@
+#include "i2c_bus_manager.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "I2C_BUS_MGR";
+
+/* I2C Configuration defaults if not in menuconfig */
+#ifndef CONFIG_I2C_MASTER_SDA
+#define I2C_MASTER_SDA_IO 20
+#else
+#define I2C_MASTER_SDA_IO CONFIG_I2C_MASTER_SDA
+#endif
+
+#ifndef CONFIG_I2C_MASTER_SCL
+#define I2C_MASTER_SCL_IO 19
+#else
+#define I2C_MASTER_SCL_IO CONFIG_I2C_MASTER_SCL
+#endif
+
+#define I2C_MASTER_NUM I2C_NUM_0
+
+#define SENSOR_IDLE_BIT BIT0 // No sensor claim held or waiting
+
+static i2c_master_bus_handle_t i2c_bus_handle = NULL;
+static SemaphoreHandle_t bus_lock = NULL;   // Held for one transaction
+static SemaphoreHandle_t state_lock = NULL; // Guards sensor_claims
+static EventGroupHandle_t bus_events = NULL;
+static int sensor_claims; // Sensor claims held or waiting
+
+esp_err_t i2c_bus_manager_init(void)
+{
+  if (i2c_bus_handle != NULL)
+    return ESP_OK;
+
+  bus_lock = xSemaphoreCreateMutex();
+  state_lock = xSemaphoreCreateMutex();
+  bus_events = xEventGroupCreate();
+  if (bus_lock == NULL || state_lock == NULL || bus_events == NULL)
+  {
+    ESP_LOGE(TAG, "Failed to create bus locks");
+    return ESP_ERR_NO_MEM;
+  }
+  xEventGroupSetBits(bus_events, SENSOR_IDLE_BIT);
+
+  i2c_master_bus_config_t bus_config = {
+      .i2c_port = I2C_MASTER_NUM,
+      .sda_io_num = I2C_MASTER_SDA_IO,
+      .scl_io_num = I2C_MASTER_SCL_IO,
+      .clk_source = I2C_CLK_SRC_DEFAULT,
+      .glitch_ignore_cnt = 7,
+      .flags.enable_internal_pullup = true,
+  };
+
+  esp_err_t ret = i2c_new_master_bus(&bus_config, &i2c_bus_handle);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to create I2C bus");
+    i2c_bus_handle = NULL;
+  }
+  return ret;
+}
+
+i2c_master_bus_handle_t i2c_bus_manager_get_handle(void)
+{
+  return i2c_bus_handle;
+}
+
+static TickType_t to_ticks(int timeout_ms)
+{
+  return timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+}
+
+static void sensor_claim_done(void)
+{
+  xSemaphoreTake(state_lock, portMAX_DELAY);
+  if (--sensor_claims == 0)
+    xEventGroupSetBits(bus_events, SENSOR_IDLE_BIT);
+  xSemaphoreGive(state_lock);
+}
+
+bool i2c_bus_manager_acquire(i2c_bus_prio_t prio, int timeout_ms)
+{
+  // Not set up (e.g. before init), the driver's own bus lock still applies
+  if (bus_lock == NULL)
+    return true;
+
+  if (prio == I2C_BUS_PRIO_SENSOR)
+  {
+    // Announce first, so display claims stop queueing up behind us
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    sensor_claims++;
+    xEventGroupClearBits(bus_events, SENSOR_IDLE_BIT);
+    xSemaphoreGive(state_lock);
+
+    if (xSemaphoreTake(bus_lock, to_ticks(timeout_ms)) != pdTRUE)
+    {
+      sensor_claim_done();
+      return false;
+    }
+    return true;
+  }
+
+  TickType_t start = xTaskGetTickCount();
+  TickType_t limit = to_ticks(timeout_ms);
+  for (;;)
+  {
+    TickType_t waited = xTaskGetTickCount() - start;
+    TickType_t left = limit == portMAX_DELAY ? portMAX_DELAY
+                      : waited < limit       ? limit - waited
+                                             : 0;
+    if (!(xEventGroupWaitBits(bus_events, SENSOR_IDLE_BIT, pdFALSE, pdTRUE,
+                              left) &
+          SENSOR_IDLE_BIT))
+      return false;
+    if (xSemaphoreTake(bus_lock, left) != pdTRUE)
+      return false;
+
+    // A sensor claim may have come in while we waited for the lock
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    bool clear = sensor_claims == 0;
+    xSemaphoreGive(state_lock);
+    if (clear)
+      return true;
+    xSemaphoreGive(bus_lock);
+  }
+}
+
+void i2c_bus_manager_release(i2c_bus_prio_t prio)
+{
+  if (bus_lock == NULL)
+    return;
+
+  xSemaphoreGive(bus_lock);
+  if (prio == I2C_BUS_PRIO_SENSOR)
+    sensor_claim_done();
+}
+
+/*
+ * Link-time wrappers (-Wl,--wrap in main/CMakeLists.txt) for the calls the
+ * bsec2 component makes on its BME680 device. The display goes through
+ * i2c_master_multi_buffer_transmit and claims the bus itself.
+ */
+esp_err_t __real_i2c_master_transmit(i2c_master_dev_handle_t dev,
+                                     const uint8_t *write_buffer,
+                                     size_t write_size, int xfer_timeout_ms);
+esp_err_t __real_i2c_master_receive(i2c_master_dev_handle_t dev,
+                                    uint8_t *read_buffer, size_t read_size,
+                                    int xfer_timeout_ms);
+esp_err_t __real_i2c_master_transmit_receive(i2c_master_dev_handle_t dev,
+                                             const uint8_t *write_buffer,
+                                             size_t write_size,
+                                             uint8_t *read_buffer,
+                                             size_t read_size,
+                                             int xfer_timeout_ms);
+
+esp_err_t __wrap_i2c_master_transmit(i2c_master_dev_handle_t dev,
+                                     const uint8_t *write_buffer,
+                                     size_t write_size, int xfer_timeout_ms)
+{
+  if (!i2c_bus_manager_acquire(I2C_BUS_PRIO_SENSOR, xfer_timeout_ms))
+    return ESP_ERR_TIMEOUT;
+  esp_err_t ret = __real_i2c_master_transmit(dev, write_buffer, write_size,
+                                             xfer_timeout_ms);
+  i2c_bus_manager_release(I2C_BUS_PRIO_SENSOR);
+  return ret;
+}
+
+esp_err_t __wrap_i2c_master_receive(i2c_master_dev_handle_t dev,
+                                    uint8_t *read_buffer, size_t read_size,
+                                    int xfer_timeout_ms)
+{
+  if (!i2c_bus_manager_acquire(I2C_BUS_PRIO_SENSOR, xfer_timeout_ms))
+    return ESP_ERR_TIMEOUT;
+  esp_err_t ret =
+      __real_i2c_master_receive(dev, read_buffer, read_size, xfer_timeout_ms);
+  i2c_bus_manager_release(I2C_BUS_PRIO_SENSOR);
+  return ret;
+}
+
+esp_err_t __wrap_i2c_master_transmit_receive(i2c_master_dev_handle_t dev,
+                                             const uint8_t *write_buffer,
+                                             size_t write_size,
+                                             uint8_t *read_buffer,
+                                             size_t read_size,
+                                             int xfer_timeout_ms)
+{
+  if (!i2c_bus_manager_acquire(I2C_BUS_PRIO_SENSOR, xfer_timeout_ms))
+    return ESP_ERR_TIMEOUT;
+  esp_err_t ret = __real_i2c_master_transmit_receive(
+      dev, write_buffer, write_size, read_buffer, read_size, xfer_timeout_ms);
+  i2c_bus_manager_release(I2C_BUS_PRIO_SENSOR);
+  return ret;
+}
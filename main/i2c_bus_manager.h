@@ -0,0 +1,53 @@
+#ifndef I2C_BUS_MANAGER_H
+#define I2C_BUS_MANAGER_H
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  I2C_BUS_PRIO_SENSOR,  // BME680 register access, BSEC timing depends on it
+  I2C_BUS_PRIO_DISPLAY, // Frame data, fills the gaps
+} i2c_bus_prio_t;
+
+/**
+ * @brief Create the shared I2C master bus (display + BME680)
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t i2c_bus_manager_init(void);
+
+/**
+ * @brief Get the I2C bus handle
+ */
+i2c_master_bus_handle_t i2c_bus_manager_get_handle(void);
+
+/**
+ * @brief Take the bus for one transaction
+ *
+ * Sensor claims go ahead of every display claim still waiting, a sensor
+ * transaction waits for at most the one display transaction in flight.
+ * The BME680 traffic from the bsec2 component is routed through here by
+ * wrapping the i2c_master transmit/receive calls at link time.
+ *
+ * @param prio Client class
+ * @param timeout_ms How long to wait, -1 for ever
+ * @return true if the bus was taken
+ */
+bool i2c_bus_manager_acquire(i2c_bus_prio_t prio, int timeout_ms);
+
+/**
+ * @brief Give the bus back after i2c_bus_manager_acquire()
+ */
+void i2c_bus_manager_release(i2c_bus_prio_t prio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // I2C_BUS_MANAGER_H
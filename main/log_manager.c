@@ -0,0 +1,985 @@
+#include "log_manager.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "wifi_time_manager.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "LOG_MGR";
+
+/*
+ * Flash layout
+ * ------------
+ * The storage partition is used as a ring of 4 KB sectors. Every sector
+ * starts with a header holding the sequence number of its first record and
+ * the log epoch, followed by compressed blocks packed back to back. A block holds the
+ * samples of one flush: a block header with the sequence range and a CRC,
+ * then the samples run through ts_codec. A block never spans two sectors.
+ * Sectors are only ever appended to and are erased right before they are
+ * reused.
+ *
+ * Because sector first_seq values increase along the ring, the newest sector
+ * is found with a binary search over the headers. Its free space starts
+ * after the last block, found by walking the block headers.
+ *
+ * The epoch is a random number drawn whenever a new log is started at
+ * sequence number 0. Readers that keep a cursor (the upload collector, the
+ * host export) compare it to tell a restarted log from the one they know.
+ *
+ * Summaries
+ * ---------
+ * Every block header carries a log_summary_t of its samples. When the head
+ * moves on, the summary of the whole sector is programmed into the still
+ * erased tail of its sector header, so the sector headers form a sparse
+ * index with one entry per 4 KB. The partition is memory mapped; a time
+ * range query reads that index, descends into block summaries only for the
+ * sectors at the edges of the range and decodes only the edge blocks.
+ *
+ * Staging
+ * -------
+ * Samples are first collected in RTC memory, which survives deep sleep. Once
+ * the buffer is nearly full they are encoded into one block and written in
+ * one burst. Between 300 s samples a block costs 10-16 bytes per sample
+ * instead of 32. The recovered write head is cached next to the buffer so
+ * warm wakes never have to search the flash.
+ */
+#define LOG_PARTITION_LABEL "storage"
+#define LOG_SECTOR_SIZE 4096
+#define LOG_SECTOR_MAGIC 0x34474C48 // "HLG4"
+#define LOG_BLOCK_MAGIC 0x4B42      // "BK"
+#define LOG_RTC_MAGIC 0x34474F4C    // "LOG4"
+#define LOG_BLOCK_ALIGN 4
+
+#define LOG_STAGE_CAPACITY LOG_BLOCK_MAX_SAMPLES // Samples held in RTC memory
+#define LOG_STAGE_FLUSH_LEVEL 28 // Flush once this many samples are staged
+
+typedef struct __attribute__((packed))
+{
+  uint32_t sum_crc;  // CRC32 over sum
+  log_summary_t sum; // Samples of the whole sector
+} log_sector_seal_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint32_t first_seq;     // Sequence number of the first record in the sector
+  uint32_t epoch;         // Log instance, the same in every sector
+  uint32_t crc;           // CRC32 over magic, first_seq and epoch
+  log_sector_seal_t seal; // Left erased until the sector is full
+} log_sector_hdr_t;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  uint16_t len;       // Encoded bytes following the header
+  uint32_t first_seq; // Sequence number of the first sample
+  uint16_t count;     // Samples in the block
+  uint16_t reserved;  // Written as 0xFFFF
+  log_summary_t sum;  // Samples of the block
+  uint32_t crc;       // CRC32 over the header up to here and the data
+} log_block_hdr_t;
+
+typedef struct
+{
+  uint32_t magic;
+  bool head_valid;         // Head fields below match the flash contents
+  uint32_t epoch;          // Of the log on flash
+  uint32_t head_sector;    // Sector currently being filled
+  uint32_t head_offset;    // Next free byte in head_sector
+  uint32_t next_seq;       // Sequence number of the next flushed sample
+  uint32_t tail_sector;    // Oldest sector still holding records
+  uint32_t tail_first_seq; // first_seq of tail_sector
+  log_summary_t head_sum;  // Blocks written to head_sector so far
+  uint32_t stage_count;
+  log_sample_t stage[LOG_STAGE_CAPACITY];
+} log_rtc_state_t;
+
+_Static_assert(sizeof(log_sample_t) == 24, "log_sample_t must be 24 bytes");
+_Static_assert(sizeof(log_sector_hdr_t) == 64, "sector header must be 64 bytes");
+_Static_assert(sizeof(log_block_hdr_t) == 16 + sizeof(log_summary_t),
+               "block header must not be padded");
+_Static_assert(sizeof(log_sector_hdr_t) + sizeof(log_block_hdr_t) +
+                       LOG_BLOCK_DATA_MAX <=
+                   LOG_SECTOR_SIZE,
+               "a full block must fit into an empty sector");
+
+static RTC_DATA_ATTR log_rtc_state_t rtc_log;
+
+static const esp_partition_t *log_partition = NULL;
+static uint32_t sector_count;
+static const uint8_t *log_map = NULL; // Whole partition, NULL if unmapped
+static esp_partition_mmap_handle_t log_map_handle;
+
+// One flush burst: an optional sector header, the block header and its data
+static uint8_t burst_buf[sizeof(log_sector_hdr_t) + sizeof(log_block_hdr_t) +
+                         LOG_BLOCK_DATA_MAX];
+
+// Iterator behind log_manager_read()
+static log_iter_t read_iter;
+
+// Edge block of a range query
+static uint8_t query_data[LOG_BLOCK_DATA_MAX];
+
+static void rtc_state_check(void)
+{
+  if (rtc_log.magic != LOG_RTC_MAGIC)
+  {
+    memset(&rtc_log, 0, sizeof(rtc_log));
+    rtc_log.magic = LOG_RTC_MAGIC;
+  }
+}
+
+static size_t sector_offset(uint32_t sector, uint32_t offset)
+{
+  return (size_t)sector * LOG_SECTOR_SIZE + offset;
+}
+
+// Reads go through the mapping when there is one, it is much cheaper than
+// a flash read for the many small headers.
+static esp_err_t flash_read(size_t offset, void *out, size_t len)
+{
+  if (log_map != NULL)
+  {
+    memcpy(out, log_map + offset, len);
+    return ESP_OK;
+  }
+  return esp_partition_read(log_partition, offset, out, len);
+}
+
+static uint32_t clamp_u16(float value)
+{
+  if (value <= 0.0f)
+    return 0;
+  if (value >= 65535.0f)
+    return 65535;
+  return (uint32_t)lroundf(value);
+}
+
+static int32_t clamp_i16(float value)
+{
+  if (value <= -32768.0f)
+    return -32768;
+  if (value >= 32767.0f)
+    return 32767;
+  return (int32_t)lroundf(value);
+}
+
+static void summary_init(log_summary_t *sum)
+{
+  memset(sum, 0, sizeof(*sum));
+  sum->t_min = UINT32_MAX;
+  for (int ch = 0; ch < LOG_SUM_CHANNELS; ch++)
+  {
+    sum->min[ch] = INT16_MAX;
+    sum->max[ch] = INT16_MIN;
+  }
+}
+
+static void summary_add(log_summary_t *sum, const log_sample_t *s)
+{
+  if (s->timestamp < sum->t_min)
+    sum->t_min = s->timestamp;
+  if (s->timestamp > sum->t_max)
+    sum->t_max = s->timestamp;
+  if (!(s->flags & LOG_FLAG_VALID))
+    return;
+
+  int16_t v[LOG_SUM_CHANNELS];
+  v[LOG_SUM_TEMPERATURE] = s->temperature_cc;
+  v[LOG_SUM_HUMIDITY] = (int16_t)clamp_i16(s->humidity_cp);
+  v[LOG_SUM_IAQ] = (int16_t)clamp_i16(s->iaq_x10);
+  v[LOG_SUM_PRESSURE] =
+      isfinite(s->pressure) ? (int16_t)clamp_i16(s->pressure * 10.0f) : 0;
+  for (int ch = 0; ch < LOG_SUM_CHANNELS; ch++)
+  {
+    if (v[ch] < sum->min[ch])
+      sum->min[ch] = v[ch];
+    if (v[ch] > sum->max[ch])
+      sum->max[ch] = v[ch];
+    sum->sum[ch] += v[ch];
+  }
+  sum->count++;
+}
+
+static void summary_merge(log_summary_t *dst, const log_summary_t *src)
+{
+  if (src->t_min < dst->t_min)
+    dst->t_min = src->t_min;
+  if (src->t_max > dst->t_max)
+    dst->t_max = src->t_max;
+  if (src->count == 0)
+    return;
+  for (int ch = 0; ch < LOG_SUM_CHANNELS; ch++)
+  {
+    if (src->min[ch] < dst->min[ch])
+      dst->min[ch] = src->min[ch];
+    if (src->max[ch] > dst->max[ch])
+      dst->max[ch] = src->max[ch];
+    dst->sum[ch] += src->sum[ch];
+  }
+  dst->count += src->count;
+}
+
+// Every sample of sum lies in [t_from, t_to)
+static bool summary_inside(const log_summary_t *sum, uint32_t t_from,
+                           uint32_t t_to)
+{
+  return sum->t_min >= t_from && sum->t_max < t_to;
+}
+
+// No sample of sum lies in [t_from, t_to), also true for an empty summary
+static bool summary_outside(const log_summary_t *sum, uint32_t t_from,
+                            uint32_t t_to)
+{
+  return sum->t_max < t_from || sum->t_min >= t_to;
+}
+
+static uint32_t block_size(uint32_t len)
+{
+  uint32_t size = sizeof(log_block_hdr_t) + len;
+  return (size + LOG_BLOCK_ALIGN - 1) & ~(uint32_t)(LOG_BLOCK_ALIGN - 1);
+}
+
+static uint32_t block_crc(const log_block_hdr_t *hdr, const uint8_t *data)
+{
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)hdr,
+                                  offsetof(log_block_hdr_t, crc));
+  return esp_rom_crc32_le(crc, data, hdr->len);
+}
+
+static void build_sector_hdr(log_sector_hdr_t *hdr, uint32_t first_seq)
+{
+  memset(hdr, 0xFF, sizeof(*hdr));
+  hdr->magic = LOG_SECTOR_MAGIC;
+  hdr->first_seq = first_seq;
+  hdr->epoch = rtc_log.epoch;
+  hdr->crc = esp_rom_crc32_le(0, (const uint8_t *)hdr,
+                              offsetof(log_sector_hdr_t, crc));
+}
+
+static bool read_sector_hdr(uint32_t sector, log_sector_hdr_t *hdr)
+{
+  if (flash_read(sector_offset(sector, 0), hdr, sizeof(*hdr)) != ESP_OK)
+    return false;
+  if (hdr->magic != LOG_SECTOR_MAGIC)
+    return false;
+  return hdr->crc == esp_rom_crc32_le(0, (const uint8_t *)hdr,
+                                      offsetof(log_sector_hdr_t, crc));
+}
+
+static esp_err_t erase_sector(uint32_t sector)
+{
+  esp_err_t err = esp_partition_erase_range(
+      log_partition, (size_t)sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Sector %lu erase failed: %s", (unsigned long)sector,
+             esp_err_to_name(err));
+  }
+  return err;
+}
+
+static bool hdr_is_erased(const log_block_hdr_t *hdr)
+{
+  const uint8_t *bytes = (const uint8_t *)hdr;
+  for (size_t i = 0; i < sizeof(*hdr); i++)
+  {
+    if (bytes[i] != 0xFF)
+      return false;
+  }
+  return true;
+}
+
+// Block header that is complete enough to step over, the data may be torn
+static bool block_hdr_usable(const log_block_hdr_t *hdr, uint32_t offset)
+{
+  return hdr->magic == LOG_BLOCK_MAGIC && hdr->count > 0 &&
+         hdr->count <= LOG_BLOCK_MAX_SAMPLES && hdr->len <= LOG_BLOCK_DATA_MAX &&
+         offset + block_size(hdr->len) <= LOG_SECTOR_SIZE;
+}
+
+// Walk the blocks of a sector, returns the offset of its free space
+static uint32_t find_free_offset(uint32_t sector, uint32_t first_seq,
+                                 uint32_t *next_seq, log_summary_t *sum)
+{
+  uint32_t offset = sizeof(log_sector_hdr_t);
+  *next_seq = first_seq;
+  summary_init(sum);
+  while (offset + sizeof(log_block_hdr_t) <= LOG_SECTOR_SIZE)
+  {
+    log_block_hdr_t hdr;
+    if (flash_read(sector_offset(sector, offset), &hdr, sizeof(hdr)) != ESP_OK)
+      break;
+    if (hdr_is_erased(&hdr))
+      return offset;
+
+    // A header torn before it was complete leaves no way to find the next
+    // one, the rest of the sector is given up.
+    if (!block_hdr_usable(&hdr, offset) || hdr.first_seq != *next_seq)
+      break;
+    *next_seq = hdr.first_seq + hdr.count;
+    summary_merge(sum, &hdr.sum);
+    offset += block_size(hdr.len);
+  }
+  return LOG_SECTOR_SIZE;
+}
+
+static esp_err_t recover_head(void)
+{
+  log_sector_hdr_t base_hdr;
+  uint32_t base = 0;
+
+  // Sector 0 is only invalid on a fresh partition or when power was lost
+  // between erasing it and writing its header after a wrap.
+  if (!read_sector_hdr(0, &base_hdr))
+  {
+    base = 1;
+    if (sector_count < 2 || !read_sector_hdr(1, &base_hdr))
+    {
+      ESP_LOGI(TAG, "No log found, starting a new one");
+      esp_err_t err = erase_sector(0);
+      if (err != ESP_OK)
+        return err;
+      rtc_log.epoch = esp_random();
+      build_sector_hdr(&base_hdr, 0);
+      err = esp_partition_write(log_partition, 0, &base_hdr, sizeof(base_hdr));
+      if (err != ESP_OK)
+        return err;
+      rtc_log.head_sector = 0;
+      rtc_log.head_offset = sizeof(log_sector_hdr_t);
+      rtc_log.next_seq = 0;
+      rtc_log.tail_sector = 0;
+      rtc_log.tail_first_seq = 0;
+      summary_init(&rtc_log.head_sum);
+      rtc_log.head_valid = true;
+      return ESP_OK;
+    }
+  }
+
+  // Sectors base..head belong to the newest lap: valid, of the same log and
+  // not older than base. Everything after head is erased or from the
+  // previous lap.
+  rtc_log.epoch = base_hdr.epoch;
+  uint32_t lo = base;
+  uint32_t hi = sector_count;
+  while (hi - lo > 1)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    log_sector_hdr_t hdr;
+    if (read_sector_hdr(mid, &hdr) && hdr.epoch == base_hdr.epoch &&
+        hdr.first_seq >= base_hdr.first_seq)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  log_sector_hdr_t head_hdr;
+  read_sector_hdr(lo, &head_hdr);
+  rtc_log.head_sector = lo;
+  rtc_log.head_offset = find_free_offset(lo, head_hdr.first_seq,
+                                         &rtc_log.next_seq, &rtc_log.head_sum);
+
+  // The oldest sector follows the head, unless its erase was interrupted,
+  // in which case the one after it is the oldest.
+  rtc_log.tail_sector = base;
+  rtc_log.tail_first_seq = base_hdr.first_seq;
+  for (uint32_t i = 1; i <= 2 && i < sector_count; i++)
+  {
+    uint32_t sector = (lo + i) % sector_count;
+    log_sector_hdr_t hdr;
+    if (read_sector_hdr(sector, &hdr))
+    {
+      if (hdr.epoch == base_hdr.epoch && hdr.first_seq < head_hdr.first_seq)
+      {
+        rtc_log.tail_sector = sector;
+        rtc_log.tail_first_seq = hdr.first_seq;
+      }
+      break;
+    }
+  }
+  rtc_log.head_valid = true;
+
+  ESP_LOGI(TAG, "Log %08lx head: sector %lu offset %lu, records %lu..%lu",
+           (unsigned long)rtc_log.epoch, (unsigned long)rtc_log.head_sector,
+           (unsigned long)rtc_log.head_offset,
+           (unsigned long)rtc_log.tail_first_seq,
+           (unsigned long)rtc_log.next_seq - 1);
+  return ESP_OK;
+}
+
+esp_err_t log_manager_init(void)
+{
+  rtc_state_check();
+  if (log_partition != NULL)
+    return ESP_OK;
+
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, LOG_PARTITION_LABEL);
+  if (part == NULL)
+  {
+    ESP_LOGE(TAG, "Partition '%s' not found", LOG_PARTITION_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  log_partition = part;
+  sector_count = part->size / LOG_SECTOR_SIZE;
+  if (sector_count == 0)
+  {
+    log_partition = NULL;
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  const void *map;
+  if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &map,
+                         &log_map_handle) == ESP_OK)
+    log_map = map;
+  else
+    ESP_LOGW(TAG, "Partition not mapped, reading through the flash driver");
+
+  if (rtc_log.head_valid && rtc_log.head_sector < sector_count)
+  {
+    ESP_LOGI(TAG, "Log head restored from RTC (%lu staged)",
+             (unsigned long)rtc_log.stage_count);
+    return ESP_OK;
+  }
+
+  esp_err_t err = recover_head();
+  if (err != ESP_OK)
+  {
+    if (log_map != NULL)
+      esp_partition_munmap(log_map_handle);
+    log_map = NULL;
+    log_partition = NULL;
+  }
+  return err;
+}
+
+static void point_from_sample(const log_sample_t *s, ts_codec_point_t *pt)
+{
+  pt->timestamp = s->timestamp;
+  pt->ints[0] = s->temperature_cc;
+  pt->ints[1] = s->humidity_cp;
+  pt->ints[2] = s->iaq_x10;
+  pt->ints[3] = s->battery_mv;
+  pt->ints[4] = s->iaq_accuracy;
+  pt->ints[5] = s->flags;
+  memcpy(&pt->floats[0], &s->pressure, sizeof(float));
+  memcpy(&pt->floats[1], &s->gas_resistance, sizeof(float));
+}
+
+static void sample_from_point(const ts_codec_point_t *pt, log_sample_t *s)
+{
+  s->timestamp = pt->timestamp;
+  s->temperature_cc = (int16_t)pt->ints[0];
+  s->humidity_cp = (uint16_t)pt->ints[1];
+  s->iaq_x10 = (uint16_t)pt->ints[2];
+  s->battery_mv = (uint16_t)pt->ints[3];
+  s->iaq_accuracy = (uint8_t)pt->ints[4];
+  s->flags = (uint8_t)pt->ints[5];
+  memcpy(&s->pressure, &pt->floats[0], sizeof(float));
+  memcpy(&s->gas_resistance, &pt->floats[1], sizeof(float));
+  s->reserved = 0xFFFF;
+}
+
+// Program the summary into the sector header, a failure only costs speed
+static void seal_sector(uint32_t sector, const log_summary_t *sum)
+{
+  log_sector_seal_t seal = {.sum = *sum};
+  seal.sum_crc = esp_rom_crc32_le(0, (const uint8_t *)&seal.sum,
+                                  sizeof(seal.sum));
+  esp_partition_write(log_partition,
+                      sector_offset(sector, offsetof(log_sector_hdr_t, seal)),
+                      &seal, sizeof(seal));
+}
+
+static bool read_seal(const log_sector_hdr_t *hdr, log_summary_t *sum)
+{
+  *sum = hdr->seal.sum;
+  return hdr->seal.sum_crc ==
+         esp_rom_crc32_le(0, (const uint8_t *)sum, sizeof(*sum));
+}
+
+// Move the head to a freshly erased sector, dropping the oldest one if needed
+static esp_err_t advance_sector(void)
+{
+  log_sector_hdr_t hdr;
+  log_summary_t sealed;
+  if (read_sector_hdr(rtc_log.head_sector, &hdr) && !read_seal(&hdr, &sealed))
+    seal_sector(rtc_log.head_sector, &rtc_log.head_sum);
+
+  uint32_t next = (rtc_log.head_sector + 1) % sector_count;
+  esp_err_t err = erase_sector(next);
+  if (err != ESP_OK)
+    return err;
+
+  if (next == rtc_log.tail_sector)
+  {
+    rtc_log.tail_sector = (next + 1) % sector_count;
+    rtc_log.tail_first_seq = read_sector_hdr(rtc_log.tail_sector, &hdr)
+                                 ? hdr.first_seq
+                                 : rtc_log.next_seq;
+  }
+  rtc_log.head_sector = next;
+  rtc_log.head_offset = 0;
+  summary_init(&rtc_log.head_sum);
+  return ESP_OK;
+}
+
+static esp_err_t write_staged(uint32_t count)
+{
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+
+  uint8_t *data = burst_buf + sizeof(log_sector_hdr_t) + sizeof(log_block_hdr_t);
+  ts_encoder_t enc;
+  ts_encoder_init(&enc, data, LOG_BLOCK_DATA_MAX);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    ts_codec_point_t pt;
+    point_from_sample(&rtc_log.stage[i], &pt);
+    ts_encoder_add(&enc, &pt); // Sized for a full stage, cannot fail
+  }
+
+  log_block_hdr_t *hdr =
+      (log_block_hdr_t *)(burst_buf + sizeof(log_sector_hdr_t));
+  hdr->magic = LOG_BLOCK_MAGIC;
+  hdr->len = (uint16_t)ts_encoder_bytes(&enc);
+  hdr->first_seq = rtc_log.next_seq;
+  hdr->count = (uint16_t)count;
+  hdr->reserved = 0xFFFF;
+  summary_init(&hdr->sum);
+  for (uint32_t i = 0; i < count; i++)
+    summary_add(&hdr->sum, &rtc_log.stage[i]);
+  hdr->crc = block_crc(hdr, data);
+
+  uint32_t size = block_size(hdr->len);
+  memset(data + hdr->len, 0xFF, size - sizeof(*hdr) - hdr->len);
+
+  uint8_t *start = (uint8_t *)hdr;
+  if (rtc_log.head_offset + size > LOG_SECTOR_SIZE)
+  {
+    esp_err_t err = advance_sector();
+    if (err != ESP_OK)
+      return err;
+    build_sector_hdr((log_sector_hdr_t *)burst_buf, rtc_log.next_seq);
+    start = burst_buf;
+    size += sizeof(log_sector_hdr_t);
+  }
+
+  // The space and the sequence numbers are consumed even if the write fails
+  // half way, recovery would skip the torn block the same way.
+  size_t offset = sector_offset(rtc_log.head_sector, rtc_log.head_offset);
+  rtc_log.head_offset += size;
+  rtc_log.next_seq += count;
+  esp_err_t err = esp_partition_write(log_partition, offset, start, size);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Log write failed: %s", esp_err_to_name(err));
+    return err;
+  }
+  summary_merge(&rtc_log.head_sum, &hdr->sum);
+  return ESP_OK;
+}
+
+static esp_err_t flush_staged(uint32_t count)
+{
+  esp_err_t err = write_staged(count);
+  if (err == ESP_OK)
+  {
+    rtc_log.stage_count -= count;
+    memmove(&rtc_log.stage[0], &rtc_log.stage[count],
+            rtc_log.stage_count * sizeof(log_sample_t));
+    ESP_LOGI(TAG, "Flushed %lu samples, next record %lu", (unsigned long)count,
+             (unsigned long)rtc_log.next_seq);
+  }
+  return err;
+}
+
+esp_err_t log_manager_flush(void)
+{
+  rtc_state_check();
+  if (rtc_log.stage_count == 0)
+    return ESP_OK;
+  return flush_staged(rtc_log.stage_count);
+}
+
+uint32_t log_manager_get_staged_count(void)
+{
+  rtc_state_check();
+  return rtc_log.stage_count;
+}
+
+esp_err_t log_manager_append(const latest_data_t *data)
+{
+  rtc_state_check();
+
+  if (rtc_log.stage_count >= LOG_STAGE_CAPACITY)
+  {
+    // Flash has been failing for a while, keep the newest samples
+    ESP_LOGW(TAG, "Staging buffer full, dropping oldest sample");
+    rtc_log.stage_count--;
+    memmove(&rtc_log.stage[0], &rtc_log.stage[1],
+            rtc_log.stage_count * sizeof(log_sample_t));
+  }
+
+  log_sample_t *s = &rtc_log.stage[rtc_log.stage_count++];
+  *s = (log_sample_t){
+      .timestamp = (uint32_t)wifi_time_manager_time(),
+      .temperature_cc = (int16_t)clamp_i16(data->temperature * 100.0f),
+      .humidity_cp = (uint16_t)clamp_u16(data->humidity * 100.0f),
+      .iaq_x10 = (uint16_t)clamp_u16(data->iaq * 10.0f),
+      .battery_mv = (uint16_t)clamp_u16((float)data->battery_voltage_mv),
+      .pressure = data->pressure,
+      .gas_resistance = data->gas_resistance,
+      .iaq_accuracy = (uint8_t)data->iaq_accuracy,
+      .flags = 0,
+      .reserved = 0xFFFF,
+  };
+  if (data->valid)
+    s->flags |= LOG_FLAG_VALID;
+  if (data->is_bsec)
+    s->flags |= LOG_FLAG_BSEC;
+  if (data->stabilization_status)
+    s->flags |= LOG_FLAG_STABILIZED;
+  if (data->run_in_status)
+    s->flags |= LOG_FLAG_RUN_IN;
+  if (!wifi_time_manager_is_synced())
+    s->flags |= LOG_FLAG_UNSYNCED;
+
+  if (rtc_log.stage_count < LOG_STAGE_FLUSH_LEVEL)
+    return ESP_OK;
+  return flush_staged(rtc_log.stage_count);
+}
+
+// Sector holding seq: the last one from the tail whose first_seq <= seq
+static uint32_t find_sector(uint32_t seq)
+{
+  uint32_t used =
+      (rtc_log.head_sector + sector_count - rtc_log.tail_sector) % sector_count;
+  uint32_t lo = 0;
+  uint32_t hi = used + 1;
+  while (hi - lo > 1)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    log_sector_hdr_t hdr;
+    if (read_sector_hdr((rtc_log.tail_sector + mid) % sector_count, &hdr) &&
+        (int32_t)(seq - hdr.first_seq) >= 0)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return (rtc_log.tail_sector + lo) % sector_count;
+}
+
+// Load the block at the iterator position, stepping to the next sector at
+// the end of one. The decoder is left at the first sample of the block.
+static esp_err_t load_block(log_iter_t *it)
+{
+  while (true)
+  {
+    log_block_hdr_t hdr;
+    bool have = false;
+    if (it->offset + sizeof(hdr) <= LOG_SECTOR_SIZE &&
+        flash_read(sector_offset(it->sector, it->offset), &hdr, sizeof(hdr)) ==
+            ESP_OK)
+      have = block_hdr_usable(&hdr, it->offset);
+
+    if (!have)
+    {
+      if (it->sector == rtc_log.head_sector)
+        return ESP_ERR_NOT_FOUND;
+      it->sector = (it->sector + 1) % sector_count;
+      it->offset = sizeof(log_sector_hdr_t);
+      continue;
+    }
+
+    uint32_t offset = it->offset;
+    it->offset += block_size(hdr.len);
+    if ((int32_t)(hdr.first_seq + hdr.count - it->seq) <= 0)
+      continue; // Entirely before the wanted record
+
+    // Records lost to a torn block are skipped
+    if ((int32_t)(hdr.first_seq - it->seq) > 0)
+      it->seq = hdr.first_seq;
+    it->block_seq = hdr.first_seq;
+    it->block_end = hdr.first_seq + hdr.count;
+
+    esp_err_t err = flash_read(sector_offset(it->sector, offset + sizeof(hdr)),
+                               it->data, hdr.len);
+    if (err != ESP_OK)
+      return err;
+    if (hdr.crc != block_crc(&hdr, it->data))
+    {
+      it->seq = it->block_end;
+      it->block_seq = it->block_end;
+      return ESP_ERR_INVALID_CRC;
+    }
+    ts_decoder_init(&it->dec, it->data, hdr.len);
+    return ESP_OK;
+  }
+}
+
+esp_err_t log_manager_iter_init(log_iter_t *it, uint32_t seq)
+{
+  memset(it, 0, sizeof(*it));
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+
+  if ((int32_t)(seq - rtc_log.tail_first_seq) < 0)
+    seq = rtc_log.tail_first_seq;
+  it->seq = seq;
+  it->block_seq = seq;
+  it->block_end = seq; // No block loaded yet
+  it->sector = find_sector(seq);
+  it->offset = sizeof(log_sector_hdr_t);
+  return ESP_OK;
+}
+
+esp_err_t log_manager_iter_next(log_iter_t *it, log_record_t *out)
+{
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+
+  while (true)
+  {
+    if ((int32_t)(it->seq - rtc_log.next_seq) >= 0)
+      return ESP_ERR_NOT_FOUND;
+
+    if (it->block_seq == it->block_end)
+    {
+      esp_err_t err = load_block(it);
+      if (err != ESP_OK)
+        return err;
+    }
+
+    ts_codec_point_t pt;
+    if (!ts_decoder_next(&it->dec, &pt))
+    {
+      // Passed the CRC but does not decode, give up on the rest
+      it->seq = it->block_end;
+      it->block_seq = it->block_end;
+      return ESP_ERR_INVALID_CRC;
+    }
+    uint32_t seq = it->block_seq++;
+    if ((int32_t)(seq - it->seq) < 0)
+      continue; // Decoding up to the wanted record
+
+    out->seq = seq;
+    sample_from_point(&pt, &out->sample);
+    it->seq = seq + 1;
+    return ESP_OK;
+  }
+}
+
+esp_err_t log_manager_iter_next_block(log_iter_t *it, uint32_t *first_seq,
+                                      uint32_t *count, size_t *len)
+{
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+  if ((int32_t)(it->seq - rtc_log.next_seq) >= 0)
+    return ESP_ERR_NOT_FOUND;
+
+  // Drop the rest of a block partly read record by record
+  if ((int32_t)(it->seq - it->block_end) < 0)
+    it->seq = it->block_end;
+  it->block_seq = it->block_end;
+
+  esp_err_t err = load_block(it);
+  if (err != ESP_OK)
+    return err;
+  *first_seq = it->block_seq;
+  *count = it->block_end - it->block_seq;
+  *len = it->dec.len;
+  it->seq = it->block_end;
+  it->block_seq = it->block_end;
+  return ESP_OK;
+}
+
+esp_err_t log_manager_read(uint32_t seq, log_record_t *out)
+{
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+  if ((int32_t)(seq - rtc_log.tail_first_seq) < 0 ||
+      (int32_t)(seq - rtc_log.next_seq) >= 0)
+    return ESP_ERR_NOT_FOUND;
+
+  esp_err_t err = log_manager_iter_init(&read_iter, seq);
+  if (err == ESP_OK)
+    err = log_manager_iter_next(&read_iter, out);
+  if (err == ESP_OK && out->seq != seq)
+    err = ESP_ERR_INVALID_CRC; // Lost to a torn block
+  return err;
+}
+
+void log_manager_get_range(uint32_t *first_seq, uint32_t *next_seq)
+{
+  if (first_seq)
+    *first_seq = rtc_log.tail_first_seq;
+  if (next_seq)
+    *next_seq = rtc_log.next_seq;
+}
+
+uint32_t log_manager_get_epoch(void)
+{
+  return rtc_log.epoch;
+}
+
+// Add the samples of one block that fall into [t_from, t_to)
+static void query_block(uint32_t sector, uint32_t offset,
+                        const log_block_hdr_t *hdr, uint32_t t_from,
+                        uint32_t t_to, log_summary_t *out)
+{
+  if (summary_outside(&hdr->sum, t_from, t_to))
+    return;
+  if (summary_inside(&hdr->sum, t_from, t_to))
+  {
+    summary_merge(out, &hdr->sum);
+    return;
+  }
+
+  // Edge block, only here samples are decoded
+  if (flash_read(sector_offset(sector, offset + sizeof(*hdr)), query_data,
+                 hdr->len) != ESP_OK ||
+      hdr->crc != block_crc(hdr, query_data))
+    return;
+  ts_decoder_t dec;
+  ts_decoder_init(&dec, query_data, hdr->len);
+  for (uint32_t i = 0; i < hdr->count; i++)
+  {
+    ts_codec_point_t pt;
+    if (!ts_decoder_next(&dec, &pt))
+      break;
+    log_sample_t s;
+    sample_from_point(&pt, &s);
+    if (s.timestamp >= t_from && s.timestamp < t_to)
+      summary_add(out, &s);
+  }
+}
+
+// Summary of a sector, from its seal or for the head from RTC memory
+static bool sector_summary(uint32_t sector, log_summary_t *sum)
+{
+  log_sector_hdr_t hdr;
+  if (!read_sector_hdr(sector, &hdr))
+    return false;
+  if (sector == rtc_log.head_sector)
+  {
+    *sum = rtc_log.head_sum;
+    return true;
+  }
+  return read_seal(&hdr, sum);
+}
+
+// Read the block headers of a sector until fn returns true
+static bool walk_blocks(uint32_t sector,
+                        bool (*fn)(uint32_t sector, uint32_t offset,
+                                   const log_block_hdr_t *hdr, void *arg),
+                        void *arg)
+{
+  uint32_t end =
+      sector == rtc_log.head_sector ? rtc_log.head_offset : LOG_SECTOR_SIZE;
+  uint32_t offset = sizeof(log_sector_hdr_t);
+  while (offset + sizeof(log_block_hdr_t) <= end)
+  {
+    log_block_hdr_t hdr;
+    if (flash_read(sector_offset(sector, offset), &hdr, sizeof(hdr)) !=
+            ESP_OK ||
+        !block_hdr_usable(&hdr, offset))
+      break;
+    if (fn(sector, offset, &hdr, arg))
+      return true;
+    offset += block_size(hdr.len);
+  }
+  return false;
+}
+
+typedef struct
+{
+  uint32_t t_from;
+  uint32_t t_to;
+  log_summary_t *out;
+} query_arg_t;
+
+static bool query_fn(uint32_t sector, uint32_t offset,
+                     const log_block_hdr_t *hdr, void *arg)
+{
+  query_arg_t *q = arg;
+  query_block(sector, offset, hdr, q->t_from, q->t_to, q->out);
+  return false;
+}
+
+esp_err_t log_manager_query(uint32_t t_from, uint32_t t_to, log_summary_t *out)
+{
+  summary_init(out);
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+
+  query_arg_t q = {.t_from = t_from, .t_to = t_to, .out = out};
+  uint32_t used =
+      (rtc_log.head_sector + sector_count - rtc_log.tail_sector) % sector_count;
+  for (uint32_t i = 0; i <= used; i++)
+  {
+    uint32_t sector = (rtc_log.tail_sector + i) % sector_count;
+    log_summary_t sum;
+    if (sector_summary(sector, &sum))
+    {
+      if (summary_outside(&sum, t_from, t_to))
+        continue;
+      if (summary_inside(&sum, t_from, t_to))
+      {
+        summary_merge(out, &sum);
+        continue;
+      }
+    }
+    walk_blocks(sector, query_fn, &q);
+  }
+
+  for (uint32_t i = 0; i < rtc_log.stage_count; i++)
+  {
+    const log_sample_t *s = &rtc_log.stage[i];
+    if (s->timestamp >= t_from && s->timestamp < t_to)
+      summary_add(out, s);
+  }
+  return ESP_OK;
+}
+
+typedef struct
+{
+  uint32_t t;
+  uint32_t *seq;
+} find_arg_t;
+
+static bool find_fn(uint32_t sector, uint32_t offset,
+                    const log_block_hdr_t *hdr, void *arg)
+{
+  find_arg_t *f = arg;
+  if (hdr->sum.t_max < f->t)
+    return false;
+  *f->seq = hdr->first_seq;
+  return true;
+}
+
+esp_err_t log_manager_find_time(uint32_t t, uint32_t *seq)
+{
+  if (log_partition == NULL || !rtc_log.head_valid)
+    return ESP_ERR_INVALID_STATE;
+
+  find_arg_t f = {.t = t, .seq = seq};
+  uint32_t used =
+      (rtc_log.head_sector + sector_count - rtc_log.tail_sector) % sector_count;
+  for (uint32_t i = 0; i <= used; i++)
+  {
+    uint32_t sector = (rtc_log.tail_sector + i) % sector_count;
+    log_summary_t sum;
+    if (sector_summary(sector, &sum) && sum.t_max < t)
+      continue;
+    if (walk_blocks(sector, find_fn, &f))
+      return ESP_OK;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
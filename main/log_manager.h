@@ -0,0 +1,232 @@
+#ifndef LOG_MANAGER_H
+#define LOG_MANAGER_H
+
+#include "common_data.h"
+#include "esp_err.h"
+#include "ts_codec.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record flags */
+#define LOG_FLAG_VALID (1 << 0)     // latest_data.valid was set
+#define LOG_FLAG_BSEC (1 << 1)      // Values came from BSEC (not raw fallback)
+#define LOG_FLAG_STABILIZED (1 << 2) // BSEC stabilization finished
+#define LOG_FLAG_RUN_IN (1 << 3)     // BSEC run-in finished
+#define LOG_FLAG_UNSYNCED (1 << 4)   // Timestamp from the RTC before any time sync
+
+/**
+ * @brief One sample in compact form (24 bytes)
+ *
+ * Physical values are stored as scaled integers where the range allows it,
+ * pressure and gas resistance are kept as floats.
+ */
+typedef struct __attribute__((packed))
+{
+  uint32_t timestamp;     // Unix time in seconds
+  int16_t temperature_cc; // Temperature in 0.01 C
+  uint16_t humidity_cp;   // Humidity in 0.01 %
+  uint16_t iaq_x10;       // IAQ in 0.1 steps
+  uint16_t battery_mv;    // Battery voltage in mV
+  float pressure;         // Pressure, same unit as latest_data.pressure
+  float gas_resistance;   // Gas resistance in Ohm
+  uint8_t iaq_accuracy;   // BSEC IAQ accuracy 0-3
+  uint8_t flags;          // LOG_FLAG_* bits
+  uint16_t reserved;      // Written as 0xFFFF
+} log_sample_t;
+
+/**
+ * @brief One sample with its place in the log
+ */
+typedef struct
+{
+  uint32_t seq;        // Monotonic record sequence number
+  log_sample_t sample; // Sample values
+} log_record_t;
+
+/* Channels kept in a log_summary_t */
+typedef enum
+{
+  LOG_SUM_TEMPERATURE, // 0.01 C
+  LOG_SUM_HUMIDITY,    // 0.01 %
+  LOG_SUM_IAQ,         // 0.1 steps
+  LOG_SUM_PRESSURE,    // 0.1 of the latest_data.pressure unit
+  LOG_SUM_CHANNELS,
+} log_sum_channel_t;
+
+/**
+ * @brief Aggregate over a set of samples (44 bytes)
+ *
+ * The time range covers every sample, min/max/sum only those with
+ * LOG_FLAG_VALID. An empty summary has t_min > t_max.
+ */
+typedef struct __attribute__((packed))
+{
+  uint32_t t_min;                  // Oldest timestamp
+  uint32_t t_max;                  // Newest timestamp
+  uint32_t count;                  // Valid samples
+  int16_t min[LOG_SUM_CHANNELS];
+  int16_t max[LOG_SUM_CHANNELS];
+  int32_t sum[LOG_SUM_CHANNELS];
+} log_summary_t;
+
+/* Samples per flash block and the worst case size of their encoding */
+#define LOG_BLOCK_MAX_SAMPLES 32
+#define LOG_BLOCK_DATA_MAX (LOG_BLOCK_MAX_SAMPLES * TS_CODEC_MAX_POINT_BYTES)
+
+/**
+ * @brief Position of a sequential read over the log
+ *
+ * Holds one decoded block, so keep it out of small task stacks.
+ */
+typedef struct
+{
+  uint32_t seq;       // Sequence number the next read returns (at least)
+  uint32_t sector;    // Sector of the next block
+  uint32_t offset;    // Offset of the next block in sector
+  uint32_t block_seq; // Sequence number of the next sample in the block
+  uint32_t block_end; // One past the last sample of the block
+  ts_decoder_t dec;
+  uint8_t data[LOG_BLOCK_DATA_MAX];
+} log_iter_t;
+
+/**
+ * @brief Locate the storage partition and recover the write head
+ *
+ * The write head is cached in RTC memory, so the flash search only runs
+ * after a cold boot.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_manager_init(void);
+
+/**
+ * @brief Stage a sample built from the given data
+ *
+ * Samples are kept in RTC memory across deep sleep and written to flash as
+ * one compressed block once the staging buffer is nearly full.
+ *
+ * @param data Sample to store
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_manager_append(const latest_data_t *data);
+
+/**
+ * @brief Write all staged samples to flash now
+ *
+ * Call when the battery is low or before exporting the log.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_manager_flush(void);
+
+/**
+ * @brief Get the number of samples waiting in RTC memory
+ */
+uint32_t log_manager_get_staged_count(void);
+
+/**
+ * @brief Read a record by sequence number
+ *
+ * Decodes its block up to the record, use an iterator to read a range.
+ *
+ * @param seq Sequence number, must be within the range from
+ *            log_manager_get_range()
+ * @param out Record buffer
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the record was
+ *         overwritten or not yet written, ESP_ERR_INVALID_CRC if it is torn
+ */
+esp_err_t log_manager_read(uint32_t seq, log_record_t *out);
+
+/**
+ * @brief Start reading the log at a sequence number
+ *
+ * Older records than the oldest one still on flash start at that one.
+ *
+ * @param it Iterator to set up
+ * @param seq First sequence number to return
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_manager_iter_init(log_iter_t *it, uint32_t seq);
+
+/**
+ * @brief Read the next record
+ *
+ * Every block is decoded once, so reading a range costs one flash read per
+ * block instead of per record.
+ *
+ * @param it Iterator from log_manager_iter_init()
+ * @param out Record buffer
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND past the newest
+ *         record, ESP_ERR_INVALID_CRC once for every torn block that was
+ *         skipped
+ */
+esp_err_t log_manager_iter_next(log_iter_t *it, log_record_t *out);
+
+/**
+ * @brief Read the next block without decoding it
+ *
+ * On success it->data holds len bytes of ts_codec data for the records
+ * first_seq..first_seq + count - 1. The first block may start before the
+ * sequence number the iterator was set up with.
+ *
+ * @param it Iterator from log_manager_iter_init()
+ * @param first_seq Sequence number of the first record in the block
+ * @param count Records in the block
+ * @param len Encoded bytes in it->data
+ * @return esp_err_t Like log_manager_iter_next()
+ */
+esp_err_t log_manager_iter_next_block(log_iter_t *it, uint32_t *first_seq,
+                                      uint32_t *count, size_t *len);
+
+/**
+ * @brief Aggregate every sample with a timestamp in [t_from, t_to)
+ *
+ * Whole sectors and blocks inside the range are taken from their stored
+ * summaries, only blocks straddling its ends are decoded. Staged samples
+ * are included.
+ *
+ * @param t_from Start of the range, Unix time
+ * @param t_to End of the range (exclusive)
+ * @param out Summary of the range
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t log_manager_query(uint32_t t_from, uint32_t t_to, log_summary_t *out);
+
+/**
+ * @brief Find where to start reading for samples from time t on
+ *
+ * @param t Unix time
+ * @param seq First sequence number of the oldest block with a sample at or
+ *            after t, earlier samples of that block may precede it
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if no flushed
+ *         sample is that new
+ */
+esp_err_t log_manager_find_time(uint32_t t, uint32_t *seq);
+
+/**
+ * @brief Get the sequence range currently held on flash
+ *
+ * Staged samples are not included until they are flushed.
+ *
+ * @param first_seq Oldest readable sequence number
+ * @param next_seq Sequence number the next flushed sample will get
+ */
+void log_manager_get_range(uint32_t *first_seq, uint32_t *next_seq);
+
+/**
+ * @brief Get the epoch of the log on flash
+ *
+ * Drawn at random whenever the log starts over at sequence number 0, so a
+ * sequence number is only meaningful together with the epoch it came from.
+ * Valid after log_manager_init().
+ */
+uint32_t log_manager_get_epoch(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_MANAGER_H
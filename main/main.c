@@ -1,11 +1,18 @@
 #include "bme680_manager.h"
 #include "common_data.c"
 #include "driver/gpio.h"
+#include "driver/usb_serial_jtag.h"
 #include "esp_log.h"
+#include "export_manager.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "i2c_bus_manager.h"
+#include "log_manager.h"
+#include "rollup_manager.h"
+#include "sleep_manager.h"
 #include "u8g2_manager.h"
 #include "vbat_driver.h"
+#include "wake_trace.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
@@ -13,8 +20,16 @@
 #define BME68X_USE_FPU
 static const char *TAG = "main";
 
+// Below this battery voltage staged data is written to flash every wake
+#define LOW_BATTERY_MV 3500
+
+// Back-off when BSEC has no call scheduled ahead (init or run failed)
+#define SAMPLE_RETRY_MS 2000
+
+#include "esp_attr.h"
 #include "esp_pm.h"
 #include "esp_sleep.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
 #include "wifi_time_manager.h"
 
@@ -24,7 +39,103 @@ int64_t getCurNs() {
   return ((int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_usec * 1000LL);
 }
 
+// After a sample the 24 h or 7 d trend, in turn, shows for a moment, then
+// the current values come back and stay up through the sleep. Fast samples
+// (LP on USB) only get a trend now and then.
+#define HISTORY_HOLD_MS 3000
+#define HISTORY_INTERVAL_S 60
+static RTC_DATA_ATTR uint8_t history_turn;
+static RTC_DATA_ATTR int64_t history_last_ns;
+static int64_t history_until_ns; // Values go back up then, 0 if they are up
+
+static void draw_values(void) {
+  u8g2_manager_draw_ui(latest_data.battery_voltage_mv, latest_data.temperature,
+                       latest_data.humidity, latest_data.iaq,
+                       latest_data.iaq_accuracy);
+}
+
+static void draw_screen(void) {
+  // Trends are wall clock buckets, empty before the first sync. A clock
+  // stepped back doesn't hold them off.
+  int64_t now = getCurNs();
+  if (!wifi_time_manager_is_synced() ||
+      (now >= history_last_ns &&
+       now - history_last_ns < HISTORY_INTERVAL_S * 1000000000LL)) {
+    draw_values();
+    return;
+  }
+  u8g2_manager_draw_history(history_turn++ % 2 ? ROLLUP_SPARK_7D
+                                                : ROLLUP_SPARK_24H);
+  history_last_ns = now;
+  history_until_ns = now + HISTORY_HOLD_MS * 1000000LL;
+}
+
+// Values back up once the trend has been shown, but never past the deadline
+static void end_history(int64_t deadline_ns) {
+  if (history_until_ns == 0)
+    return;
+  // The trend frame may still be going out, light sleep would cut it off
+  u8g2_manager_wait_idle();
+  sleep_manager_wait_until(history_until_ns < deadline_ns ? history_until_ns
+                                                          : deadline_ns);
+  history_until_ns = 0;
+  draw_values();
+}
+
+// Set right before our own deep sleep, so a timer wake can trust RTC state
+#define BOOT_SLEEP_MARKER 0x534C5052 // "SLPR"
+static RTC_DATA_ATTR uint32_t boot_sleep_marker;
+
+// A warm boot is a timer wake from the deep sleep at the end of app_main,
+// everything else (power-on, reset, panic, brown-out) takes the cold path.
+static bool is_warm_boot(void) {
+  bool warm = esp_reset_reason() == ESP_RST_DEEPSLEEP &&
+              esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER &&
+              boot_sleep_marker == BOOT_SLEEP_MARKER;
+  boot_sleep_marker = 0;
+  return warm;
+}
+
+static void cold_boot_init(void) {
+  // Initialize the Display manager (also initializes I2C)
+  if (u8g2_manager_init(false) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to initialize display");
+  }
+
+  // The RTC may still hold the time across a reset, the sync itself runs in
+  // the background once the sampling loop is going
+  wifi_time_manager_set_timezone();
+
+  u8g2_manager_print_status("Init Sensor...");
+
+  // Initialize NVS
+  wake_trace_begin(WAKE_PHASE_NVS_INIT);
+  esp_err_t ret = nvs_flash_init();
+  if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+      ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    ret = nvs_flash_init();
+  }
+  ESP_ERROR_CHECK(ret);
+  wake_trace_end(WAKE_PHASE_NVS_INIT);
+}
+
+static void warm_boot_init(void) {
+  // The panel kept running and showing the last frame through deep sleep
+  if (u8g2_manager_init(true) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to initialize display");
+  }
+
+  // The RTC kept the synced time, only the timezone is lost
+  wifi_time_manager_set_timezone();
+
+  // NVS is opened lazily, only if the BSEC state has to be written
+}
+
 void app_main(void) {
+  bool warm_boot = is_warm_boot();
+  wake_trace_begin_cycle(warm_boot);
+
   // Initialize Power Management (Auto Light Sleep)
   esp_pm_config_t pm_config = {.max_freq_mhz = 80,
                                .min_freq_mhz = 40,
@@ -34,25 +145,17 @@ void app_main(void) {
   };
   ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
 
-  // Initialize the Display manager (also initializes I2C)
-  if (u8g2_manager_init() != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to initialize display");
+  ESP_LOGI(TAG, "%s boot", warm_boot ? "Warm" : "Cold");
+  // Cold boot init brings up the display the first status screens go to,
+  // warm boot init is independent of the sensor and runs during the first
+  // measurement
+  if (!warm_boot) {
+    wake_trace_begin(WAKE_PHASE_BOOT_INIT);
+    cold_boot_init();
+    wake_trace_end(WAKE_PHASE_BOOT_INIT);
   }
 
-  // Initialize WiFi & SNTP
-  u8g2_manager_print_status("Checking Time...");
-  if (wifi_time_manager_init() != ESP_OK) {
-    ESP_LOGE(TAG, "Time Sync Failed - Aborting BSEC run");
-    u8g2_manager_print_status("Time Sync Fail!");
-    vTaskDelay(pdMS_TO_TICKS(5000));
-    // Sleep for a short time to retry later
-    esp_sleep_enable_timer_wakeup(10 * 1000000ULL);
-    esp_deep_sleep_start();
-    return;
-  }
-
-  // Initialize the ADC driver
-  ESP_ERROR_CHECK(vbat_driver_init());
+  ESP_ERROR_CHECK(i2c_bus_manager_init());
 
   gpio_reset_pin(18);
   gpio_set_direction(18, GPIO_MODE_OUTPUT);
@@ -64,86 +167,177 @@ void app_main(void) {
   // ... rest of the code ... (keeping user's init logic)
 
   // Initialize BME680
-  u8g2_manager_print_status("Init Sensor...");
-  i2c_master_bus_handle_t bus_handle = u8g2_manager_get_i2c_bus_handle();
-
-  // Initialize NVS
-  esp_err_t ret = nvs_flash_init();
-  if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
-      ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-    ESP_ERROR_CHECK(nvs_flash_erase());
-    ret = nvs_flash_init();
-  }
-  ESP_ERROR_CHECK(ret);
+  i2c_master_bus_handle_t bus_handle = i2c_bus_manager_get_handle();
 
   if (bme680_manager_init(bus_handle) != ESP_OK) {
     ESP_LOGE(TAG, "Failed to initialize BME680");
   }
 
-  // Read calibrated battery voltage into struct
-  vbat_driver_read();
-
   latest_data.valid = false;
   latest_data.is_bsec = false;
-// Try to get data with extended timeout (10s)
-a:
-  ESP_LOGI(TAG, "diff:%lld", getCurNs() - bme680_manager_get_next_call_ns());
-  if (getCurNs() >= bme680_manager_get_next_call_ns()) {
-    if (bme680_manager_run() == ESP_OK)
-      ESP_LOGI(TAG, "BSEC run good");
-  } else
-    ESP_LOGW(TAG, "yanlış uyuyon amınakodumun malı");
-
-  if (latest_data.valid) {
-    ESP_LOGI(TAG, "BSEC Data Acquired");
-    // Pass unified data to display
-    u8g2_manager_draw_ui(latest_data.battery_voltage_mv,
-                         latest_data.temperature, latest_data.humidity,
-                         latest_data.iaq, latest_data.iaq_accuracy);
-  } else {
-    ESP_LOGW(TAG, "BSEC Data NOT Ready");
-    // Only display battery if sensor fails
-    char bat_str[16];
-    snprintf(bat_str, sizeof(bat_str), "Bat: %dmV",
-             latest_data.battery_voltage_mv);
-    u8g2_manager_print_status(bat_str);
-  }
 
-  if (latest_data.is_bsec) {
-    // display all sensors
-    ESP_LOGI(TAG, "IAQ: %f", latest_data.iaq);
-    ESP_LOGI(TAG, "IAQ Accuracy: %d", latest_data.iaq_accuracy);
-    ESP_LOGI(TAG, "Temperature: %f", latest_data.temperature);
-    ESP_LOGI(TAG, "Humidity: %f", latest_data.humidity);
-    ESP_LOGI(TAG, "Pressure: %f", latest_data.pressure);
-    ESP_LOGI(TAG, "Gas Resistance: %f", latest_data.gas_resistance);
-    ESP_LOGI(TAG, "Stabilization Status: %d", latest_data.stabilization_status);
-    ESP_LOGI(TAG, "Run-in Status: %d", latest_data.run_in_status);
-  }
-  //  u8g2_manager_print_status("deepsleep...");
-  //  vTaskDelay(pdMS_TO_TICKS(500)); // Short delay to show message
+  // Stay up across short BSEC intervals (LP mode), deep sleep across long
+  // ones. Every pass starts at or after next_call.
+  int64_t sleep_duration_us;
+  int64_t deadline_ns;
+  bool battery_low;
+  bool first_pass = true;
+  for (;;) {
+    // Deep sleep wakes are aimed a bit early, measure by how much and wait
+    // out the rest so the call lands on next_call
+    sleep_manager_wake_ready(warm_boot);
+    int64_t early_us =
+        (bme680_manager_get_next_call_ns() - getCurNs()) / 1000LL;
+    if (early_us > 0 && sleep_manager_select(early_us) != SLEEP_MODE_DEEP)
+      sleep_manager_wait_until(bme680_manager_get_next_call_ns());
+
+    ESP_LOGI(TAG, "diff:%lld", getCurNs() - bme680_manager_get_next_call_ns());
+    bool due = getCurNs() >= bme680_manager_get_next_call_ns();
+    if (due) {
+      // valid is set again by the BSEC callback only if a sample was taken
+      latest_data.valid = false;
+      bme680_manager_run_start();
+    }
+
+    // Work that doesn't need the sensor runs while it converts
+    if (first_pass) {
+      if (warm_boot) {
+        wake_trace_begin(WAKE_PHASE_BOOT_INIT);
+        warm_boot_init();
+        wake_trace_end(WAKE_PHASE_BOOT_INIT);
+      }
+
+      // Initialize the ADC driver
+      ESP_ERROR_CHECK(vbat_driver_init());
+
+      // Open the sample log on the storage partition
+      if (log_manager_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize sample log");
+      }
+      if (rollup_manager_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize rollups");
+      }
+      first_pass = false;
+    }
+
+    // Only if due and not backed off, sampling goes on on RTC time meanwhile
+    wifi_time_manager_sync_start();
+
+    // Read calibrated battery voltage into struct
+    vbat_driver_read();
+
+    if (due) {
+      if (bme680_manager_run_join() == ESP_OK)
+        ESP_LOGI(TAG, "BSEC run good");
+      if (latest_data.valid) {
+        wake_trace_begin(WAKE_PHASE_LOG);
+        log_manager_append(&latest_data);
+        rollup_manager_update(&latest_data);
+        wake_trace_end(WAKE_PHASE_LOG);
+      }
+    } else
+      ESP_LOGW(TAG, "yanlış uyuyon amınakodumun malı");
 
-  // Calculate sleep time based on BSEC next call (nanoseconds)
-  int64_t next_call_ns = bme680_manager_get_next_call_ns();
+    if (latest_data.valid) {
+      ESP_LOGI(TAG, "BSEC Data Acquired");
+      // Pass unified data to display
+      draw_screen();
+    } else {
+      ESP_LOGW(TAG, "BSEC Data NOT Ready");
+      // Only display battery if sensor fails
+      char bat_str[16];
+      snprintf(bat_str, sizeof(bat_str), "Bat: %dmV",
+               latest_data.battery_voltage_mv);
+      u8g2_manager_print_status(bat_str);
+    }
 
-  int64_t now_ns = getCurNs();
+    if (latest_data.is_bsec) {
+      // display all sensors
+      ESP_LOGI(TAG, "IAQ: %f", latest_data.iaq);
+      ESP_LOGI(TAG, "IAQ Accuracy: %d", latest_data.iaq_accuracy);
+      ESP_LOGI(TAG, "Temperature: %f", latest_data.temperature);
+      ESP_LOGI(TAG, "Humidity: %f", latest_data.humidity);
+      ESP_LOGI(TAG, "Pressure: %f", latest_data.pressure);
+      ESP_LOGI(TAG, "Gas Resistance: %f", latest_data.gas_resistance);
+      ESP_LOGI(TAG, "Stabilization Status: %d",
+               latest_data.stabilization_status);
+      ESP_LOGI(TAG, "Run-in Status: %d", latest_data.run_in_status);
+    }
 
-  // Calculate remaining time in microseconds for esp_sleep
-  int64_t sleep_duration_us = (next_call_ns - now_ns) / 1000LL;
+    // Sample fast while on USB power, the battery only affords ULP. Without
+    // an LP configuration built in this stays on ULP
+    bsec_config_id_t config = usb_serial_jtag_is_connected() ? BSEC_CONFIG_LP
+                                                             : BSEC_CONFIG_ULP;
+    bool switched = config != bme680_manager_get_config() &&
+                    bme680_manager_select_config(config) == ESP_OK;
 
-  // Safety clamp - if calculated time is invalid or too short, force safe 10sec
-  if (sleep_duration_us < 10000000) {
-    ESP_LOGE(TAG, "Calculated sleep duration too short (%lld us), forcing 2s",
-             sleep_duration_us);
-    vTaskDelay(pdMS_TO_TICKS(2000));
-    goto a;
+    // next_call only moves ahead on a good run. If it didn't (sensor init
+    // failed, BSEC returned early) retry later instead of spinning; after a
+    // switch the new configuration runs right away.
+    deadline_ns = bme680_manager_get_next_call_ns();
+    if (!switched && deadline_ns <= getCurNs()) {
+      ESP_LOGW(TAG, "No BSEC call scheduled, retrying in %d ms",
+               SAMPLE_RETRY_MS);
+      deadline_ns = getCurNs() + SAMPLE_RETRY_MS * 1000000LL;
+    }
+
+    // Deep sleep would cut a running sync short, wait for it but never past
+    // the deadline; the next pass samples on time if it isn't done by then
+    if (wifi_time_manager_sync_busy()) {
+      int64_t wait_ms = (deadline_ns - getCurNs()) / 1000000LL;
+      wifi_time_manager_sync_wait(wait_ms > 0 ? (int)wait_ms : 0);
+    }
+
+    // A sync wait above already counts towards the time a trend is shown
+    end_history(deadline_ns);
+
+    // On USB power the time until the deadline goes to answering export
+    // requests from the host instead of sleeping
+    if (usb_serial_jtag_is_connected()) {
+      int64_t wait_ms = (deadline_ns - getCurNs()) / 1000000LL;
+      if (wait_ms > 0)
+        export_manager_serve((int)wait_ms);
+    }
+
+    // Calculate remaining time in microseconds for esp_sleep
+    sleep_duration_us = (deadline_ns - getCurNs()) / 1000LL;
+
+    // Don't risk losing staged samples or BSEC state if the battery may not
+    // last until the next wake
+    battery_low = latest_data.battery_voltage_mv > 0 &&
+                  latest_data.battery_voltage_mv < LOW_BATTERY_MV;
+    if (battery_low) {
+      wake_trace_begin(WAKE_PHASE_LOG);
+      log_manager_flush();
+      wake_trace_end(WAKE_PHASE_LOG);
+    }
+
+    if (sleep_manager_select(sleep_duration_us) == SLEEP_MODE_DEEP)
+      break;
+
+    // Cheaper to stay booted: keep the RTC copy of the BSEC state fresh in
+    // case of a reset, then wake right at the deadline. Blocks at least a
+    // tick even if the deadline has passed.
+    bme680_manager_save_state(battery_low);
+    ESP_LOGI(TAG, "Light sleep (%lld us)", sleep_duration_us);
+    u8g2_manager_wait_idle();
+    wake_trace_end(WAKE_PHASE_WAKE);
+    sleep_manager_wait_until(deadline_ns);
+    wake_trace_begin_cycle(true);
   }
 
-  // Save BSEC state before sleeping
-  bme680_manager_save_state();
+  // Save BSEC state before sleeping, the frame is sent meanwhile
+  bme680_manager_save_state(battery_low);
+  u8g2_manager_wait_idle();
 
+  // Wake early by the measured boot latency
+  sleep_duration_us = sleep_manager_plan_deep_sleep(deadline_ns);
   ESP_LOGI(TAG, "Enabling Timer Wakeup (%lld us)", sleep_duration_us);
   esp_sleep_enable_timer_wakeup(sleep_duration_us);
 
+  boot_sleep_marker = BOOT_SLEEP_MARKER;
+
+  wake_trace_end(WAKE_PHASE_WAKE);
+
   esp_deep_sleep_start();
 }
@@ -0,0 +1,573 @@
+#include "rollup_manager.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "log_manager.h"
+#include "wifi_time_manager.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "ROLLUP_MGR";
+
+/*
+ * The open bucket of every level and a ring of recently closed ones live in
+ * RTC memory. Closed buckets are also appended to the rollup partition, a
+ * ring of fixed-size records: record n sits in slot n % slot_count, and a
+ * sector is erased right before its first slot is written. The newest record
+ * is found after a cold boot with a binary search for the slot where the
+ * sequence numbers stop following slot 0. The sparklines are not spilled,
+ * after RTC memory was lost they are rebuilt from the sample log instead.
+ */
+#define ROLLUP_PARTITION_LABEL "rollup"
+#define ROLLUP_SECTOR_SIZE 4096
+#define ROLLUP_RTC_MAGIC 0x324C4F52 // "ROL2"
+#define ROLLUP_ERASED_WORD 0xFFFFFFFF
+
+#define ROLLUP_MAX_HOLD_S 1800 // Longer gaps don't count towards iaq_area
+#define ROLLUP_HOUR_DEPTH 24   // Closed hours kept in RTC memory
+#define ROLLUP_DAY_DEPTH 7     // Closed days kept in RTC memory
+
+typedef struct __attribute__((packed))
+{
+  uint32_t seq;
+  uint8_t level;
+  uint8_t reserved[3]; // Written as 0xFF
+  rollup_bucket_t bucket;
+  uint32_t crc; // CRC32 over all preceding bytes
+} rollup_record_t;
+
+#define ROLLUP_SLOTS_PER_SECTOR (ROLLUP_SECTOR_SIZE / sizeof(rollup_record_t))
+
+typedef struct
+{
+  uint32_t period_s; // Nominal length, days may differ around DST changes
+  uint32_t depth;    // Closed buckets kept in RTC memory
+  uint32_t base;     // First entry in rtc_rollup.ring
+} rollup_level_info_t;
+
+static const rollup_level_info_t level_info[ROLLUP_LEVELS] = {
+    [ROLLUP_HOUR] = {3600, ROLLUP_HOUR_DEPTH, 0},
+    [ROLLUP_DAY] = {86400, ROLLUP_DAY_DEPTH, ROLLUP_HOUR_DEPTH},
+};
+
+/* Channels kept for the sparklines */
+static const rollup_channel_t spark_channels[] = {
+    ROLLUP_TEMPERATURE,
+    ROLLUP_HUMIDITY,
+    ROLLUP_IAQ,
+};
+#define ROLLUP_SPARK_CHANNELS                                                  \
+  (sizeof(spark_channels) / sizeof(spark_channels[0]))
+
+/* The same channels in a log summary, scaled alike */
+static const log_sum_channel_t spark_log_channels[ROLLUP_SPARK_CHANNELS] = {
+    LOG_SUM_TEMPERATURE,
+    LOG_SUM_HUMIDITY,
+    LOG_SUM_IAQ,
+};
+
+static const uint32_t spark_period_s[ROLLUP_SPARKS] = {
+    [ROLLUP_SPARK_24H] = 24 * 3600 / ROLLUP_SPARK_COLUMNS,
+    [ROLLUP_SPARK_7D] = 7 * 24 * 3600 / ROLLUP_SPARK_COLUMNS,
+};
+
+/*
+ * Closed columns sit at their column number modulo the width, so closing
+ * one never shifts the others. Columns skipped without a sample are marked
+ * empty when the next one opens.
+ */
+typedef struct
+{
+  uint32_t column; // Open column, Unix time / period
+  uint16_t count;
+  int32_t sum[ROLLUP_SPARK_CHANNELS];
+  int16_t mean[ROLLUP_SPARK_COLUMNS][ROLLUP_SPARK_CHANNELS];
+} rollup_spark_state_t;
+
+typedef struct
+{
+  uint32_t magic;
+  bool prev_valid;      // prev_t and prev_iaq hold the last sample
+  uint32_t prev_t;
+  int16_t prev_iaq;
+  rollup_bucket_t open[ROLLUP_LEVELS];
+  uint8_t ring_next[ROLLUP_LEVELS];  // Entry the next closed bucket goes to
+  uint8_t ring_count[ROLLUP_LEVELS];
+  rollup_bucket_t ring[ROLLUP_HOUR_DEPTH + ROLLUP_DAY_DEPTH];
+  bool spill_valid;     // spill_next matches the flash contents
+  uint32_t spill_next;  // Sequence number of the next spilled bucket
+  bool spark_restored;  // Sparklines rebuilt from the log since RTC loss
+  rollup_spark_state_t spark[ROLLUP_SPARKS];
+} rollup_rtc_state_t;
+
+_Static_assert(sizeof(rollup_bucket_t) == 64, "rollup_bucket_t must be 64 bytes");
+
+static RTC_DATA_ATTR rollup_rtc_state_t rtc_rollup;
+
+static const esp_partition_t *rollup_partition = NULL;
+static uint32_t slot_count;
+
+static void bucket_init(rollup_bucket_t *b, uint32_t start)
+{
+  memset(b, 0, sizeof(*b));
+  b->start = start;
+  b->reserved = 0xFFFF;
+  for (int ch = 0; ch < ROLLUP_CHANNELS; ch++)
+  {
+    b->min[ch] = INT16_MAX;
+    b->max[ch] = INT16_MIN;
+  }
+}
+
+static void spark_clear(rollup_spark_state_t *sp, uint32_t from, uint32_t n)
+{
+  for (uint32_t i = 0; i < n && i < ROLLUP_SPARK_COLUMNS; i++)
+  {
+    for (size_t c = 0; c < ROLLUP_SPARK_CHANNELS; c++)
+      sp->mean[(from + i) % ROLLUP_SPARK_COLUMNS][c] = ROLLUP_SPARK_EMPTY;
+  }
+}
+
+static void rtc_state_check(void)
+{
+  if (rtc_rollup.magic == ROLLUP_RTC_MAGIC)
+    return;
+
+  memset(&rtc_rollup, 0, sizeof(rtc_rollup));
+  for (int level = 0; level < ROLLUP_LEVELS; level++)
+    bucket_init(&rtc_rollup.open[level], 0);
+  for (int sp = 0; sp < ROLLUP_SPARKS; sp++)
+    spark_clear(&rtc_rollup.spark[sp], 0, ROLLUP_SPARK_COLUMNS);
+  rtc_rollup.magic = ROLLUP_RTC_MAGIC;
+}
+
+static size_t slot_offset(uint32_t slot)
+{
+  return (size_t)(slot / ROLLUP_SLOTS_PER_SECTOR) * ROLLUP_SECTOR_SIZE +
+         (slot % ROLLUP_SLOTS_PER_SECTOR) * sizeof(rollup_record_t);
+}
+
+static uint32_t record_crc(const rollup_record_t *rec)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)rec,
+                          offsetof(rollup_record_t, crc));
+}
+
+static bool read_record(uint32_t slot, rollup_record_t *rec)
+{
+  return esp_partition_read(rollup_partition, slot_offset(slot), rec,
+                            sizeof(*rec)) == ESP_OK;
+}
+
+static void ring_push(rollup_level_t level, const rollup_bucket_t *b)
+{
+  const rollup_level_info_t *info = &level_info[level];
+  rtc_rollup.ring[info->base + rtc_rollup.ring_next[level]] = *b;
+  rtc_rollup.ring_next[level] = (rtc_rollup.ring_next[level] + 1) % info->depth;
+  if (rtc_rollup.ring_count[level] < info->depth)
+    rtc_rollup.ring_count[level]++;
+}
+
+// Refill the RTC rings from the newest spilled records
+static void ring_restore(void)
+{
+  uint32_t first, next;
+  rollup_manager_get_spill_range(&first, &next);
+
+  // Walk back collecting newest first, then push oldest first
+  rollup_bucket_t found[ROLLUP_HOUR_DEPTH + ROLLUP_DAY_DEPTH];
+  uint32_t found_count[ROLLUP_LEVELS] = {0};
+  uint32_t limit = (ROLLUP_HOUR_DEPTH + 1) * ROLLUP_DAY_DEPTH;
+  for (uint32_t seq = next; seq != first && limit > 0; limit--)
+  {
+    seq--;
+    rollup_level_t level;
+    rollup_bucket_t b;
+    if (rollup_manager_read_spilled(seq, &level, &b) != ESP_OK)
+      continue;
+    const rollup_level_info_t *info = &level_info[level];
+    if (found_count[level] < info->depth)
+      found[info->base + found_count[level]++] = b;
+    if (found_count[ROLLUP_HOUR] == ROLLUP_HOUR_DEPTH &&
+        found_count[ROLLUP_DAY] == ROLLUP_DAY_DEPTH)
+      break;
+  }
+
+  for (int level = 0; level < ROLLUP_LEVELS; level++)
+  {
+    for (uint32_t i = found_count[level]; i > 0; i--)
+      ring_push(level, &found[level_info[level].base + i - 1]);
+  }
+  ESP_LOGI(TAG, "Restored %lu hours and %lu days from flash",
+           (unsigned long)found_count[ROLLUP_HOUR],
+           (unsigned long)found_count[ROLLUP_DAY]);
+}
+
+static void recover_spill(void)
+{
+  rollup_record_t rec;
+  uint32_t next = 0;
+
+  if (read_record(0, &rec) && rec.seq != ROLLUP_ERASED_WORD)
+  {
+    if (rec.seq % slot_count != 0 || rec.crc != record_crc(&rec))
+    {
+      // Not our format, the sectors get erased as they are reached
+      ESP_LOGW(TAG, "Unknown data in the rollup partition, starting over");
+    }
+    else
+    {
+      // Slots 0..lo continue slot 0, the rest is erased or a lap older
+      uint32_t base = rec.seq;
+      uint32_t lo = 0;
+      uint32_t hi = slot_count;
+      while (hi - lo > 1)
+      {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (read_record(mid, &rec) && rec.seq == base + mid)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      next = base + lo + 1;
+    }
+  }
+  else if (read_record(slot_count - 1, &rec) && rec.seq != ROLLUP_ERASED_WORD &&
+           rec.crc == record_crc(&rec))
+  {
+    // Power was lost right after erasing sector 0 on a wrap
+    next = rec.seq + 1;
+  }
+
+  rtc_rollup.spill_next = next;
+  rtc_rollup.spill_valid = true;
+  ESP_LOGI(TAG, "Rollup spill head at %lu", (unsigned long)next);
+}
+
+esp_err_t rollup_manager_init(void)
+{
+  rtc_state_check();
+  if (rollup_partition != NULL)
+    return ESP_OK;
+
+  const esp_partition_t *part =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                               ESP_PARTITION_SUBTYPE_ANY, ROLLUP_PARTITION_LABEL);
+  if (part == NULL)
+  {
+    ESP_LOGE(TAG, "Partition '%s' not found", ROLLUP_PARTITION_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+  slot_count = (part->size / ROLLUP_SECTOR_SIZE) * ROLLUP_SLOTS_PER_SECTOR;
+  if (slot_count < 2 * ROLLUP_SLOTS_PER_SECTOR)
+    return ESP_ERR_INVALID_SIZE;
+  rollup_partition = part;
+
+  if (rtc_rollup.spill_valid)
+    return ESP_OK;
+
+  recover_spill();
+  ring_restore();
+  return ESP_OK;
+}
+
+static void spill(rollup_level_t level, const rollup_bucket_t *b)
+{
+  if (rollup_partition == NULL || !rtc_rollup.spill_valid)
+    return;
+
+  uint32_t slot = rtc_rollup.spill_next % slot_count;
+  if (slot % ROLLUP_SLOTS_PER_SECTOR == 0)
+  {
+    esp_err_t err = esp_partition_erase_range(
+        rollup_partition, slot_offset(slot), ROLLUP_SECTOR_SIZE);
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Rollup erase failed: %s", esp_err_to_name(err));
+      return;
+    }
+  }
+
+  rollup_record_t rec;
+  rec.seq = rtc_rollup.spill_next;
+  rec.level = (uint8_t)level;
+  memset(rec.reserved, 0xFF, sizeof(rec.reserved));
+  rec.bucket = *b;
+  rec.crc = record_crc(&rec);
+
+  // The slot is consumed even if the write fails half way
+  rtc_rollup.spill_next++;
+  esp_err_t err = esp_partition_write(rollup_partition, slot_offset(slot), &rec,
+                                      sizeof(rec));
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Rollup write failed: %s", esp_err_to_name(err));
+}
+
+static int16_t clamp_i16(float value)
+{
+  if (!isfinite(value))
+    return 0;
+  if (value <= -32768.0f)
+    return INT16_MIN;
+  if (value >= 32767.0f)
+    return INT16_MAX;
+  return (int16_t)lroundf(value);
+}
+
+// Credit the IAQ held over [from, to) to the part of it inside the bucket
+static void hold_iaq(rollup_bucket_t *b, uint32_t period_s, uint32_t from,
+                     uint32_t to, int16_t iaq)
+{
+  uint32_t end = b->start + period_s;
+  uint32_t lo = from > b->start ? from : b->start;
+  uint32_t hi = to < end ? to : end;
+  if (hi <= lo)
+    return;
+  b->iaq_area += (int32_t)iaq * (int32_t)(hi - lo);
+  b->iaq_span += hi - lo;
+}
+
+static int16_t spark_open_mean(const rollup_spark_state_t *sp, size_t c)
+{
+  if (sp->count == 0)
+    return ROLLUP_SPARK_EMPTY;
+  return (int16_t)(sp->sum[c] / sp->count);
+}
+
+static void spark_update(rollup_spark_state_t *sp, uint32_t period_s,
+                         uint32_t t, const int16_t *v)
+{
+  uint32_t column = t / period_s;
+  if (column != sp->column)
+  {
+    for (size_t c = 0; c < ROLLUP_SPARK_CHANNELS; c++)
+      sp->mean[sp->column % ROLLUP_SPARK_COLUMNS][c] = spark_open_mean(sp, c);
+
+    // A step back in time leaves nothing in place
+    if (column < sp->column)
+      spark_clear(sp, 0, ROLLUP_SPARK_COLUMNS);
+    else
+      spark_clear(sp, sp->column + 1, column - sp->column - 1);
+    sp->column = column;
+    sp->count = 0;
+    memset(sp->sum, 0, sizeof(sp->sum));
+  }
+
+  for (size_t c = 0; c < ROLLUP_SPARK_CHANNELS; c++)
+    sp->sum[c] += v[spark_channels[c]];
+  sp->count++;
+}
+
+/*
+ * Fill every column up to t from the log summaries, the open one with what
+ * is logged up to t, which includes the sample being added.
+ */
+static bool spark_restore(rollup_spark_state_t *sp, uint32_t period_s,
+                          uint32_t t)
+{
+  uint32_t last = t / period_s;
+  for (uint32_t column = last - (ROLLUP_SPARK_COLUMNS - 1); column <= last;
+       column++)
+  {
+    uint32_t from = column * period_s;
+    log_summary_t sum;
+    if (log_manager_query(from, column == last ? t + 1 : from + period_s,
+                          &sum) != ESP_OK)
+      return false;
+
+    for (size_t c = 0; c < ROLLUP_SPARK_CHANNELS; c++)
+    {
+      int32_t total = sum.sum[spark_log_channels[c]];
+      if (column == last)
+        sp->sum[c] = total;
+      else
+        sp->mean[column % ROLLUP_SPARK_COLUMNS][c] =
+            sum.count > 0 ? (int16_t)(total / (int32_t)sum.count)
+                          : ROLLUP_SPARK_EMPTY;
+    }
+    if (column == last)
+    {
+      sp->column = last;
+      sp->count = (uint16_t)sum.count;
+    }
+  }
+  return true;
+}
+
+void rollup_manager_update(const latest_data_t *data)
+{
+  rtc_state_check();
+  if (!wifi_time_manager_is_synced())
+    return;
+
+  time_t now = wifi_time_manager_time();
+  uint32_t t = (uint32_t)now;
+
+  // Once per RTC loss, at the first sample with wall clock time. The log
+  // already has this sample, so it is not added again below.
+  bool restored = false;
+  if (!rtc_rollup.spark_restored)
+  {
+    restored = true;
+    for (int sp = 0; sp < ROLLUP_SPARKS; sp++)
+      restored &= spark_restore(&rtc_rollup.spark[sp], spark_period_s[sp], t);
+    rtc_rollup.spark_restored = true;
+  }
+
+  struct tm local;
+  localtime_r(&now, &local);
+  uint32_t into_hour = local.tm_min * 60 + local.tm_sec;
+  uint32_t start[ROLLUP_LEVELS] = {
+      [ROLLUP_HOUR] = t - into_hour,
+      [ROLLUP_DAY] = t - (local.tm_hour * 3600 + into_hour),
+  };
+
+  int16_t v[ROLLUP_CHANNELS];
+  v[ROLLUP_TEMPERATURE] = clamp_i16(data->temperature * 100.0f);
+  v[ROLLUP_HUMIDITY] = clamp_i16(data->humidity * 100.0f);
+  v[ROLLUP_PRESSURE] = clamp_i16(data->pressure * 10.0f);
+  v[ROLLUP_IAQ] = clamp_i16(data->iaq * 10.0f);
+  v[ROLLUP_GAS] = clamp_i16(data->gas_resistance / 100.0f);
+  v[ROLLUP_BATTERY] = clamp_i16((float)data->battery_voltage_mv);
+
+  bool hold = rtc_rollup.prev_valid && t > rtc_rollup.prev_t &&
+              t - rtc_rollup.prev_t <= ROLLUP_MAX_HOLD_S;
+
+  for (int level = 0; level < ROLLUP_LEVELS; level++)
+  {
+    rollup_bucket_t *b = &rtc_rollup.open[level];
+    uint32_t period = level_info[level].period_s;
+    if (hold)
+      hold_iaq(b, period, rtc_rollup.prev_t, t, rtc_rollup.prev_iaq);
+
+    if (b->start != start[level])
+    {
+      if (b->count > 0)
+      {
+        ring_push(level, b);
+        spill(level, b);
+      }
+      bucket_init(b, start[level]);
+      if (hold)
+        hold_iaq(b, period, rtc_rollup.prev_t, t, rtc_rollup.prev_iaq);
+    }
+
+    for (int ch = 0; ch < ROLLUP_CHANNELS; ch++)
+    {
+      if (v[ch] < b->min[ch])
+        b->min[ch] = v[ch];
+      if (v[ch] > b->max[ch])
+        b->max[ch] = v[ch];
+      b->sum[ch] += v[ch];
+    }
+    b->count++;
+  }
+
+  for (int sp = 0; sp < ROLLUP_SPARKS && !restored; sp++)
+    spark_update(&rtc_rollup.spark[sp], spark_period_s[sp], t, v);
+
+  rtc_rollup.prev_t = t;
+  rtc_rollup.prev_iaq = v[ROLLUP_IAQ];
+  rtc_rollup.prev_valid = true;
+}
+
+const rollup_bucket_t *rollup_manager_get_open(rollup_level_t level)
+{
+  rtc_state_check();
+  return &rtc_rollup.open[level];
+}
+
+bool rollup_manager_get_closed(rollup_level_t level, uint32_t age,
+                               rollup_bucket_t *out)
+{
+  rtc_state_check();
+  const rollup_level_info_t *info = &level_info[level];
+  if (age >= rtc_rollup.ring_count[level])
+    return false;
+  uint32_t i = (rtc_rollup.ring_next[level] + info->depth - 1 - age) % info->depth;
+  *out = rtc_rollup.ring[info->base + i];
+  return true;
+}
+
+void rollup_manager_get_spark(rollup_spark_t spark, rollup_channel_t ch,
+                              int16_t out[ROLLUP_SPARK_COLUMNS])
+{
+  rtc_state_check();
+  const rollup_spark_state_t *sp = &rtc_rollup.spark[spark];
+  size_t c = 0;
+  while (c < ROLLUP_SPARK_CHANNELS && spark_channels[c] != ch)
+    c++;
+  if (c == ROLLUP_SPARK_CHANNELS || !wifi_time_manager_is_synced())
+  {
+    for (int x = 0; x < ROLLUP_SPARK_COLUMNS; x++)
+      out[x] = ROLLUP_SPARK_EMPTY;
+    return;
+  }
+
+  // The right edge is now, not the last sample
+  uint32_t last = (uint32_t)wifi_time_manager_time() / spark_period_s[spark];
+  for (int x = 0; x < ROLLUP_SPARK_COLUMNS; x++)
+  {
+    uint32_t column = last - (ROLLUP_SPARK_COLUMNS - 1) + x;
+    if (column == sp->column)
+      out[x] = spark_open_mean(sp, c);
+    else if (column < sp->column && sp->column - column < ROLLUP_SPARK_COLUMNS)
+      out[x] = sp->mean[column % ROLLUP_SPARK_COLUMNS][c];
+    else
+      out[x] = ROLLUP_SPARK_EMPTY;
+  }
+}
+
+void rollup_manager_get_spill_range(uint32_t *first_seq, uint32_t *next_seq)
+{
+  uint32_t next = rtc_rollup.spill_next;
+  uint32_t held = 0;
+  if (rollup_partition != NULL && rtc_rollup.spill_valid)
+  {
+    // Every sector but the one being filled holds a full set of records
+    held = slot_count - ROLLUP_SLOTS_PER_SECTOR +
+           (next % slot_count) % ROLLUP_SLOTS_PER_SECTOR;
+    if (held > next)
+      held = next;
+  }
+  if (first_seq)
+    *first_seq = next - held;
+  if (next_seq)
+    *next_seq = next;
+}
+
+esp_err_t rollup_manager_read_spilled(uint32_t seq, rollup_level_t *level,
+                                      rollup_bucket_t *out)
+{
+  uint32_t first, next;
+  rollup_manager_get_spill_range(&first, &next);
+  if ((int32_t)(seq - first) < 0 || (int32_t)(seq - next) >= 0)
+    return ESP_ERR_NOT_FOUND;
+
+  rollup_record_t rec;
+  if (!read_record(seq % slot_count, &rec))
+    return ESP_FAIL;
+  if (rec.seq != seq || rec.crc != record_crc(&rec) ||
+      rec.level >= ROLLUP_LEVELS)
+    return ESP_ERR_INVALID_CRC;
+  *level = (rollup_level_t)rec.level;
+  *out = rec.bucket;
+  return ESP_OK;
+}
+
+int32_t rollup_bucket_mean(const rollup_bucket_t *bucket, rollup_channel_t ch)
+{
+  if (bucket->count == 0)
+    return 0;
+  return bucket->sum[ch] / (int32_t)bucket->count;
+}
+
+int32_t rollup_bucket_iaq_tw(const rollup_bucket_t *bucket)
+{
+  if (bucket->iaq_span == 0)
+    return rollup_bucket_mean(bucket, ROLLUP_IAQ);
+  return bucket->iaq_area / (int32_t)bucket->iaq_span;
+}
@@ -0,0 +1,149 @@
+#ifndef ROLLUP_MANAGER_H
+#define ROLLUP_MANAGER_H
+
+#include "common_data.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  ROLLUP_HOUR, // Local hours
+  ROLLUP_DAY,  // Local days, from midnight
+  ROLLUP_LEVELS,
+} rollup_level_t;
+
+/* Channels, scaled like the log samples */
+typedef enum
+{
+  ROLLUP_TEMPERATURE, // 0.01 C
+  ROLLUP_HUMIDITY,    // 0.01 %
+  ROLLUP_PRESSURE,    // 0.1 of the latest_data.pressure unit
+  ROLLUP_IAQ,         // 0.1 steps
+  ROLLUP_GAS,         // 100 Ohm
+  ROLLUP_BATTERY,     // mV
+  ROLLUP_CHANNELS,
+} rollup_channel_t;
+
+/* Sparklines: one column per pixel of the panel width */
+typedef enum
+{
+  ROLLUP_SPARK_24H, // 675 s per column
+  ROLLUP_SPARK_7D,  // 4725 s per column
+  ROLLUP_SPARKS,
+} rollup_spark_t;
+
+#define ROLLUP_SPARK_COLUMNS 128
+#define ROLLUP_SPARK_EMPTY INT16_MIN // Column without samples
+
+/**
+ * @brief Aggregate of one hour or day (64 bytes)
+ */
+typedef struct __attribute__((packed))
+{
+  uint32_t start;     // Unix time the bucket begins
+  uint16_t count;     // Samples
+  uint16_t reserved;
+  int16_t min[ROLLUP_CHANNELS];
+  int16_t max[ROLLUP_CHANNELS];
+  int32_t sum[ROLLUP_CHANNELS];
+  int32_t iaq_area;   // IAQ integrated over time, 0.1 steps * s
+  uint32_t iaq_span;  // Seconds covered by iaq_area
+} rollup_bucket_t;
+
+/**
+ * @brief Find the spill partition and recover its write head
+ *
+ * After a cold boot the recent closed buckets are read back from flash
+ * into RTC memory.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t rollup_manager_init(void);
+
+/**
+ * @brief Add a sample to the open hour and day and to the sparklines
+ *
+ * Constant time. A bucket is closed by the first sample past its end: it
+ * moves to a ring in RTC memory and is spilled to flash. Samples taken
+ * before the first time sync are ignored, they have no place in wall clock
+ * buckets. IAQ is also integrated over time, each value held until the
+ * next sample but for at most 30 minutes.
+ *
+ * The first call after RTC memory was lost rebuilds the sparklines from
+ * the log with log_manager_query(), one range query per column, so call it
+ * after log_manager_append() of the same sample.
+ *
+ * @param data Sample to add, must be valid
+ */
+void rollup_manager_update(const latest_data_t *data);
+
+/**
+ * @brief The bucket samples are added to now, count is 0 if it is empty
+ */
+const rollup_bucket_t *rollup_manager_get_open(rollup_level_t level);
+
+/**
+ * @brief A recently closed bucket from RTC memory
+ *
+ * Holds the last 24 hours and 7 days.
+ *
+ * @param level Hours or days
+ * @param age 0 for the newest closed bucket
+ * @param out Bucket
+ * @return true if there is a bucket that old
+ */
+bool rollup_manager_get_closed(rollup_level_t level, uint32_t age,
+                               rollup_bucket_t *out);
+
+/**
+ * @brief Column means of a sparkline, oldest first
+ *
+ * The last column is the one samples are added to now. Only temperature,
+ * humidity and IAQ are kept; for other channels, before the first time
+ * sync and where no sample was taken, columns are ROLLUP_SPARK_EMPTY.
+ *
+ * @param spark Time span
+ * @param ch Channel, scaled like the buckets
+ * @param out One value per column
+ */
+void rollup_manager_get_spark(rollup_spark_t spark, rollup_channel_t ch,
+                              int16_t out[ROLLUP_SPARK_COLUMNS]);
+
+/**
+ * @brief Read a spilled bucket by sequence number
+ *
+ * @param seq Sequence number within rollup_manager_get_spill_range()
+ * @param level Level of the bucket
+ * @param out Bucket
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if out of range,
+ *         ESP_ERR_INVALID_CRC if the record is torn
+ */
+esp_err_t rollup_manager_read_spilled(uint32_t seq, rollup_level_t *level,
+                                      rollup_bucket_t *out);
+
+/**
+ * @brief Get the sequence range of the spilled buckets on flash
+ */
+void rollup_manager_get_spill_range(uint32_t *first_seq, uint32_t *next_seq);
+
+/**
+ * @brief Mean of a channel, 0 for an empty bucket
+ */
+int32_t rollup_bucket_mean(const rollup_bucket_t *bucket, rollup_channel_t ch);
+
+/**
+ * @brief Time-weighted mean IAQ in 0.1 steps, the plain mean if no time was
+ *        covered
+ */
+int32_t rollup_bucket_iaq_tw(const rollup_bucket_t *bucket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ROLLUP_MANAGER_H
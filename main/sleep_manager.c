@@ -0,0 +1,168 @@
+#include "sleep_manager.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <sys/time.h>
+
+static const char *TAG = "SLEEP_MGR";
+
+/*
+ * Cost model for the break-even point, ESP32-C6 at 80 MHz. The panel and
+ * the sensor draw the same in both sleep modes and are left out. The reboot
+ * time is replaced by the measured wake latency once there is one.
+ */
+#define SLEEP_REBOOT_US 250000  // Timer wake to next BSEC call, warm path
+#define SLEEP_ACTIVE_UA 22000   // Average current while booting
+#define SLEEP_LIGHT_UA 250      // Light sleep, CPU and RAM retained
+#define SLEEP_DEEP_UA 12        // Deep sleep, RTC timer and memory only
+
+// Light sleep entry/exit costs ~1 ms, below this just wait
+#define SLEEP_LIGHT_MIN_US 5000
+// Wake this much early from light sleep and wait out the rest
+#define SLEEP_LIGHT_GUARD_US 2000
+
+// Wake latency samples outside this are clock steps or stalls, not boots
+#define SLEEP_LATENCY_MAX_US 2000000
+// EMA weight of a new latency sample, 1/2^N
+#define SLEEP_LATENCY_SHIFT 2
+// Aim this much early, sleep_manager_wait_until() absorbs the rest
+#define SLEEP_LATENCY_MARGIN_US 3000
+#define SLEEP_RTC_MAGIC 0x504C5353 // "SSLP"
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t samples;        // Latency samples in the EMA
+  int64_t planned_wake_ns; // Wall clock the deep sleep timer fires at, 0 = none
+  int64_t latency_us;      // EMA of timer fire to ready-to-run
+} sleep_rtc_state_t;
+
+static RTC_DATA_ATTR sleep_rtc_state_t rtc_sleep;
+
+static int64_t now_ns(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_usec * 1000LL;
+}
+
+static bool rtc_state_valid(void)
+{
+  return rtc_sleep.magic == SLEEP_RTC_MAGIC;
+}
+
+int64_t sleep_manager_get_latency_us(void)
+{
+  return rtc_state_valid() && rtc_sleep.samples > 0 ? rtc_sleep.latency_us
+                                                     : 0;
+}
+
+int64_t sleep_manager_break_even_us(void)
+{
+  int64_t reboot_us = rtc_state_valid() && rtc_sleep.samples > 0
+                          ? rtc_sleep.latency_us
+                          : SLEEP_REBOOT_US;
+  /*
+   * Deep sleep over T: reboot at active current, the rest at deep current.
+   * Light sleep over T: all of it at light current. Equal at
+   * T = reboot * (active - deep) / (light - deep), ~23 s with the above.
+   */
+  return reboot_us * (SLEEP_ACTIVE_UA - SLEEP_DEEP_UA) /
+         (SLEEP_LIGHT_UA - SLEEP_DEEP_UA);
+}
+
+int64_t sleep_manager_plan_deep_sleep(int64_t target_ns)
+{
+  if (!rtc_state_valid())
+  {
+    rtc_sleep.magic = SLEEP_RTC_MAGIC;
+    rtc_sleep.samples = 0;
+    rtc_sleep.latency_us = 0;
+  }
+
+  int64_t now = now_ns();
+  int64_t sleep_us = (target_ns - now) / 1000LL;
+  if (rtc_sleep.samples > 0)
+    sleep_us -= rtc_sleep.latency_us + SLEEP_LATENCY_MARGIN_US;
+  if (sleep_us < SLEEP_LIGHT_MIN_US)
+    sleep_us = SLEEP_LIGHT_MIN_US;
+
+  rtc_sleep.planned_wake_ns = now + sleep_us * 1000LL;
+  return sleep_us;
+}
+
+void sleep_manager_wake_ready(bool warm)
+{
+  if (!rtc_state_valid() || rtc_sleep.planned_wake_ns == 0)
+    return;
+
+  int64_t latency_us = (now_ns() - rtc_sleep.planned_wake_ns) / 1000LL;
+  rtc_sleep.planned_wake_ns = 0;
+
+  // Cold boots don't come from our timer, their plan is stale
+  if (!warm || latency_us < 0 || latency_us > SLEEP_LATENCY_MAX_US)
+  {
+    if (warm)
+      ESP_LOGW(TAG, "Wake latency sample out of range: %lld us", latency_us);
+    return;
+  }
+
+  if (rtc_sleep.samples == 0)
+    rtc_sleep.latency_us = latency_us;
+  else
+    rtc_sleep.latency_us +=
+        (latency_us - rtc_sleep.latency_us) / (1 << SLEEP_LATENCY_SHIFT);
+  rtc_sleep.samples++;
+
+  ESP_LOGI(TAG, "Wake latency %lld us, estimate %lld us", latency_us,
+           rtc_sleep.latency_us);
+}
+
+sleep_mode_t sleep_manager_select(int64_t sleep_us)
+{
+  if (sleep_us >= sleep_manager_break_even_us())
+    return SLEEP_MODE_DEEP;
+  if (sleep_us >= SLEEP_LIGHT_MIN_US)
+    return SLEEP_MODE_LIGHT;
+  return SLEEP_MODE_WAIT;
+}
+
+void sleep_manager_wait_until(int64_t target_ns)
+{
+  int64_t remaining_us = (target_ns - now_ns()) / 1000LL;
+
+  // A caller that keeps missing its deadline still gives up the CPU, so the
+  // idle task (and the task watchdog) gets to run
+  if (remaining_us <= 0)
+  {
+    vTaskDelay(1);
+    return;
+  }
+
+  if (sleep_manager_select(remaining_us) != SLEEP_MODE_WAIT)
+  {
+    esp_sleep_enable_timer_wakeup(remaining_us - SLEEP_LIGHT_GUARD_US);
+    esp_err_t ret = esp_light_sleep_start();
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    if (ret != ESP_OK)
+      ESP_LOGW(TAG, "Light sleep rejected: %s", esp_err_to_name(ret));
+    remaining_us = (target_ns - now_ns()) / 1000LL;
+  }
+
+  // Coarse part on the tick (auto light sleep may kick in), the rest busy
+  int64_t ticks = remaining_us / (portTICK_PERIOD_MS * 1000LL);
+  if (ticks > 1)
+  {
+    vTaskDelay((TickType_t)(ticks - 1));
+    remaining_us = (target_ns - now_ns()) / 1000LL;
+  }
+
+  while (remaining_us > 0)
+  {
+    esp_rom_delay_us(remaining_us > 1000 ? 1000 : (uint32_t)remaining_us);
+    remaining_us = (target_ns - now_ns()) / 1000LL;
+  }
+}
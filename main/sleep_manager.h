@@ -0,0 +1,75 @@
+#ifndef SLEEP_MANAGER_H
+#define SLEEP_MANAGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  SLEEP_MODE_WAIT,  // Too short for light sleep, wait on the tick/busy delay
+  SLEEP_MODE_LIGHT, // Stay booted, light sleep until the deadline
+  SLEEP_MODE_DEEP,  // Long enough to pay for a reboot
+} sleep_mode_t;
+
+/**
+ * @brief Pick how to spend the time until the next BSEC call
+ *
+ * Deep sleep is chosen only when the interval is past the break-even point
+ * where the charge of a reboot is cheaper than light sleep current.
+ *
+ * @param sleep_us Time left until the deadline
+ */
+sleep_mode_t sleep_manager_select(int64_t sleep_us);
+
+/**
+ * @brief Break-even interval between light sleep and deep sleep
+ */
+int64_t sleep_manager_break_even_us(void);
+
+/**
+ * @brief Deep sleep timer for a wake at target_ns
+ *
+ * Shortened by the measured wake latency, so the next wake is ready to run
+ * BSEC just before target_ns. Remembers the planned timer expiry in RTC
+ * memory for sleep_manager_wake_ready().
+ *
+ * @param target_ns Next BSEC call on the gettimeofday() clock in ns
+ * @return int64_t Timer duration for esp_sleep_enable_timer_wakeup
+ */
+int64_t sleep_manager_plan_deep_sleep(int64_t target_ns);
+
+/**
+ * @brief Mark the point where a wake is ready to run BSEC
+ *
+ * The first call after a planned deep sleep measures the latency from the
+ * timer expiry and folds it into the estimate, further calls do nothing.
+ *
+ * @param warm Woken by our own timer, cold boots only drop the plan
+ */
+void sleep_manager_wake_ready(bool warm);
+
+/**
+ * @brief Smoothed deep sleep wake latency, 0 until measured
+ */
+int64_t sleep_manager_get_latency_us(void);
+
+/**
+ * @brief Light sleep / wait until a wall clock deadline
+ *
+ * Returns at target_ns, not before, with a few 100 us of spread. If the
+ * deadline has already passed it blocks for one tick and returns.
+ *
+ * @param target_ns Deadline on the gettimeofday() clock in ns, the same
+ *                  base as the BSEC next_call
+ */
+void sleep_manager_wait_until(int64_t target_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLEEP_MANAGER_H
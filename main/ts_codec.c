@@ -0,0 +1,268 @@
+#include "ts_codec.h"
+#include <string.h>
+
+/*
+ * Prefix codes
+ * ------------
+ * Timestamp delta-of-delta and integer channel deltas are zig-zag mapped to
+ * an unsigned value z and written as
+ *
+ *   z == 0          '0'
+ *   z < 2^7         '10'   + 7 bits
+ *   z < 2^9         '110'  + 9 bits
+ *   z < 2^12        '1110' + 12 bits
+ *   otherwise       '1111' + 32 bits
+ *
+ * A float channel is XORed with its previous value x and written as
+ *
+ *   x == 0                              '0'
+ *   meaningful bits in the last window  '10' + bits of the window
+ *   otherwise                           '11' + 5 bits leading zeros
+ *                                            + 5 bits length - 1 + bits
+ *
+ * The first point goes through the same path against an all-zero previous
+ * point, so the block needs no separate raw header.
+ */
+
+static void put_bits(ts_encoder_t *enc, uint32_t value, unsigned n)
+{
+  while (n > 0)
+  {
+    size_t byte = enc->bit_pos >> 3;
+    unsigned room = 8 - (enc->bit_pos & 7);
+    unsigned take = n < room ? n : room;
+    uint32_t bits = (value >> (n - take)) & ((1u << take) - 1);
+    if ((enc->bit_pos & 7) == 0)
+      enc->buf[byte] = 0;
+    enc->buf[byte] |= (uint8_t)(bits << (room - take));
+    enc->bit_pos += take;
+    n -= take;
+  }
+}
+
+static uint32_t get_bits(ts_decoder_t *dec, unsigned n)
+{
+  uint32_t value = 0;
+  while (n > 0)
+  {
+    size_t byte = dec->bit_pos >> 3;
+    if (byte >= dec->len)
+    {
+      dec->overrun = true;
+      return 0;
+    }
+    unsigned room = 8 - (dec->bit_pos & 7);
+    unsigned take = n < room ? n : room;
+    uint32_t bits = (dec->buf[byte] >> (room - take)) & ((1u << take) - 1);
+    value = (value << take) | bits;
+    dec->bit_pos += take;
+    n -= take;
+  }
+  return value;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t z)
+{
+  return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+static void put_int(ts_encoder_t *enc, int32_t v)
+{
+  uint32_t z = zigzag(v);
+  if (z == 0)
+    put_bits(enc, 0x0, 1);
+  else if (z < (1u << 7))
+  {
+    put_bits(enc, 0x2, 2);
+    put_bits(enc, z, 7);
+  }
+  else if (z < (1u << 9))
+  {
+    put_bits(enc, 0x6, 3);
+    put_bits(enc, z, 9);
+  }
+  else if (z < (1u << 12))
+  {
+    put_bits(enc, 0xE, 4);
+    put_bits(enc, z, 12);
+  }
+  else
+  {
+    put_bits(enc, 0xF, 4);
+    put_bits(enc, z, 32);
+  }
+}
+
+static int32_t get_int(ts_decoder_t *dec)
+{
+  unsigned ones = 0;
+  while (ones < 4 && get_bits(dec, 1))
+    ones++;
+
+  uint32_t z;
+  switch (ones)
+  {
+  case 0:
+    z = 0;
+    break;
+  case 1:
+    z = get_bits(dec, 7);
+    break;
+  case 2:
+    z = get_bits(dec, 9);
+    break;
+  case 3:
+    z = get_bits(dec, 12);
+    break;
+  default:
+    z = get_bits(dec, 32);
+    break;
+  }
+  return unzigzag(z);
+}
+
+static unsigned clz32(uint32_t x)
+{
+  return x ? (unsigned)__builtin_clz(x) : 32;
+}
+
+static unsigned ctz32(uint32_t x)
+{
+  return x ? (unsigned)__builtin_ctz(x) : 32;
+}
+
+static void put_float(ts_encoder_t *enc, int ch, uint32_t value)
+{
+  ts_codec_state_t *st = &enc->st;
+  uint32_t x = value ^ st->prev.floats[ch];
+  if (x == 0)
+  {
+    put_bits(enc, 0x0, 1);
+    return;
+  }
+
+  unsigned lead = clz32(x);
+  unsigned trail = ctz32(x);
+
+  // Reuse the previous window if the meaningful bits fit inside it
+  if (st->len[ch] != 0 && lead >= st->lead[ch] &&
+      32 - trail <= (unsigned)st->lead[ch] + st->len[ch])
+  {
+    unsigned shift = 32 - st->lead[ch] - st->len[ch];
+    put_bits(enc, 0x2, 2);
+    put_bits(enc, x >> shift, st->len[ch]);
+    return;
+  }
+
+  unsigned len = 32 - lead - trail;
+  put_bits(enc, 0x3, 2);
+  put_bits(enc, lead, 5);
+  put_bits(enc, len - 1, 5);
+  put_bits(enc, x >> trail, len);
+  st->lead[ch] = (uint8_t)lead;
+  st->len[ch] = (uint8_t)len;
+}
+
+static uint32_t get_float(ts_decoder_t *dec, int ch)
+{
+  ts_codec_state_t *st = &dec->st;
+  if (!get_bits(dec, 1))
+    return st->prev.floats[ch];
+
+  if (get_bits(dec, 1))
+  {
+    st->lead[ch] = (uint8_t)get_bits(dec, 5);
+    st->len[ch] = (uint8_t)(get_bits(dec, 5) + 1);
+    if (st->lead[ch] + st->len[ch] > 32)
+    {
+      dec->overrun = true;
+      return 0;
+    }
+  }
+  else if (st->len[ch] == 0)
+  {
+    dec->overrun = true; // Window reused before one was set
+    return 0;
+  }
+
+  unsigned shift = 32 - st->lead[ch] - st->len[ch];
+  uint32_t x = get_bits(dec, st->len[ch]) << shift;
+  return st->prev.floats[ch] ^ x;
+}
+
+void ts_encoder_init(ts_encoder_t *enc, uint8_t *buf, size_t cap)
+{
+  memset(enc, 0, sizeof(*enc));
+  enc->buf = buf;
+  enc->cap = cap;
+}
+
+bool ts_encoder_add(ts_encoder_t *enc, const ts_codec_point_t *pt)
+{
+  if (enc->bit_pos + TS_CODEC_MAX_POINT_BYTES * 8 > enc->cap * 8)
+    return false;
+
+  ts_codec_state_t *st = &enc->st;
+  int32_t delta = (int32_t)(pt->timestamp - st->prev.timestamp);
+  if (st->count == 0)
+    put_int(enc, (int32_t)pt->timestamp); // Raw, wraps into the 32 bit escape
+  else
+    put_int(enc, (int32_t)((uint32_t)delta - (uint32_t)st->prev_delta));
+
+  for (int i = 0; i < TS_CODEC_INTS; i++)
+    put_int(enc, (int32_t)((uint32_t)pt->ints[i] - (uint32_t)st->prev.ints[i]));
+  for (int i = 0; i < TS_CODEC_FLOATS; i++)
+    put_float(enc, i, pt->floats[i]);
+
+  st->prev_delta = st->count == 0 ? 0 : delta;
+  st->prev = *pt;
+  st->count++;
+  return true;
+}
+
+size_t ts_encoder_bytes(const ts_encoder_t *enc)
+{
+  return (enc->bit_pos + 7) / 8;
+}
+
+void ts_decoder_init(ts_decoder_t *dec, const uint8_t *buf, size_t len)
+{
+  memset(dec, 0, sizeof(*dec));
+  dec->buf = buf;
+  dec->len = len;
+}
+
+bool ts_decoder_next(ts_decoder_t *dec, ts_codec_point_t *pt)
+{
+  ts_codec_state_t *st = &dec->st;
+  ts_codec_point_t p;
+
+  int32_t v = get_int(dec);
+  int32_t delta = 0;
+  if (st->count == 0)
+    p.timestamp = (uint32_t)v;
+  else
+  {
+    delta = (int32_t)((uint32_t)st->prev_delta + (uint32_t)v);
+    p.timestamp = st->prev.timestamp + (uint32_t)delta;
+  }
+
+  for (int i = 0; i < TS_CODEC_INTS; i++)
+    p.ints[i] = (int32_t)((uint32_t)st->prev.ints[i] + (uint32_t)get_int(dec));
+  for (int i = 0; i < TS_CODEC_FLOATS; i++)
+    p.floats[i] = get_float(dec, i);
+
+  if (dec->overrun)
+    return false;
+
+  st->prev_delta = delta;
+  st->prev = p;
+  st->count++;
+  *pt = p;
+  return true;
+}
@@ -0,0 +1,100 @@
+#ifndef TS_CODEC_H
+#define TS_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Channels of one point, the log maps its sample fields onto these */
+#define TS_CODEC_INTS 6   // Integer channels, zig-zag delta coded
+#define TS_CODEC_FLOATS 2 // Float channels, XOR coded
+
+/*
+ * Worst case size of one point: a 36 bit timestamp, 36 bits per integer
+ * channel and 44 bits per float channel, rounded up to bytes.
+ */
+#define TS_CODEC_MAX_POINT_BYTES                                               \
+  ((36 + 36 * TS_CODEC_INTS + 44 * TS_CODEC_FLOATS + 7) / 8)
+
+typedef struct
+{
+  uint32_t timestamp;               // Seconds
+  int32_t ints[TS_CODEC_INTS];
+  uint32_t floats[TS_CODEC_FLOATS]; // IEEE 754 bit patterns
+} ts_codec_point_t;
+
+/* Channel state shared by encoder and decoder */
+typedef struct
+{
+  ts_codec_point_t prev;
+  int32_t prev_delta;                 // Timestamp delta of the last point
+  uint8_t lead[TS_CODEC_FLOATS];      // XOR window of the last float value
+  uint8_t len[TS_CODEC_FLOATS];
+  uint32_t count;
+} ts_codec_state_t;
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t cap;     // Bytes
+  size_t bit_pos; // Bits written
+  ts_codec_state_t st;
+} ts_encoder_t;
+
+typedef struct
+{
+  const uint8_t *buf;
+  size_t len;     // Bytes
+  size_t bit_pos; // Bits read
+  bool overrun;   // Read past the end, the data is corrupt
+  ts_codec_state_t st;
+} ts_decoder_t;
+
+/**
+ * @brief Start a block in buf
+ *
+ * The encoder only ever touches buf, a block needs at most
+ * TS_CODEC_MAX_POINT_BYTES per point.
+ */
+void ts_encoder_init(ts_encoder_t *enc, uint8_t *buf, size_t cap);
+
+/**
+ * @brief Append a point
+ *
+ * Timestamps are coded as delta-of-delta, integer channels as zig-zag
+ * deltas and float channels as the XOR with the previous value, each with
+ * a short prefix code for the common small values (Gorilla, VLDB 2015).
+ *
+ * @return false if the block could not take a worst case point, nothing
+ *         is written then
+ */
+bool ts_encoder_add(ts_encoder_t *enc, const ts_codec_point_t *pt);
+
+/**
+ * @brief Bytes used so far, the last one padded with zero bits
+ */
+size_t ts_encoder_bytes(const ts_encoder_t *enc);
+
+/**
+ * @brief Start decoding a block of len bytes
+ */
+void ts_decoder_init(ts_decoder_t *dec, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Decode the next point
+ *
+ * The caller knows the point count from the block header.
+ *
+ * @return false if the block ended early (corrupt data)
+ */
+bool ts_decoder_next(ts_decoder_t *dec, ts_codec_point_t *pt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TS_CODEC_H
@@ -1,95 +1,334 @@
 #include "u8g2_manager.h"
 #include "driver/gpio.h"
 #include "driver/i2c_master.h"
+#include "esp_attr.h"
 #include "esp_check.h"
 #include "esp_log.h"
+#include "i2c_bus_manager.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "sdkconfig.h"
 #include "u8g2.h"
+#include "wake_trace.h"
+#include "wifi_time_manager.h"
+#include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
 static const char *TAG = "U8G2_MGR";
 
 /* I2C Configuration defaults if not in menuconfig */
-#ifndef CONFIG_I2C_MASTER_SDA
-#define I2C_MASTER_SDA_IO 20
-#else
-#define I2C_MASTER_SDA_IO CONFIG_I2C_MASTER_SDA
-#endif
-
-#ifndef CONFIG_I2C_MASTER_SCL
-#define I2C_MASTER_SCL_IO 19
-#else
-#define I2C_MASTER_SCL_IO CONFIG_I2C_MASTER_SCL
-#endif
-
 #ifndef CONFIG_I2C_MASTER_FREQUENCY
 #define I2C_FREQ_HZ 400000
 #else
 #define I2C_FREQ_HZ CONFIG_I2C_MASTER_FREQUENCY
 #endif
 
+/* The panel is clocked above the bus default, and drops back on errors */
+#ifndef CONFIG_I2C_DISPLAY_FREQUENCY
+#define I2C_DISPLAY_FAST_HZ 800000 // Fastest the C6 I2C master can do
+#else
+#define I2C_DISPLAY_FAST_HZ CONFIG_I2C_DISPLAY_FREQUENCY
+#endif
+
 #ifndef CONFIG_I2C_DISPLAY_ADDRESS
 #define I2C_DISPLAY_ADDRESS 0x3C
 #else
 #define I2C_DISPLAY_ADDRESS CONFIG_I2C_DISPLAY_ADDRESS
 #endif
 
-#define I2C_MASTER_NUM I2C_NUM_0
 #define I2C_TIMEOUT_MS 1000
 
+#define DISPLAY_TILE_COLS 16 // 128 px / 8
+#define DISPLAY_TILE_ROWS 8  // 64 px / 8
+#define DISPLAY_FRAME_BYTES (DISPLAY_TILE_COLS * DISPLAY_TILE_ROWS * 8)
+#define DISPLAY_FRAME_MAGIC 0x4D524644 // "DFRM"
+#define DISPLAY_PANEL_MAGIC 0x4C4E5044 // "DPNL"
+
+#define DISPLAY_XFER_MAX 32   // Queued I2C transactions, a full frame is 16
+#define DISPLAY_XFER_SEGS 3   // Buffers per transaction
+#define DISPLAY_POOL_BYTES 256 // Copied bytes: control bytes and commands
+#define DISPLAY_TX_STACK 3072
+
 static i2c_master_bus_handle_t i2c_bus_handle = NULL;
 static i2c_master_dev_handle_t display_dev_handle = NULL;
 static u8g2_t u8g2;
 
+// Set by the transmit task when a transfer fails, the panel is then unknown
+static volatile bool bus_error;
+
+/*
+ * Copy of what the panel shows, kept across deep sleep so a wake only sends
+ * the tiles that differ. Only valid while frame_magic is set.
+ */
+static RTC_DATA_ATTR uint32_t frame_magic;
+static RTC_DATA_ATTR uint8_t frame_shown[DISPLAY_FRAME_BYTES];
+
+/*
+ * The SSD1306 stays powered through deep sleep and keeps its configuration
+ * and GDDRAM. Set once the init sequence went through, cleared on any bus
+ * error, so a warm wake can attach to the running panel.
+ */
+static RTC_DATA_ATTR uint32_t panel_magic;
+
+// Set after a bus error at I2C_DISPLAY_FAST_HZ, the panel then runs at the
+// bus default
+static RTC_DATA_ATTR bool display_slow_clock;
+
+/*
+ * Display transport. The byte callback doesn't transmit, it records each
+ * u8x8 transfer as a list of buffers: control and command bytes are copied
+ * to a small pool, tile data is referenced in place in the u8g2 frame
+ * buffer. Data transfers that continue the previous one in the frame buffer
+ * are merged, so a tile row goes out as one transaction instead of six
+ * 24 byte ones. display_flush() hands the list to a task that sends it
+ * while the caller carries on, display_wait() joins it. The frame buffer
+ * must not be touched in between.
+ */
+typedef struct
+{
+  const uint8_t *ptr;
+  size_t len;
+} display_seg_t;
+
+typedef struct
+{
+  display_seg_t seg[DISPLAY_XFER_SEGS];
+  uint8_t n_segs;
+} display_xfer_t;
+
+static display_xfer_t xfers[DISPLAY_XFER_MAX];
+static uint8_t n_xfers;
+static bool xfer_open;
+static uint8_t pool[DISPLAY_POOL_BYTES];
+static size_t pool_used;
+
+static TaskHandle_t tx_task = NULL;
+static SemaphoreHandle_t tx_done = NULL;
+static bool tx_busy;
+
+static esp_err_t display_attach(void)
+{
+  if (display_dev_handle != NULL)
+    return ESP_OK;
+
+  i2c_device_config_t dev_config = {
+      .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+      .device_address = I2C_DISPLAY_ADDRESS,
+      .scl_speed_hz = display_slow_clock ? I2C_FREQ_HZ : I2C_DISPLAY_FAST_HZ,
+  };
+  return i2c_master_bus_add_device(i2c_bus_handle, &dev_config,
+                                   &display_dev_handle);
+}
+
+static void transmit_xfers(void)
+{
+  for (uint8_t i = 0; i < n_xfers; i++)
+  {
+    i2c_master_transmit_multi_buffer_info_t bufs[DISPLAY_XFER_SEGS];
+    for (uint8_t j = 0; j < xfers[i].n_segs; j++)
+    {
+      bufs[j].write_buffer = xfers[i].seg[j].ptr;
+      bufs[j].buffer_size = xfers[i].seg[j].len;
+    }
+    // One transaction (at most a tile row) per claim, so a sensor access
+    // never waits for more than that
+    if (!i2c_bus_manager_acquire(I2C_BUS_PRIO_DISPLAY, I2C_TIMEOUT_MS))
+    {
+      bus_error = true;
+      break;
+    }
+    esp_err_t ret = i2c_master_multi_buffer_transmit(
+        display_dev_handle, bufs, xfers[i].n_segs, I2C_TIMEOUT_MS);
+    i2c_bus_manager_release(I2C_BUS_PRIO_DISPLAY);
+    if (ret != ESP_OK)
+    {
+      bus_error = true;
+      break;
+    }
+  }
+}
+
+static void display_tx_task(void *arg)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    transmit_xfers();
+    xSemaphoreGive(tx_done);
+  }
+}
+
+/**
+ * @brief Wait for the transfers in flight and release their buffers
+ */
+static void display_wait(void)
+{
+  if (tx_busy)
+  {
+    xSemaphoreTake(tx_done, portMAX_DELAY);
+    tx_busy = false;
+  }
+  n_xfers = 0;
+  pool_used = 0;
+
+  if (bus_error)
+  {
+    // Part of the frame may be missing, start over on the next wake
+    frame_magic = 0;
+    panel_magic = 0;
+    if (!display_slow_clock)
+    {
+      ESP_LOGW(TAG, "Display bus error, using %d Hz from now on",
+               I2C_FREQ_HZ);
+      display_slow_clock = true;
+    }
+    bus_error = false;
+  }
+}
+
+/**
+ * @brief Start sending the recorded transfers in the background
+ */
+static void display_flush(void)
+{
+  if (n_xfers == 0 || tx_busy)
+    return;
+  if (tx_task == NULL)
+  {
+    // No task, send from here
+    transmit_xfers();
+    display_wait();
+    return;
+  }
+  tx_busy = true;
+  xTaskNotifyGive(tx_task);
+}
+
+static bool in_frame(const uint8_t *ptr, size_t len)
+{
+  const uint8_t *frame = u8g2_GetBufferPtr(&u8g2);
+  return frame != NULL && ptr >= frame && ptr + len <= frame + DISPLAY_FRAME_BYTES;
+}
+
+static bool xfer_append(display_xfer_t *x, const uint8_t *ptr, size_t len)
+{
+  bool frame_data = in_frame(ptr, len);
+  if (x->n_segs > 0)
+  {
+    // Extend the last buffer if the bytes follow on from it
+    display_seg_t *last = &x->seg[x->n_segs - 1];
+    if (frame_data && last->ptr + last->len == ptr)
+    {
+      last->len += len;
+      return true;
+    }
+    if (!frame_data && last->ptr + last->len == pool + pool_used &&
+        pool_used + len <= DISPLAY_POOL_BYTES)
+    {
+      memmove(pool + pool_used, ptr, len);
+      pool_used += len;
+      last->len += len;
+      return true;
+    }
+  }
+
+  if (x->n_segs == DISPLAY_XFER_SEGS ||
+      (!frame_data && pool_used + len > DISPLAY_POOL_BYTES))
+    return false;
+
+  if (!frame_data)
+  {
+    memmove(pool + pool_used, ptr, len);
+    ptr = pool + pool_used;
+    pool_used += len;
+  }
+  x->seg[x->n_segs].ptr = ptr;
+  x->seg[x->n_segs].len = len;
+  x->n_segs++;
+  return true;
+}
+
+/*
+ * Fold a finished data transfer into the previous one when both are a
+ * control byte plus frame data and the data is contiguous.
+ */
+static void xfer_close(void)
+{
+  xfer_open = false;
+  if (n_xfers < 2)
+    return;
+  display_xfer_t *prev = &xfers[n_xfers - 2];
+  display_xfer_t *cur = &xfers[n_xfers - 1];
+  if (prev->n_segs == 2 && cur->n_segs == 2 && prev->seg[0].len == 1 &&
+      cur->seg[0].len == 1 && *prev->seg[0].ptr == *cur->seg[0].ptr &&
+      in_frame(prev->seg[1].ptr, prev->seg[1].len) &&
+      prev->seg[1].ptr + prev->seg[1].len == cur->seg[1].ptr)
+  {
+    prev->seg[1].len += cur->seg[1].len;
+    if (cur->seg[0].ptr == pool + pool_used - 1)
+      pool_used--;
+    n_xfers--;
+  }
+}
+
 /**
  * @brief U8X8 I2C communication callback
  */
 static uint8_t u8x8_byte_i2c_cb(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int,
                                 void *arg_ptr)
 {
-  static uint8_t buffer[132];
-  static uint8_t buf_idx;
-
   switch (msg)
   {
   case U8X8_MSG_BYTE_INIT:
-  {
-    i2c_device_config_t dev_config = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address = I2C_DISPLAY_ADDRESS,
-        .scl_speed_hz = I2C_FREQ_HZ,
-    };
-    esp_err_t ret = i2c_master_bus_add_device(i2c_bus_handle, &dev_config,
-                                              &display_dev_handle);
-    if (ret != ESP_OK)
+    if (display_attach() != ESP_OK)
     {
       ESP_LOGE(TAG, "I2C master driver initialized failed");
       return 0;
     }
     break;
-  }
   case U8X8_MSG_BYTE_START_TRANSFER:
-    buf_idx = 0;
+    // The lists are in use until the previous batch is out
+    if (tx_busy || n_xfers == DISPLAY_XFER_MAX)
+    {
+      display_flush();
+      display_wait();
+    }
+    memset(&xfers[n_xfers], 0, sizeof(xfers[0]));
+    n_xfers++;
+    xfer_open = true;
     break;
   case U8X8_MSG_BYTE_SET_DC:
     break;
   case U8X8_MSG_BYTE_SEND:
-    for (size_t i = 0; i < arg_int; ++i)
+    if (!xfer_open || arg_int == 0)
+      break;
+    if (!xfer_append(&xfers[n_xfers - 1], arg_ptr, arg_int))
     {
-      buffer[buf_idx++] = *((uint8_t *)arg_ptr + i);
+      // Out of list space mid-transfer: send what came before it, then
+      // restart this transfer on empty lists
+      display_xfer_t cur = xfers[--n_xfers];
+      display_flush();
+      display_wait();
+      memset(&xfers[0], 0, sizeof(xfers[0]));
+      n_xfers = 1;
+      for (uint8_t j = 0; j < cur.n_segs; j++)
+      {
+        if (!xfer_append(&xfers[0], cur.seg[j].ptr, cur.seg[j].len))
+          return 0;
+      }
+      if (!xfer_append(&xfers[0], arg_ptr, arg_int))
+      {
+        ESP_LOGE(TAG, "Display transfer too long");
+        return 0;
+      }
     }
     break;
   case U8X8_MSG_BYTE_END_TRANSFER:
-    if (buf_idx > 0 && display_dev_handle != NULL)
-    {
-      esp_err_t ret = i2c_master_transmit(display_dev_handle, buffer, buf_idx,
-                                          I2C_TIMEOUT_MS);
-      if (ret != ESP_OK)
-        return 0;
-    }
+    if (xfer_open)
+      xfer_close();
     break;
   default:
     return 0;
@@ -108,6 +347,9 @@ static uint8_t u8x8_gpio_delay_cb(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int,
   case U8X8_MSG_GPIO_AND_DELAY_INIT:
     break;
   case U8X8_MSG_DELAY_MILLI:
+    // Delays are timed against the commands before them
+    display_flush();
+    display_wait();
     vTaskDelay(pdMS_TO_TICKS(arg_int));
     break;
   case U8X8_MSG_DELAY_10MICRO:
@@ -125,34 +367,123 @@ static uint8_t u8x8_gpio_delay_cb(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int,
   return 1;
 }
 
-esp_err_t u8g2_manager_init(void)
+/**
+ * @brief Send the tiles that differ from the panel and remember the frame
+ *
+ * The u8g2 full buffer is tile rows of 128 bytes, 8 bytes per 8x8 tile, so
+ * each row is diffed in 8 byte steps and the span from the first to the
+ * last changed tile goes out in one transfer. Returns with the transfers
+ * still running, display_wait() rolls the copy back if they fail.
+ */
+static void send_frame(void)
 {
-  i2c_master_bus_config_t bus_config = {
-      .i2c_port = I2C_MASTER_NUM,
-      .sda_io_num = I2C_MASTER_SDA_IO,
-      .scl_io_num = I2C_MASTER_SCL_IO,
-      .clk_source = I2C_CLK_SRC_DEFAULT,
-      .glitch_ignore_cnt = 7,
-      .flags.enable_internal_pullup = true,
-  };
+  const uint8_t *frame = u8g2_GetBufferPtr(&u8g2);
 
-  ESP_RETURN_ON_ERROR(i2c_new_master_bus(&bus_config, &i2c_bus_handle), TAG,
-                      "Failed to create I2C bus");
+  if (frame_magic != DISPLAY_FRAME_MAGIC)
+  {
+    u8g2_SendBuffer(&u8g2);
+  }
+  else
+  {
+    int tiles_sent = 0;
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++)
+    {
+      const uint8_t *now = frame + row * DISPLAY_TILE_COLS * 8;
+      const uint8_t *was = frame_shown + row * DISPLAY_TILE_COLS * 8;
+      int first = -1, last = -1;
+      for (int col = 0; col < DISPLAY_TILE_COLS; col++)
+      {
+        if (memcmp(now + col * 8, was + col * 8, 8) != 0)
+        {
+          if (first < 0)
+            first = col;
+          last = col;
+        }
+      }
+      if (first >= 0)
+      {
+        u8g2_UpdateDisplayArea(&u8g2, first, row, last - first + 1, 1);
+        tiles_sent += last - first + 1;
+      }
+    }
+    if (tiles_sent == 0)
+      return;
+    ESP_LOGD(TAG, "Sent %d of %d tiles", tiles_sent,
+             DISPLAY_TILE_COLS * DISPLAY_TILE_ROWS);
+  }
+
+  display_flush();
+  memcpy(frame_shown, frame, DISPLAY_FRAME_BYTES);
+  frame_magic = DISPLAY_FRAME_MAGIC;
+}
+
+static bool probe_panel(void)
+{
+  if (!i2c_bus_manager_acquire(I2C_BUS_PRIO_DISPLAY, I2C_TIMEOUT_MS))
+    return false;
+  esp_err_t ret =
+      i2c_master_probe(i2c_bus_handle, I2C_DISPLAY_ADDRESS, I2C_TIMEOUT_MS);
+  i2c_bus_manager_release(I2C_BUS_PRIO_DISPLAY);
+  return ret == ESP_OK;
+}
+
+esp_err_t u8g2_manager_init(bool warm)
+{
+  wake_trace_begin(WAKE_PHASE_DISPLAY_INIT);
+
+  esp_err_t ret = i2c_bus_manager_init();
+  if (ret != ESP_OK)
+  {
+    wake_trace_end(WAKE_PHASE_DISPLAY_INIT);
+    return ret;
+  }
+  i2c_bus_handle = i2c_bus_manager_get_handle();
+
+  if (tx_done == NULL)
+    tx_done = xSemaphoreCreateBinary();
+  if (tx_done != NULL && tx_task == NULL &&
+      xTaskCreate(display_tx_task, "display_tx", DISPLAY_TX_STACK, NULL,
+                  uxTaskPriorityGet(NULL), &tx_task) != pdPASS)
+  {
+    ESP_LOGW(TAG, "No display task, sending synchronously");
+    tx_task = NULL;
+  }
 
   u8g2_Setup_ssd1306_i2c_128x64_noname_f(&u8g2, U8G2_R0, u8x8_byte_i2c_cb,
                                          u8x8_gpio_delay_cb);
 
+  // Warm wake onto a panel we set up: it is still on and showing the last
+  // frame, so only attach. A quick address probe catches a panel that lost
+  // power or was unplugged.
+  if (warm && panel_magic == DISPLAY_PANEL_MAGIC && probe_panel() &&
+      display_attach() == ESP_OK)
+  {
+    wake_trace_end(WAKE_PHASE_DISPLAY_INIT);
+    ESP_LOGI(TAG, "U8G2 attached to retained panel");
+    return ESP_OK;
+  }
+
+  if (warm)
+    ESP_LOGW(TAG, "Panel state lost, full init");
+  panel_magic = 0;
+  frame_magic = 0;
   u8g2_InitDisplay(&u8g2);
   u8g2_SetPowerSave(&u8g2, 0);
   u8g2_ClearBuffer(&u8g2);
-  u8g2_SendBuffer(&u8g2);
+  send_frame();
+  display_wait();
+  if (frame_magic == DISPLAY_FRAME_MAGIC)
+    panel_magic = DISPLAY_PANEL_MAGIC;
 
+  wake_trace_end(WAKE_PHASE_DISPLAY_INIT);
   ESP_LOGI(TAG, "U8G2 initialized successfully");
   return ESP_OK;
 }
 
 void u8g2_manager_draw_ui(int voltage_mv, float temp, float humidity, float iaq, int iaq_accuracy)
 {
+  wake_trace_begin(WAKE_PHASE_DISPLAY_DRAW);
+  display_wait();
   u8g2_ClearBuffer(&u8g2);
   char buf[32];
 
@@ -171,9 +502,8 @@ void u8g2_manager_draw_ui(int voltage_mv, float temp, float humidity, float iaq,
   u8g2_DrawStr(&u8g2, 0, 38, buf);
 
   // Draw Time
-  time_t now;
+  time_t now = wifi_time_manager_time();
   struct tm timeinfo;
-  time(&now);
   localtime_r(&now, &timeinfo);
   strftime(buf, sizeof(buf), "%H:%M:%S", &timeinfo);
   u8g2_DrawStr(&u8g2, 0, 52, buf);
@@ -182,18 +512,116 @@ void u8g2_manager_draw_ui(int voltage_mv, float temp, float humidity, float iaq,
   snprintf(buf, sizeof(buf), "IAQ: %.1f (%d)", iaq, iaq_accuracy);
   u8g2_DrawStr(&u8g2, 0, 66, buf);
 
-  u8g2_SendBuffer(&u8g2);
+  wake_trace_begin(WAKE_PHASE_DISPLAY_SEND);
+  send_frame();
+  wake_trace_end(WAKE_PHASE_DISPLAY_SEND);
+  wake_trace_end(WAKE_PHASE_DISPLAY_DRAW);
+}
+
+#define HISTORY_ROW_HEIGHT 21 // Label and line of one channel
+#define HISTORY_LABEL_HEIGHT 7
+#define HISTORY_LINE_HEIGHT (HISTORY_ROW_HEIGHT - HISTORY_LABEL_HEIGHT - 1)
+
+// Fixed point value with one decimal, without going through float
+static void format_fixed(char *buf, size_t size, int32_t value, int32_t scale)
+{
+  int32_t a = value < 0 ? -value : value;
+  snprintf(buf, size, "%s%ld.%ld", value < 0 ? "-" : "", (long)(a / scale),
+           (long)(a % scale / (scale / 10)));
+}
+
+static void draw_sparkline(int y, const char *name, const char *unit,
+                           int32_t scale, const int16_t *col)
+{
+  int32_t lo = INT16_MAX, hi = INT16_MIN;
+  for (int x = 0; x < ROLLUP_SPARK_COLUMNS; x++)
+  {
+    if (col[x] == ROLLUP_SPARK_EMPTY)
+      continue;
+    if (col[x] < lo)
+      lo = col[x];
+    if (col[x] > hi)
+      hi = col[x];
+  }
+
+  char buf[32];
+  if (lo > hi)
+  {
+    snprintf(buf, sizeof(buf), "%s --", name);
+    u8g2_DrawStr(&u8g2, 0, y + HISTORY_LABEL_HEIGHT - 1, buf);
+    return;
+  }
+  char lo_str[12], hi_str[12];
+  format_fixed(lo_str, sizeof(lo_str), lo, scale);
+  format_fixed(hi_str, sizeof(hi_str), hi, scale);
+  snprintf(buf, sizeof(buf), "%s %s..%s%s", name, lo_str, hi_str, unit);
+  u8g2_DrawStr(&u8g2, 0, y + HISTORY_LABEL_HEIGHT - 1, buf);
+
+  // Newer columns on the right, a gap breaks the line
+  int32_t range = hi > lo ? hi - lo : 1;
+  int bottom = y + HISTORY_LABEL_HEIGHT + HISTORY_LINE_HEIGHT - 1;
+  int prev = -1;
+  for (int x = 0; x < ROLLUP_SPARK_COLUMNS; x++)
+  {
+    if (col[x] == ROLLUP_SPARK_EMPTY)
+    {
+      prev = -1;
+      continue;
+    }
+    int py = bottom - (col[x] - lo) * (HISTORY_LINE_HEIGHT - 1) / range;
+    int top = prev >= 0 && prev < py ? prev : py;
+    int end = prev >= 0 && prev > py ? prev : py;
+    u8g2_DrawVLine(&u8g2, x, top, end - top + 1);
+    prev = py;
+  }
+}
+
+void u8g2_manager_draw_history(rollup_spark_t span)
+{
+  static const struct
+  {
+    rollup_channel_t ch;
+    const char *name;
+    const char *unit;
+    int32_t scale;
+  } rows[] = {
+      {ROLLUP_TEMPERATURE, "T", " C", 100},
+      {ROLLUP_HUMIDITY, "RH", " %", 100},
+      {ROLLUP_IAQ, "IAQ", "", 10},
+  };
+
+  wake_trace_begin(WAKE_PHASE_DISPLAY_DRAW);
+  display_wait();
+  u8g2_ClearBuffer(&u8g2);
+  u8g2_SetFont(&u8g2, u8g2_font_4x6_tr);
+
+  int16_t col[ROLLUP_SPARK_COLUMNS];
+  for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++)
+  {
+    rollup_manager_get_spark(span, rows[i].ch, col);
+    draw_sparkline(i * HISTORY_ROW_HEIGHT, rows[i].name, rows[i].unit,
+                   rows[i].scale, col);
+  }
+  const char *span_str = span == ROLLUP_SPARK_7D ? "7d" : "24h";
+  u8g2_DrawStr(&u8g2, 128 - 4 * strlen(span_str), HISTORY_LABEL_HEIGHT - 1,
+               span_str);
+
+  wake_trace_begin(WAKE_PHASE_DISPLAY_SEND);
+  send_frame();
+  wake_trace_end(WAKE_PHASE_DISPLAY_SEND);
+  wake_trace_end(WAKE_PHASE_DISPLAY_DRAW);
 }
 
 void u8g2_manager_print_status(const char *message)
 {
+  display_wait();
   u8g2_ClearBuffer(&u8g2);
   u8g2_SetFont(&u8g2, u8g2_font_6x10_tr);
   u8g2_DrawStr(&u8g2, 0, 30, message);
-  u8g2_SendBuffer(&u8g2);
+  send_frame();
 }
 
-i2c_master_bus_handle_t u8g2_manager_get_i2c_bus_handle(void)
+void u8g2_manager_wait_idle(void)
 {
-  return i2c_bus_handle;
+  display_wait();
 }
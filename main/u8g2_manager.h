@@ -3,7 +3,9 @@
 
 #include "driver/i2c_master.h"
 #include "esp_err.h"
+#include "rollup_manager.h"
 #include "u8g2.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,9 +14,12 @@ extern "C" {
 /**
  * @brief Initialize the U8G2 display
  *
+ * @param warm Woken from our own deep sleep: attach to the panel left
+ *             running before sleep instead of init and clear, falls back
+ *             to a full init if the panel state is not known good
  * @return esp_err_t ESP_OK on success
  */
-esp_err_t u8g2_manager_init(void);
+esp_err_t u8g2_manager_init(bool warm);
 
 /**
  * @brief Draw the main UI with voltage and sensor data
@@ -26,6 +31,17 @@ esp_err_t u8g2_manager_init(void);
 void u8g2_manager_draw_ui(int voltage_mv, float temp, float humidity, float iaq,
                           int iaq_accuracy);
 
+/**
+ * @brief Draw temperature, humidity and IAQ sparklines
+ *
+ * One column per pixel, straight from the rollup sparkline buckets, each
+ * line scaled to its own min..max. Sent like the main screen, only the
+ * tiles that changed go out.
+ *
+ * @param span 24 hours or 7 days
+ */
+void u8g2_manager_draw_history(rollup_spark_t span);
+
 /**
  * @brief Print status message to display
  * @param message String to display
@@ -33,11 +49,12 @@ void u8g2_manager_draw_ui(int voltage_mv, float temp, float humidity, float iaq,
 void u8g2_manager_print_status(const char *message);
 
 /**
- * @brief Get the I2C bus handle
+ * @brief Wait until the last frame has gone out over I2C
  *
- * @return i2c_master_bus_handle_t
+ * Draw calls return while the frame is still being sent, call this before
+ * any sleep.
  */
-i2c_master_bus_handle_t u8g2_manager_get_i2c_bus_handle(void);
+void u8g2_manager_wait_idle(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,326 @@
+#include "upload_manager.h"
+#include "esp_attr.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "log_manager.h"
+#include "nvs.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "UPLOAD_MGR";
+
+/*
+ * Wire format
+ * -----------
+ * One POST per batch, sent with chunked transfer encoding. The body is the
+ * magic "HLU1" followed by one entry per record. Every field of an entry is
+ * the zig-zag LEB128 varint of the difference to the same field of the
+ * previous entry (to 0 for the first one):
+ *
+ *   seq, timestamp, temperature_cc, humidity_cp, iaq_x10, battery_mv,
+ *   pressure in Pa, gas resistance in Ohm, iaq_accuracy, flags
+ *
+ * Between 300 s samples most differences fit in one byte, an entry is ~12
+ * bytes instead of 32. The X-Log-Epoch header carries the log epoch in hex:
+ * sequence numbers start over with a new epoch, and the collector resets
+ * its cursor when the epoch changes. It answers 2xx with the decimal
+ * sequence number of the first record it does not have yet;
+ * tools/collector has a reference implementation.
+ */
+#ifndef CONFIG_UPLOAD_URL
+#define UPLOAD_URL "http://192.168.1.10:8080/upload"
+#else
+#define UPLOAD_URL CONFIG_UPLOAD_URL
+#endif
+
+#define UPLOAD_MAGIC "HLU1"
+#define UPLOAD_WATERMARK 512          // Records waiting that trigger an upload
+#define UPLOAD_INTERVAL_S (6 * 3600)  // Upload at least this often
+#define UPLOAD_MAX_RECORDS 4096       // Per request, bounds the radio time
+#define UPLOAD_TIMEOUT_MS 10000       // HTTP connect and response
+#define UPLOAD_BACKOFF_MIN_S 600
+#define UPLOAD_BACKOFF_MAX_S (6 * 3600)
+#define UPLOAD_CHUNK_SIZE 512
+#define UPLOAD_ENTRY_MAX 48 // 8 varints of <= 5 bytes and 2 of <= 2
+#define UPLOAD_RTC_MAGIC 0x32505548 // "HUP2"
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t epoch;         // Log epoch acked_seq belongs to
+  uint32_t acked_seq;     // First record the collector doesn't have
+  int64_t last_upload_s;  // RTC time of the last acknowledged upload
+  int64_t next_attempt_s; // No attempt before this RTC time
+  uint32_t backoff_s;     // Wait after the next failure
+} upload_rtc_state_t;
+
+static RTC_DATA_ATTR upload_rtc_state_t rtc_upload;
+
+static int64_t rtc_now_s(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec;
+}
+
+// The cursor also goes to NVS, power loss must not cause a resend
+static void rtc_state_check(void)
+{
+  if (rtc_upload.magic == UPLOAD_RTC_MAGIC)
+    return;
+
+  memset(&rtc_upload, 0, sizeof(rtc_upload));
+  rtc_upload.backoff_s = UPLOAD_BACKOFF_MIN_S;
+  nvs_handle_t handle;
+  if (nvs_open("upload", NVS_READONLY, &handle) == ESP_OK)
+  {
+    nvs_get_u32(handle, "epoch", &rtc_upload.epoch);
+    nvs_get_u32(handle, "acked", &rtc_upload.acked_seq);
+    nvs_close(handle);
+  }
+  rtc_upload.magic = UPLOAD_RTC_MAGIC;
+}
+
+static void save_cursor(void)
+{
+  nvs_handle_t handle;
+  if (nvs_open("upload", NVS_READWRITE, &handle) != ESP_OK)
+    return;
+  if (nvs_set_u32(handle, "epoch", rtc_upload.epoch) == ESP_OK &&
+      nvs_set_u32(handle, "acked", rtc_upload.acked_seq) == ESP_OK)
+    nvs_commit(handle);
+  nvs_close(handle);
+}
+
+// First record to send, records overwritten before they were sent are lost
+static uint32_t pending_range(uint32_t *next_seq)
+{
+  uint32_t first_seq;
+  log_manager_get_range(&first_seq, next_seq);
+  rtc_state_check();
+
+  // The cursor of an earlier log means nothing in this one
+  uint32_t epoch = log_manager_get_epoch();
+  if (rtc_upload.epoch != epoch)
+  {
+    ESP_LOGI(TAG, "Log epoch changed to %08lx, upload starts over",
+             (unsigned long)epoch);
+    rtc_upload.epoch = epoch;
+    rtc_upload.acked_seq = first_seq;
+  }
+
+  uint32_t from = rtc_upload.acked_seq;
+  if ((int32_t)(first_seq - from) > 0 || (int32_t)(from - *next_seq) > 0)
+    from = first_seq;
+  return from;
+}
+
+uint32_t upload_manager_get_acked_seq(void)
+{
+  rtc_state_check();
+  return rtc_upload.acked_seq;
+}
+
+bool upload_manager_due(void)
+{
+  uint32_t next_seq;
+  uint32_t from = pending_range(&next_seq);
+  uint32_t waiting = next_seq - from;
+  if (waiting == 0)
+    return false;
+
+  int64_t now = rtc_now_s();
+  if (now < rtc_upload.next_attempt_s)
+    return false;
+  return waiting >= UPLOAD_WATERMARK ||
+         now - rtc_upload.last_upload_s >= UPLOAD_INTERVAL_S;
+}
+
+static size_t put_varint(uint8_t *out, int64_t value)
+{
+  uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); // zig-zag
+  size_t n = 0;
+  do
+  {
+    uint8_t b = v & 0x7F;
+    v >>= 7;
+    out[n++] = b | (v ? 0x80 : 0);
+  } while (v);
+  return n;
+}
+
+typedef struct
+{
+  int64_t field[10];
+} upload_entry_t;
+
+static void entry_from_record(const log_record_t *rec, upload_entry_t *e)
+{
+  const log_sample_t *s = &rec->sample;
+  e->field[0] = rec->seq;
+  e->field[1] = s->timestamp;
+  e->field[2] = s->temperature_cc;
+  e->field[3] = s->humidity_cp;
+  e->field[4] = s->iaq_x10;
+  e->field[5] = s->battery_mv;
+  e->field[6] = isfinite(s->pressure) ? llroundf(s->pressure * 100.0f) : 0;
+  e->field[7] = isfinite(s->gas_resistance) ? llroundf(s->gas_resistance) : 0;
+  e->field[8] = s->iaq_accuracy;
+  e->field[9] = s->flags;
+}
+
+static esp_err_t write_chunk(esp_http_client_handle_t client,
+                             const uint8_t *data, size_t len)
+{
+  char size_line[12];
+  int n = snprintf(size_line, sizeof(size_line), "%x\r\n", (unsigned)len);
+  if (esp_http_client_write(client, size_line, n) != n)
+    return ESP_FAIL;
+  if (len > 0 &&
+      esp_http_client_write(client, (const char *)data, len) != (int)len)
+    return ESP_FAIL;
+  if (esp_http_client_write(client, "\r\n", 2) != 2)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+static esp_err_t send_records(esp_http_client_handle_t client, uint32_t from,
+                              uint32_t to, uint32_t *sent)
+{
+  static uint8_t chunk[UPLOAD_CHUNK_SIZE];
+  static log_iter_t iter;
+  size_t fill = 0;
+  upload_entry_t prev = {0};
+  *sent = 0;
+
+  memcpy(chunk, UPLOAD_MAGIC, 4);
+  fill = 4;
+  esp_err_t err = log_manager_iter_init(&iter, from);
+  while (err == ESP_OK && (int32_t)(iter.seq - to) < 0)
+  {
+    log_record_t rec;
+    err = log_manager_iter_next(&iter, &rec);
+    if (err == ESP_ERR_INVALID_CRC)
+    {
+      err = ESP_OK;
+      continue; // Torn block, nothing to send
+    }
+    if (err != ESP_OK || (int32_t)(rec.seq - to) >= 0)
+      break;
+
+    upload_entry_t e;
+    entry_from_record(&rec, &e);
+    if (fill + UPLOAD_ENTRY_MAX > sizeof(chunk))
+    {
+      if (write_chunk(client, chunk, fill) != ESP_OK)
+        return ESP_FAIL;
+      fill = 0;
+    }
+    for (int i = 0; i < 10; i++)
+      fill += put_varint(&chunk[fill], e.field[i] - prev.field[i]);
+    prev = e;
+    (*sent)++;
+  }
+
+  if (fill > 0 && write_chunk(client, chunk, fill) != ESP_OK)
+    return ESP_FAIL;
+  return write_chunk(client, NULL, 0); // Last chunk
+}
+
+static void upload_failed(void)
+{
+  rtc_upload.next_attempt_s = rtc_now_s() + rtc_upload.backoff_s;
+  ESP_LOGW(TAG, "Upload failed, next attempt in %lu s",
+           (unsigned long)rtc_upload.backoff_s);
+  rtc_upload.backoff_s = rtc_upload.backoff_s * 2 > UPLOAD_BACKOFF_MAX_S
+                             ? UPLOAD_BACKOFF_MAX_S
+                             : rtc_upload.backoff_s * 2;
+}
+
+esp_err_t upload_manager_run(void)
+{
+  uint32_t next_seq;
+  uint32_t from = pending_range(&next_seq);
+  uint32_t to = next_seq;
+  if (to - from > UPLOAD_MAX_RECORDS)
+    to = from + UPLOAD_MAX_RECORDS;
+  if (to == from)
+    return ESP_OK;
+
+  esp_http_client_config_t config = {
+      .url = UPLOAD_URL,
+      .method = HTTP_METHOD_POST,
+      .timeout_ms = UPLOAD_TIMEOUT_MS,
+  };
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == NULL)
+    return ESP_ERR_NO_MEM;
+
+  uint8_t mac[6];
+  char device[18] = "";
+  if (esp_efuse_mac_get_default(mac) == ESP_OK)
+    snprintf(device, sizeof(device), "%02x%02x%02x%02x%02x%02x", mac[0],
+             mac[1], mac[2], mac[3], mac[4], mac[5]);
+  char first[12];
+  char epoch[12];
+  snprintf(first, sizeof(first), "%lu", (unsigned long)from);
+  snprintf(epoch, sizeof(epoch), "%08lx", (unsigned long)rtc_upload.epoch);
+  esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+  esp_http_client_set_header(client, "X-Device", device);
+  esp_http_client_set_header(client, "X-First-Seq", first);
+  esp_http_client_set_header(client, "X-Log-Epoch", epoch);
+
+  ESP_LOGI(TAG, "Uploading records %lu..%lu", (unsigned long)from,
+           (unsigned long)to - 1);
+  uint32_t sent = 0;
+  esp_err_t err = esp_http_client_open(client, -1); // -1: chunked
+  if (err == ESP_OK)
+    err = send_records(client, from, to, &sent);
+
+  int status = 0;
+  char body[16] = "";
+  if (err == ESP_OK && esp_http_client_fetch_headers(client) >= 0)
+  {
+    status = esp_http_client_get_status_code(client);
+    int n = esp_http_client_read_response(client, body, sizeof(body) - 1);
+    body[n > 0 ? n : 0] = '\0';
+  }
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+
+  if (status < 200 || status >= 300)
+  {
+    ESP_LOGW(TAG, "Collector answered %d (%s)", status, esp_err_to_name(err));
+    upload_failed();
+    return ESP_FAIL;
+  }
+
+  // The collector says where it stands, without an answer trust the batch.
+  // An answer outside the batch means it tracks another log or device, the
+  // records were not taken.
+  char *end;
+  unsigned long acked = strtoul(body, &end, 10);
+  if (end == body)
+    acked = to;
+  if ((int32_t)(acked - from) < 0 || (int32_t)(acked - to) > 0)
+  {
+    ESP_LOGW(TAG, "Collector is at record %lu, sent %lu..%lu", acked,
+             (unsigned long)from, (unsigned long)to - 1);
+    upload_failed();
+    return ESP_FAIL;
+  }
+  if ((int32_t)(acked - rtc_upload.acked_seq) > 0)
+    rtc_upload.acked_seq = acked;
+  rtc_upload.last_upload_s = rtc_now_s();
+  rtc_upload.next_attempt_s = 0;
+  rtc_upload.backoff_s = UPLOAD_BACKOFF_MIN_S;
+  save_cursor();
+
+  ESP_LOGI(TAG, "%lu records sent, acknowledged up to %lu",
+           (unsigned long)sent, (unsigned long)rtc_upload.acked_seq);
+  return ESP_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef UPLOAD_MANAGER_H
+#define UPLOAD_MANAGER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Whether the log should be uploaded on the next WiFi session
+ *
+ * Due once enough records are waiting on flash, or the upload interval has
+ * passed with at least one record waiting, and no failed upload is being
+ * backed off.
+ */
+bool upload_manager_due(void);
+
+/**
+ * @brief Send every unacknowledged flash record in one request
+ *
+ * Needs a WiFi connection, it runs inside the session started by
+ * wifi_time_manager_sync_start(). Records are delta encoded and sent
+ * chunked to the collector; the sequence number the collector reports
+ * back becomes the new acknowledged cursor, kept in RTC memory and NVS.
+ *
+ * @return esp_err_t ESP_OK if the collector acknowledged the batch
+ */
+esp_err_t upload_manager_run(void);
+
+/**
+ * @brief Sequence number of the first record not yet acknowledged
+ */
+uint32_t upload_manager_get_acked_seq(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UPLOAD_MANAGER_H
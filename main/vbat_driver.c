@@ -1,132 +1,249 @@
 #include "vbat_driver.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
-#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "common_data.h"
+#include "wake_trace.h"
+#include <stdlib.h>
+#include <string.h>
 static const char *TAG = "adc_driver";
 
-// Single instance handles managed by the driver
-static adc_oneshot_unit_handle_t adc1_handle = NULL;
-static adc_cali_handle_t adc1_cali_handle = NULL;
-static bool is_calibrated = false;
-
 // Fixed configuration
 #define VBAT_ADC_UNIT ADC_UNIT_1
 #define VBAT_ADC_CHANNEL ADC_CHANNEL_1 // GPIO 1 on ESP32-C6
 #define VBAT_ADC_ATTEN ADC_ATTEN_DB_12
 
-static bool adc_calibration_init(adc_unit_t unit, adc_channel_t channel,
-                                 adc_atten_t atten,
-                                 adc_cali_handle_t *out_handle);
+// Burst of samples per reading, taken by the ADC DMA
+#define VBAT_BURST_SAMPLES 64
+#define VBAT_SAMPLE_FREQ_HZ 20000 // 64 samples in ~3.2 ms
+#define VBAT_READ_TIMEOUT_MS 20
+
+// Calibration table, raw code to mV in VBAT_CALI_STEP steps
+#define VBAT_CALI_STEP 128
+#define VBAT_CALI_POINTS (4096 / VBAT_CALI_STEP + 1)
+#define VBAT_RTC_MAGIC 0x54414256 // "VBAT"
+
+// Smoothing across readings, 1/2^N weight for a new one
+#define VBAT_EMA_SHIFT 2
+// A jump this large is a charger (dis)connect, not noise
+#define VBAT_EMA_RESET_MV 150
+
+/*
+ * Kept across deep sleep: the curve fitting calibration sampled into a
+ * table, so warm wakes don't rebuild it from eFuse, and the smoothed
+ * battery voltage.
+ */
+typedef struct
+{
+  uint32_t magic;
+  bool calibrated;
+  uint16_t cali_mv[VBAT_CALI_POINTS];
+  int32_t ema_mv; // Smoothed battery voltage, after the divider
+  uint32_t ema_samples;
+} vbat_rtc_state_t;
+
+static RTC_DATA_ATTR vbat_rtc_state_t rtc_vbat;
+
+static adc_continuous_handle_t adc_handle = NULL;
+
+static void adc_calibration_cache(adc_unit_t unit, adc_channel_t channel,
+                                  adc_atten_t atten);
 
 esp_err_t vbat_driver_init(void)
 {
-  if (adc1_handle != NULL)
+  if (adc_handle != NULL)
   {
     ESP_LOGW(TAG, "ADC driver already initialized");
     return ESP_OK;
   }
 
-  //-------------ADC1 Init---------------//
-  adc_oneshot_unit_init_cfg_t init_config1 = {
-      .unit_id = VBAT_ADC_UNIT,
-      .ulp_mode = ADC_ULP_MODE_DISABLE,
+  wake_trace_begin(WAKE_PHASE_VBAT_INIT);
+
+  //-------------ADC1 Continuous Init---------------//
+  adc_continuous_handle_cfg_t handle_config = {
+      .max_store_buf_size = VBAT_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES * 2,
+      .conv_frame_size = VBAT_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES,
+      .flags.flush_pool = true,
   };
-  ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
+  ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc_handle));
 
   //-------------ADC1 Config---------------//
-  adc_oneshot_chan_cfg_t config = {
+  adc_digi_pattern_config_t pattern = {
       .atten = VBAT_ADC_ATTEN,
-      .bitwidth = ADC_BITWIDTH_DEFAULT,
+      .channel = VBAT_ADC_CHANNEL,
+      .unit = VBAT_ADC_UNIT,
+      .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
   };
-  ESP_ERROR_CHECK(
-      adc_oneshot_config_channel(adc1_handle, VBAT_ADC_CHANNEL, &config));
+  adc_continuous_config_t config = {
+      .pattern_num = 1,
+      .adc_pattern = &pattern,
+      .sample_freq_hz = VBAT_SAMPLE_FREQ_HZ,
+      .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+      .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+  };
+  ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &config));
 
-  //-------------ADC1 Calibration Init---------------//
-  is_calibrated = adc_calibration_init(VBAT_ADC_UNIT, VBAT_ADC_CHANNEL,
-                                       VBAT_ADC_ATTEN, &adc1_cali_handle);
+  //-------------ADC1 Calibration---------------//
+  if (rtc_vbat.magic != VBAT_RTC_MAGIC)
+  {
+    memset(&rtc_vbat, 0, sizeof(rtc_vbat));
+    adc_calibration_cache(VBAT_ADC_UNIT, VBAT_ADC_CHANNEL, VBAT_ADC_ATTEN);
+    rtc_vbat.magic = VBAT_RTC_MAGIC;
+  }
 
+  wake_trace_end(WAKE_PHASE_VBAT_INIT);
   return ESP_OK;
 }
 
+static int compare_int(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
 esp_err_t vbat_driver_read_raw(int *raw_out)
 {
-  if (adc1_handle == NULL)
+  if (adc_handle == NULL)
   {
     return ESP_ERR_INVALID_STATE;
   }
-  return adc_oneshot_read(adc1_handle, VBAT_ADC_CHANNEL, raw_out);
-}
 
-esp_err_t vbat_driver_read_voltage(int *voltage_mv)
-{
-  int raw;
-  esp_err_t ret = vbat_driver_read_raw(&raw);
+  static uint8_t buf[VBAT_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES];
+  int samples[VBAT_BURST_SAMPLES];
+  int n = 0;
+
+  adc_continuous_flush_pool(adc_handle);
+  esp_err_t ret = adc_continuous_start(adc_handle);
   if (ret != ESP_OK)
     return ret;
+  while (n < VBAT_BURST_SAMPLES)
+  {
+    uint32_t len = 0;
+    ret = adc_continuous_read(adc_handle, buf, sizeof(buf), &len,
+                              VBAT_READ_TIMEOUT_MS);
+    if (ret != ESP_OK)
+      break;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len && n < VBAT_BURST_SAMPLES;
+         i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+      const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&buf[i];
+      if (p->type2.channel == VBAT_ADC_CHANNEL)
+        samples[n++] = p->type2.data;
+    }
+  }
+  adc_continuous_stop(adc_handle);
 
-  if (is_calibrated)
+  if (n < VBAT_BURST_SAMPLES / 2)
   {
-    return adc_cali_raw_to_voltage(adc1_cali_handle, raw, voltage_mv);
+    ESP_LOGW(TAG, "ADC burst short: %d samples", n);
+    return ret != ESP_OK ? ret : ESP_ERR_TIMEOUT;
   }
-  else
+
+  // Mean of the middle half around the median, spikes can't move it
+  qsort(samples, n, sizeof(samples[0]), compare_int);
+  int lo = n / 4, hi = n - n / 4;
+  int sum = 0;
+  for (int i = lo; i < hi; i++)
+    sum += samples[i];
+  *raw_out = (sum + (hi - lo) / 2) / (hi - lo);
+  return ESP_OK;
+}
+
+static int raw_to_mv(int raw)
+{
+  if (!rtc_vbat.calibrated)
   {
     // Fallback or handle uncalibrated state
     // On ESP32-C6, 12dB attenuation covers up to ~3.3V
-    *voltage_mv = (raw * 3300) / 4095;
-    return ESP_OK;
+    return (raw * 3300) / 4095;
   }
+
+  // Linear between table points, the fitted curve is smooth
+  if (raw < 0)
+    raw = 0;
+  int idx = raw / VBAT_CALI_STEP;
+  if (idx >= VBAT_CALI_POINTS - 1)
+    idx = VBAT_CALI_POINTS - 2;
+  int frac = raw - idx * VBAT_CALI_STEP;
+  int lo = rtc_vbat.cali_mv[idx], hi = rtc_vbat.cali_mv[idx + 1];
+  return lo + ((hi - lo) * frac + VBAT_CALI_STEP / 2) / VBAT_CALI_STEP;
+}
+
+esp_err_t vbat_driver_read_voltage(int *voltage_mv)
+{
+  int raw;
+  esp_err_t ret = vbat_driver_read_raw(&raw);
+  if (ret != ESP_OK)
+    return ret;
+
+  *voltage_mv = raw_to_mv(raw);
+  return ESP_OK;
 }
 
 esp_err_t vbat_driver_read()
 {
   int voltage_mv = 0;
+  wake_trace_begin(WAKE_PHASE_VBAT_READ);
   esp_err_t ret = vbat_driver_read_voltage(&voltage_mv);
-  if (ret == ESP_OK)
-  {
-    latest_data.battery_voltage_mv = voltage_mv * 2; // Apply voltage divider scaling
-  }
-  return ret;
+  wake_trace_end(WAKE_PHASE_VBAT_READ);
+  if (ret != ESP_OK)
+    return ret;
+
+  int battery_mv = voltage_mv * 2; // Apply voltage divider scaling
+  if (rtc_vbat.ema_samples == 0 ||
+      abs(battery_mv - rtc_vbat.ema_mv) > VBAT_EMA_RESET_MV)
+    rtc_vbat.ema_mv = battery_mv;
+  else
+    rtc_vbat.ema_mv += (battery_mv - rtc_vbat.ema_mv) / (1 << VBAT_EMA_SHIFT);
+  rtc_vbat.ema_samples++;
+
+  latest_data.battery_voltage_mv = rtc_vbat.ema_mv;
+  return ESP_OK;
 }
 
-static bool adc_calibration_init(adc_unit_t unit, adc_channel_t channel,
-                                 adc_atten_t atten,
-                                 adc_cali_handle_t *out_handle)
+/*
+ * Build the curve fitting scheme once and sample it into the RTC table,
+ * the scheme itself is freed again.
+ */
+static void adc_calibration_cache(adc_unit_t unit, adc_channel_t channel,
+                                  adc_atten_t atten)
 {
   adc_cali_handle_t handle = NULL;
-  esp_err_t ret = ESP_FAIL;
-  bool calibrated = false;
 
-  if (!calibrated)
-  {
-    ESP_LOGI(TAG, "Calibration scheme: Curve Fitting");
-    adc_cali_curve_fitting_config_t cali_config = {
-        .unit_id = unit,
-        .chan = channel,
-        .atten = atten,
-        .bitwidth = ADC_BITWIDTH_DEFAULT,
-    };
-    ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
-    if (ret == ESP_OK)
-    {
-      calibrated = true;
-    }
-  }
-
-  *out_handle = handle;
-  if (ret == ESP_OK)
-  {
-    ESP_LOGI(TAG, "Calibration Success");
-  }
-  else if (ret == ESP_ERR_NOT_SUPPORTED || !calibrated)
+  ESP_LOGI(TAG, "Calibration scheme: Curve Fitting");
+  adc_cali_curve_fitting_config_t cali_config = {
+      .unit_id = unit,
+      .chan = channel,
+      .atten = atten,
+      .bitwidth = ADC_BITWIDTH_DEFAULT,
+  };
+  esp_err_t ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
+  if (ret == ESP_ERR_NOT_SUPPORTED)
   {
     ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
+    return;
   }
-  else
+  else if (ret != ESP_OK)
   {
     ESP_LOGE(TAG, "Invalid arg or no memory");
+    return;
+  }
+
+  rtc_vbat.calibrated = true;
+  for (int i = 0; i < VBAT_CALI_POINTS; i++)
+  {
+    int raw = i * VBAT_CALI_STEP;
+    int mv = 0;
+    if (adc_cali_raw_to_voltage(handle, raw > 4095 ? 4095 : raw, &mv) != ESP_OK)
+    {
+      rtc_vbat.calibrated = false;
+      break;
+    }
+    rtc_vbat.cali_mv[i] = mv;
   }
+  adc_cali_delete_scheme_curve_fitting(handle);
 
-  return calibrated;
+  if (rtc_vbat.calibrated)
+    ESP_LOGI(TAG, "Calibration Success");
 }
@@ -12,7 +12,8 @@ extern "C"
     /**
      * @brief Initialize the ADC driver for battery voltage monitoring (GPIO 1)
      *
-     * Handles internal handles for one-shot unit and calibration.
+     * Sets up ADC continuous mode (DMA). The calibration is built once and
+     * kept in RTC memory, warm wakes reuse it.
      *
      * @return esp_err_t ESP_OK on success
      */
@@ -21,6 +22,9 @@ extern "C"
     /**
      * @brief Read battery voltage directly into latest_data_t struct
      *
+     * Smoothed across readings and wakes, a jump of more than 150 mV
+     * (charger plugged in or out) is taken over right away.
+     *
      * @param data Pointer to the unified data struct
      * @return esp_err_t ESP_OK on success
      */
@@ -37,6 +41,8 @@ extern "C"
     /**
      * @brief Read the raw ADC data
      *
+     * A burst of 64 DMA samples, reduced to the mean of the middle half.
+     *
      * @param raw_out Pointer to store the result
      * @return esp_err_t ESP_OK on success
      */
@@ -0,0 +1,164 @@
+#include "wake_trace.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define WAKE_TRACE_CYCLES 8 // Wakes kept in the ring
+#define WAKE_TRACE_SPANS 20 // Phases recorded per wake
+#define WAKE_TRACE_MAGIC 0x32525457 // "WTR2"
+#define WAKE_TRACE_TEXT_MAX 192 // Longest piece of dump text
+
+typedef struct
+{
+  uint32_t start_us;    // esp_timer time at phase start
+  uint32_t dur_us : 24; // Phase duration, saturates at ~16.7 s
+  uint32_t phase : 8;   // wake_phase_t
+} wake_span_t;
+
+typedef struct
+{
+  uint32_t wake_index; // Running wake counter
+  uint32_t unix_time;  // Wall clock at wake, 0 if not yet valid
+  uint8_t warm;
+  uint8_t n_spans;
+  wake_span_t spans[WAKE_TRACE_SPANS];
+} wake_cycle_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t wake_count;    // Wakes recorded since the ring was reset
+  wake_cycle_t cycles[WAKE_TRACE_CYCLES];
+} wake_trace_ring_t;
+
+static RTC_DATA_ATTR wake_trace_ring_t trace_ring;
+
+static const char *const phase_names[WAKE_PHASE_COUNT] = {
+    [WAKE_PHASE_WAKE] = "wake",
+    [WAKE_PHASE_BOOT_INIT] = "boot_init",
+    [WAKE_PHASE_DISPLAY_INIT] = "display_init",
+    [WAKE_PHASE_TIME_CHECK] = "time_check",
+    [WAKE_PHASE_NVS_INIT] = "nvs_init",
+    [WAKE_PHASE_VBAT_INIT] = "vbat_init",
+    [WAKE_PHASE_VBAT_READ] = "vbat_read",
+    [WAKE_PHASE_BSEC_INIT] = "bsec_init",
+    [WAKE_PHASE_BSEC_CONFIG] = "bsec_config",
+    [WAKE_PHASE_STATE_LOAD] = "state_load",
+    [WAKE_PHASE_BSEC_SUBSCRIBE] = "bsec_subscribe",
+    [WAKE_PHASE_BSEC_RUN] = "bsec_run",
+    [WAKE_PHASE_DISPLAY_DRAW] = "display_draw",
+    [WAKE_PHASE_DISPLAY_SEND] = "display_send",
+    [WAKE_PHASE_LOG] = "log",
+    [WAKE_PHASE_STATE_SAVE] = "state_save",
+};
+
+// Start stamps of open phases, only needed during this wake
+static uint32_t phase_start_us[WAKE_PHASE_COUNT];
+static wake_cycle_t *current = NULL;
+// The BSEC task records its phases alongside app_main
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void wake_trace_begin_cycle(bool warm)
+{
+  if (trace_ring.magic != WAKE_TRACE_MAGIC)
+  {
+    memset(&trace_ring, 0, sizeof(trace_ring));
+    trace_ring.magic = WAKE_TRACE_MAGIC;
+  }
+
+  current = &trace_ring.cycles[trace_ring.wake_count % WAKE_TRACE_CYCLES];
+  current->wake_index = trace_ring.wake_count++;
+  current->warm = warm;
+  current->n_spans = 0;
+
+  time_t now = time(NULL);
+  current->unix_time = now > 0 ? (uint32_t)now : 0;
+
+  wake_trace_begin(WAKE_PHASE_WAKE);
+}
+
+void wake_trace_begin(wake_phase_t phase)
+{
+  if (phase < WAKE_PHASE_COUNT)
+    phase_start_us[phase] = (uint32_t)esp_timer_get_time();
+}
+
+void wake_trace_end(wake_phase_t phase)
+{
+  if (current == NULL || phase >= WAKE_PHASE_COUNT)
+    return;
+
+  uint32_t dur = (uint32_t)esp_timer_get_time() - phase_start_us[phase];
+  portENTER_CRITICAL(&trace_lock);
+  if (current->n_spans < WAKE_TRACE_SPANS)
+  {
+    wake_span_t *span = &current->spans[current->n_spans++];
+    span->start_us = phase_start_us[phase];
+    span->dur_us = dur > 0xFFFFFF ? 0xFFFFFF : dur;
+    span->phase = phase;
+  }
+  portEXIT_CRITICAL(&trace_lock);
+}
+
+static void emit(wake_trace_write_t write, void *arg, const char *fmt, ...)
+{
+  char text[WAKE_TRACE_TEXT_MAX];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    write(text, n < (int)sizeof(text) ? (size_t)n : sizeof(text) - 1, arg);
+}
+
+void wake_trace_dump(wake_trace_write_t write, void *arg)
+{
+  if (trace_ring.magic != WAKE_TRACE_MAGIC)
+    return;
+
+  uint32_t count = trace_ring.wake_count < WAKE_TRACE_CYCLES
+                       ? trace_ring.wake_count
+                       : WAKE_TRACE_CYCLES;
+  uint32_t first = trace_ring.wake_count - count;
+
+  emit(write, arg, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"firmware\":\"%s\"},"
+       "\"traceEvents\":[\n",
+       esp_app_get_description()->version);
+
+  bool first_event = true;
+  for (uint32_t w = first; w < trace_ring.wake_count; w++)
+  {
+    // A copy, the BSEC task may be adding a phase to the current wake
+    wake_cycle_t copy;
+    portENTER_CRITICAL(&trace_lock);
+    copy = trace_ring.cycles[w % WAKE_TRACE_CYCLES];
+    portEXIT_CRITICAL(&trace_lock);
+    const wake_cycle_t *cycle = &copy;
+
+    // One row per wake, named after its index, boot type and wall clock
+    emit(write, arg,
+         "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+         "\"tid\":%lu,\"args\":{\"name\":\"wake %lu (%s) t=%lu\"}}",
+         first_event ? "" : ",\n", (unsigned long)cycle->wake_index,
+         (unsigned long)cycle->wake_index, cycle->warm ? "warm" : "cold",
+         (unsigned long)cycle->unix_time);
+    first_event = false;
+
+    for (uint8_t i = 0; i < cycle->n_spans; i++)
+    {
+      const wake_span_t *span = &cycle->spans[i];
+      emit(write, arg,
+           ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%lu,"
+           "\"ts\":%lu,\"dur\":%lu}",
+           span->phase < WAKE_PHASE_COUNT ? phase_names[span->phase] : "?",
+           (unsigned long)cycle->wake_index, (unsigned long)span->start_us,
+           (unsigned long)span->dur_us);
+    }
+  }
+  emit(write, arg, "\n]}\n");
+}
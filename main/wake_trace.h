@@ -0,0 +1,73 @@
+#ifndef WAKE_TRACE_H
+#define WAKE_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Phases of a wake cycle, nested phases are fine */
+typedef enum
+{
+  WAKE_PHASE_WAKE,           // Whole wake, app_main to deep sleep
+  WAKE_PHASE_BOOT_INIT,      // Cold or warm boot specific init
+  WAKE_PHASE_DISPLAY_INIT,   // I2C bus and panel init
+  WAKE_PHASE_TIME_CHECK,     // RTC time check / WiFi + SNTP sync
+  WAKE_PHASE_NVS_INIT,       // nvs_flash_init
+  WAKE_PHASE_VBAT_INIT,      // ADC unit and calibration setup
+  WAKE_PHASE_VBAT_READ,      // Battery voltage sample
+  WAKE_PHASE_BSEC_INIT,      // bsec2_init
+  WAKE_PHASE_BSEC_CONFIG,    // bsec2_set_config
+  WAKE_PHASE_STATE_LOAD,     // BSEC state restore
+  WAKE_PHASE_BSEC_SUBSCRIBE, // bsec2_update_subscription
+  WAKE_PHASE_BSEC_RUN,       // bsec2_run incl. measurement wait
+  WAKE_PHASE_DISPLAY_DRAW,   // Frame render and send
+  WAKE_PHASE_DISPLAY_SEND,   // u8g2_SendBuffer
+  WAKE_PHASE_LOG,            // Log staging and flush
+  WAKE_PHASE_STATE_SAVE,     // BSEC state save
+  WAKE_PHASE_COUNT
+} wake_phase_t;
+
+/**
+ * @brief Start a new wake cycle in the RTC trace ring
+ *
+ * Call first thing in app_main, the trace clock is esp_timer_get_time().
+ *
+ * @param warm Whether this is a warm (timer) wake
+ */
+void wake_trace_begin_cycle(bool warm);
+
+/**
+ * @brief Mark the start of a phase
+ */
+void wake_trace_begin(wake_phase_t phase);
+
+/**
+ * @brief Mark the end of a phase and record it in the current cycle
+ */
+void wake_trace_end(wake_phase_t phase);
+
+/* Receives the dump text piece by piece */
+typedef void (*wake_trace_write_t)(const char *text, size_t len, void *arg);
+
+/**
+ * @brief Write the last wakes as Chrome trace / Perfetto JSON
+ *
+ * Saved to a .json file it opens in ui.perfetto.dev or chrome://tracing.
+ * Every wake is one row, all starting at 0; the wake in progress shows the
+ * phases it has finished. Served on request by export_manager ("HLX
+ * TRACE"), the wake path never pays for it.
+ *
+ * @param write Called with every piece of the text, at most one event long
+ * @param arg Passed on to write
+ */
+void wake_trace_dump(wake_trace_write_t write, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WAKE_TRACE_H
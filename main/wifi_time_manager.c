@@ -1,15 +1,20 @@
-#include "u8g2_manager.h" // Include header for display access
+#include "wifi_time_manager.h"
 
 #include "esp_attr.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
 #include "esp_sntp.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "mbedtls/pkcs5.h"
+#include "nvs.h"
 #include "nvs_flash.h"
+#include "upload_manager.h"
+#include "wake_trace.h"
 // #include "protocol_examples_common.h" -- NOT AVAILABLE
 #include <string.h>
 #include <sys/time.h>
@@ -24,34 +29,136 @@ static const char *TAG = "WIFI_TIME_MGR";
 #define WIFI_PASS "170525ANee"
 #define MAXIMUM_RETRY 5
 
+// Optional fixed address, DHCP is skipped altogether
+// #define WIFI_STATIC_IP "192.168.1.50"
+// #define WIFI_STATIC_NETMASK "255.255.255.0"
+// #define WIFI_STATIC_GW "192.168.1.1"
+// #define WIFI_STATIC_DNS "192.168.1.1"
+
+// The cached AP gets this long before falling back to a full scan
+#define WIFI_FAST_CONNECT_MS 1500
+// A cached DHCP lease is reused this long, well inside common lease times
+#define WIFI_LEASE_REUSE_S (12 * 3600)
+#define WIFI_CACHE_MAGIC 0x48434657 // "WFCH"
+
+// Whole attempt, WiFi connect + SNTP, before the radio is shut down again
+#define TIME_SYNC_DEADLINE_MS 15000
+// Wait after a failed attempt, doubled per failure in a row
+#define TIME_SYNC_BACKOFF_MIN_S 60
+#define TIME_SYNC_BACKOFF_MAX_S (6 * 3600)
+// RTC error rate assumed until measured, the radio is only worth it past
+// the error limit
+#define TIME_DRIFT_PPM 100
+#define TIME_MAX_ERROR_MS 2000
+// Drift fit: a sample needs this much RTC time since the last sync to be
+// above the SNTP jitter, larger rates are clock steps, not drift
+#define TIME_DRIFT_MIN_SPAN_S 1800
+#define TIME_DRIFT_MAX_PPB 5000000
+// Older samples are weighted down by 3/4 per sync
+#define TIME_DRIFT_DECAY_NUM 3
+#define TIME_DRIFT_DECAY_DEN 4
+// Temperature moves the rate around even when the fit is good
+#define TIME_DRIFT_MIN_UNCERTAINTY_PPB 5000
+#define TIME_SYNC_TASK_STACK 6144 // HTTP client for the upload
+#define TIME_RTC_MAGIC 0x434E5953 // "SYNC"
+
+// Sync bookkeeping on the RTC clock, kept across deep sleep
+typedef struct
+{
+  uint32_t magic;
+  int64_t synced_at_s;    // RTC time of the last good sync, 0 = never
+  int64_t next_attempt_s; // No attempt before this RTC time
+  uint32_t backoff_s;     // Wait after the next failure
+  uint32_t failures;      // Failed attempts in a row
+  // Drift fit, offset over RTC time since the previous sync, decayed sums
+  int64_t fit_offset_us;
+  int64_t fit_span_s;
+  int32_t drift_ppb;       // RTC rate error, positive = RTC runs slow
+  int32_t drift_dev_ppb;   // Mean deviation of the samples from the fit
+  uint32_t drift_samples;
+} time_rtc_state_t;
+
+// The drift fit in NVS, it is a property of the board and outlives power-off
+typedef struct
+{
+  int64_t fit_offset_us;
+  int64_t fit_span_s;
+  int32_t drift_ppb;
+  int32_t drift_dev_ppb;
+  uint32_t drift_samples;
+} time_drift_nvs_t;
+
+static RTC_DATA_ATTR time_rtc_state_t rtc_time;
+
 static int s_retry_num = 0;
 static EventGroupHandle_t s_wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
+#define TIME_SYNCED_BIT BIT2
+#define SYNC_IDLE_BIT BIT3 // No sync task running
+
+/*
+ * Fast reconnect: the AP found last time is joined directly on its channel,
+ * with the WPA2 PMK precomputed (PBKDF2 is 4096 SHA1 rounds) and the last
+ * DHCP lease configured statically. The AP and PMK are also kept in NVS for
+ * cold boots, the lease only in RTC memory.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t cred_crc; // CRC32 of the SSID and passphrase the PMK is for
+  uint8_t pmk[32];
+  uint8_t bssid[6];
+  uint8_t channel;   // 0 = no AP cached
+  bool lease_valid;
+  int64_t lease_at_s; // RTC time the lease was obtained
+  esp_netif_ip_info_t ip_info;
+  esp_netif_dns_info_t dns;
+} wifi_cache_t;
+
+static RTC_DATA_ATTR wifi_cache_t rtc_wifi;
+
+static esp_netif_t *sta_netif = NULL;
+static bool fast_attempt;  // Connecting to the cached AP, no retries
+static bool lease_applied; // IP configured from the cache, not DHCP
+
+static TaskHandle_t sync_task = NULL;
+
+// Measured by sntp_sync_time() right before it steps the clock
+static int64_t sync_offset_us; // SNTP time minus RTC time
+static int64_t sync_rtc_s;     // RTC time at that point
+
+static int64_t rtc_now_s(void);
 
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data)
 {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
   {
-    u8g2_manager_print_status("Connecting WiFi...");
     esp_wifi_connect();
   }
+  else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+  {
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+    memcpy(rtc_wifi.bssid, event->bssid, sizeof(rtc_wifi.bssid));
+    rtc_wifi.channel = event->channel;
+  }
   else if (event_base == WIFI_EVENT &&
            event_id == WIFI_EVENT_STA_DISCONNECTED)
   {
-    if (s_retry_num < MAXIMUM_RETRY)
+    if (fast_attempt)
+    {
+      // Straight to the full scan instead of retrying a stale AP
+      xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    }
+    else if (s_retry_num < MAXIMUM_RETRY)
     {
-      char buf[32];
-      snprintf(buf, sizeof(buf), "Retrying WiFi (%d)", s_retry_num + 1);
-      u8g2_manager_print_status(buf);
       esp_wifi_connect();
       s_retry_num++;
       ESP_LOGI(TAG, "retry to connect to the AP");
     }
     else
     {
-      u8g2_manager_print_status("WiFi Failed!");
       xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
     }
     ESP_LOGI(TAG, "connect to the AP fail");
@@ -60,24 +167,46 @@ static void event_handler(void *arg, esp_event_base_t event_base,
   {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+    if (!lease_applied)
+    {
+      rtc_wifi.ip_info = event->ip_info;
+      esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &rtc_wifi.dns);
+      rtc_wifi.lease_at_s = rtc_now_s();
+      rtc_wifi.lease_valid = true;
+    }
     s_retry_num = 0;
-    u8g2_manager_print_status("WiFi Connected!");
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
   }
 }
 
-// ...
+static int64_t rtc_now_s(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec;
+}
+
+static void rtc_state_check(void)
+{
+  if (rtc_time.magic != TIME_RTC_MAGIC)
+  {
+    memset(&rtc_time, 0, sizeof(rtc_time));
+    rtc_time.backoff_s = TIME_SYNC_BACKOFF_MIN_S;
+    rtc_time.magic = TIME_RTC_MAGIC;
+  }
+}
 
-static void wifi_init_sta(void)
+// netif, the event loop and the handlers live for the whole boot, only the
+// WiFi driver itself is brought up and down per attempt
+static void wifi_stack_init(void)
 {
-  s_wifi_event_group = xEventGroupCreate();
+  static bool stack_ready = false;
+  if (stack_ready)
+    return;
 
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
-
-  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+  sta_netif = esp_netif_create_default_wifi_sta();
 
   esp_event_handler_instance_t instance_any_id;
   esp_event_handler_instance_t instance_got_ip;
@@ -85,6 +214,109 @@ static void wifi_init_sta(void)
       WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, &instance_any_id));
   ESP_ERROR_CHECK(esp_event_handler_instance_register(
       IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, &instance_got_ip));
+  stack_ready = true;
+}
+
+static TickType_t ticks_left(TickType_t deadline)
+{
+  TickType_t left = deadline - xTaskGetTickCount();
+  return (int32_t)left > 0 ? left : 0;
+}
+
+static uint32_t cred_crc(void)
+{
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)WIFI_SSID,
+                                  strlen(WIFI_SSID));
+  return esp_rom_crc32_le(crc, (const uint8_t *)WIFI_PASS, strlen(WIFI_PASS));
+}
+
+static void wifi_cache_save(void)
+{
+  nvs_handle_t handle;
+  if (nvs_open("wifi", NVS_READWRITE, &handle) != ESP_OK)
+    return;
+  if (nvs_set_blob(handle, "cache", &rtc_wifi, sizeof(rtc_wifi)) == ESP_OK)
+    nvs_commit(handle);
+  nvs_close(handle);
+}
+
+static void wifi_cache_load(void)
+{
+  if (rtc_wifi.magic != WIFI_CACHE_MAGIC)
+  {
+    size_t size = sizeof(rtc_wifi);
+    nvs_handle_t handle;
+    bool found = false;
+    if (nvs_open("wifi", NVS_READONLY, &handle) == ESP_OK)
+    {
+      found = nvs_get_blob(handle, "cache", &rtc_wifi, &size) == ESP_OK &&
+              size == sizeof(rtc_wifi) && rtc_wifi.magic == WIFI_CACHE_MAGIC;
+      nvs_close(handle);
+    }
+    if (!found)
+    {
+      memset(&rtc_wifi, 0, sizeof(rtc_wifi));
+      rtc_wifi.magic = WIFI_CACHE_MAGIC;
+    }
+    // The lease's age is unknown after a cold boot
+    rtc_wifi.lease_valid = false;
+  }
+
+  if (rtc_wifi.cred_crc != cred_crc())
+  {
+    ESP_LOGI(TAG, "Computing PMK");
+    memset(rtc_wifi.bssid, 0, sizeof(rtc_wifi.bssid));
+    rtc_wifi.channel = 0;
+    if (mbedtls_pkcs5_pbkdf2_hmac_ext(
+            MBEDTLS_MD_SHA1, (const unsigned char *)WIFI_PASS,
+            strlen(WIFI_PASS), (const unsigned char *)WIFI_SSID,
+            strlen(WIFI_SSID), 4096, sizeof(rtc_wifi.pmk), rtc_wifi.pmk) == 0)
+    {
+      rtc_wifi.cred_crc = cred_crc();
+      wifi_cache_save();
+    }
+  }
+}
+
+// Static IP, or the cached lease while it is fresh, otherwise DHCP
+static void wifi_apply_ip(void)
+{
+  lease_applied = false;
+#ifdef WIFI_STATIC_IP
+  rtc_wifi.ip_info.ip.addr = esp_ip4addr_aton(WIFI_STATIC_IP);
+  rtc_wifi.ip_info.netmask.addr = esp_ip4addr_aton(WIFI_STATIC_NETMASK);
+  rtc_wifi.ip_info.gw.addr = esp_ip4addr_aton(WIFI_STATIC_GW);
+  rtc_wifi.dns.ip.u_addr.ip4.addr = esp_ip4addr_aton(WIFI_STATIC_DNS);
+  rtc_wifi.dns.ip.type = ESP_IPADDR_TYPE_V4;
+  rtc_wifi.lease_at_s = rtc_now_s();
+  rtc_wifi.lease_valid = true;
+#endif
+  int64_t age_s = rtc_now_s() - rtc_wifi.lease_at_s;
+  if (rtc_wifi.lease_valid && age_s >= 0 && age_s < WIFI_LEASE_REUSE_S)
+  {
+    esp_netif_dhcpc_stop(sta_netif);
+    if (esp_netif_set_ip_info(sta_netif, &rtc_wifi.ip_info) == ESP_OK &&
+        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &rtc_wifi.dns) ==
+            ESP_OK)
+    {
+      lease_applied = true;
+      return;
+    }
+  }
+  esp_netif_dhcpc_start(sta_netif);
+}
+
+static bool wifi_init_sta(TickType_t deadline)
+{
+  s_retry_num = 0;
+  xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+  wifi_stack_init();
+  wifi_cache_load();
+
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+  // The config changes with the cached AP, keep it out of flash
+  ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 
   wifi_config_t wifi_config = {
       .sta =
@@ -94,6 +326,27 @@ static void wifi_init_sta(void)
               .threshold.authmode = WIFI_AUTH_WPA2_PSK,
           },
   };
+  // A 64 digit hex password is taken as the PMK itself
+  if (rtc_wifi.cred_crc == cred_crc())
+  {
+    char hex[sizeof(rtc_wifi.pmk) * 2 + 1];
+    for (size_t i = 0; i < sizeof(rtc_wifi.pmk); i++)
+      snprintf(&hex[i * 2], 3, "%02x", rtc_wifi.pmk[i]);
+    memcpy(wifi_config.sta.password, hex, sizeof(wifi_config.sta.password));
+  }
+  uint8_t cached_bssid[6];
+  uint8_t cached_channel = rtc_wifi.channel;
+  memcpy(cached_bssid, rtc_wifi.bssid, sizeof(cached_bssid));
+  fast_attempt = cached_channel != 0;
+  if (fast_attempt)
+  {
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, cached_bssid, sizeof(cached_bssid));
+    wifi_config.sta.channel = cached_channel;
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+  }
+  wifi_apply_ip();
+
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
   ESP_ERROR_CHECK(esp_wifi_start());
@@ -103,81 +356,215 @@ static void wifi_init_sta(void)
 
   ESP_LOGI(TAG, "wifi_init_sta finished.");
 
-  EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                         WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                         pdFALSE, pdFALSE, portMAX_DELAY);
-
-  if (bits & WIFI_CONNECTED_BIT)
+  EventBits_t bits = 0;
+  if (fast_attempt)
   {
-    ESP_LOGI(TAG, "connected to ap SSID:%s password:%s", WIFI_SSID, WIFI_PASS);
+    TickType_t fast_deadline =
+        xTaskGetTickCount() + pdMS_TO_TICKS(WIFI_FAST_CONNECT_MS);
+    if ((int32_t)(fast_deadline - deadline) > 0)
+      fast_deadline = deadline;
+    bits = xEventGroupWaitBits(s_wifi_event_group,
+                               WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE,
+                               pdFALSE, ticks_left(fast_deadline));
+    if (!(bits & WIFI_CONNECTED_BIT))
+    {
+      ESP_LOGW(TAG, "Cached AP on channel %d failed, full scan",
+               cached_channel);
+      fast_attempt = false;
+      rtc_wifi.channel = 0;
+      esp_wifi_disconnect();
+      xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
+      wifi_config.sta.bssid_set = false;
+      wifi_config.sta.channel = 0;
+      wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+      esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+      esp_wifi_connect();
+    }
   }
-  else if (bits & WIFI_FAIL_BIT)
+  if (!(bits & WIFI_CONNECTED_BIT))
+    bits = xEventGroupWaitBits(s_wifi_event_group,
+                               WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE,
+                               pdFALSE, ticks_left(deadline));
+  fast_attempt = false;
+
+  if (bits & WIFI_CONNECTED_BIT)
   {
-    ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s", WIFI_SSID,
-             WIFI_PASS);
+    ESP_LOGI(TAG, "connected to ap SSID:%s", WIFI_SSID);
+    // Only a new AP goes to flash, the lease is RTC only
+    if (rtc_wifi.channel != cached_channel ||
+        memcmp(rtc_wifi.bssid, cached_bssid, sizeof(cached_bssid)) != 0)
+      wifi_cache_save();
+    return true;
   }
-  else
+  ESP_LOGW(TAG, "Failed to connect to SSID:%s%s", WIFI_SSID,
+           bits & WIFI_FAIL_BIT ? "" : " (deadline)");
+  return false;
+}
+
+/*
+ * Replaces the weak default in the SNTP client, which steps the clock
+ * without telling by how much. The offset is what the RTC drifted since
+ * the previous sync.
+ */
+void sntp_sync_time(struct timeval *tv)
+{
+  struct timeval rtc;
+  gettimeofday(&rtc, NULL);
+  sync_offset_us = (int64_t)(tv->tv_sec - rtc.tv_sec) * 1000000LL +
+                   (tv->tv_usec - rtc.tv_usec);
+  sync_rtc_s = rtc.tv_sec;
+  settimeofday(tv, NULL);
+  sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
+
+static void drift_load(void)
+{
+  static bool loaded = false;
+  if (loaded || rtc_time.drift_samples > 0)
+    return;
+  loaded = true;
+
+  nvs_handle_t handle;
+  if (nvs_open("time", NVS_READONLY, &handle) != ESP_OK)
+    return;
+  time_drift_nvs_t stored;
+  size_t size = sizeof(stored);
+  if (nvs_get_blob(handle, "drift", &stored, &size) == ESP_OK &&
+      size == sizeof(stored) && stored.fit_span_s > 0)
   {
-    ESP_LOGE(TAG, "UNEXPECTED EVENT");
+    rtc_time.fit_offset_us = stored.fit_offset_us;
+    rtc_time.fit_span_s = stored.fit_span_s;
+    rtc_time.drift_ppb = stored.drift_ppb;
+    rtc_time.drift_dev_ppb = stored.drift_dev_ppb;
+    rtc_time.drift_samples = stored.drift_samples;
+    ESP_LOGI(TAG, "RTC drift %+ld ppb loaded from NVS",
+             (long)rtc_time.drift_ppb);
   }
+  nvs_close(handle);
 }
 
-static void initialize_sntp(void)
+static void drift_save(void)
 {
-  ESP_LOGI(TAG, "Initializing SNTP");
-  esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-  esp_sntp_setservername(0, "pool.ntp.org");
-  esp_sntp_init();
+  time_drift_nvs_t stored = {
+      .fit_offset_us = rtc_time.fit_offset_us,
+      .fit_span_s = rtc_time.fit_span_s,
+      .drift_ppb = rtc_time.drift_ppb,
+      .drift_dev_ppb = rtc_time.drift_dev_ppb,
+      .drift_samples = rtc_time.drift_samples,
+  };
+  nvs_handle_t handle;
+  if (nvs_open("time", NVS_READWRITE, &handle) != ESP_OK)
+    return;
+  if (nvs_set_blob(handle, "drift", &stored, sizeof(stored)) == ESP_OK)
+    nvs_commit(handle);
+  nvs_close(handle);
 }
 
-static void obtain_time(void)
+// Fold the offset found by a sync into the drift fit
+static void drift_update(int64_t offset_us, int64_t span_s)
 {
-  u8g2_manager_print_status("Syncing Time...");
-  // Wait for time to be set
-  time_t now = 0;
-  struct tm timeinfo = {0};
-  int retry = 0;
-  const int retry_count = 10;
-  while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET &&
-         ++retry < retry_count)
+  if (span_s < TIME_DRIFT_MIN_SPAN_S)
+    return;
+  int64_t ppb = offset_us * 1000 / span_s;
+  if (ppb > TIME_DRIFT_MAX_PPB || ppb < -TIME_DRIFT_MAX_PPB)
   {
-    ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry,
-             retry_count);
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    ESP_LOGW(TAG, "RTC offset %lld us over %lld s rejected", offset_us,
+             span_s);
+    return;
   }
-  if (sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED)
+
+  // Weighted by span, a long interval says more than a short one
+  if (rtc_time.drift_samples == 0)
   {
-    u8g2_manager_print_status("Time Synced!");
+    rtc_time.fit_offset_us = offset_us;
+    rtc_time.fit_span_s = span_s;
+    rtc_time.drift_dev_ppb = TIME_DRIFT_PPM * 1000;
   }
   else
   {
-    u8g2_manager_print_status("Time Sync Failed");
+    int64_t dev = ppb - rtc_time.drift_ppb;
+    if (dev < 0)
+      dev = -dev;
+    rtc_time.drift_dev_ppb += (dev - rtc_time.drift_dev_ppb) / 4;
+    rtc_time.fit_offset_us = rtc_time.fit_offset_us * TIME_DRIFT_DECAY_NUM /
+                                 TIME_DRIFT_DECAY_DEN +
+                             offset_us;
+    rtc_time.fit_span_s =
+        rtc_time.fit_span_s * TIME_DRIFT_DECAY_NUM / TIME_DRIFT_DECAY_DEN +
+        span_s;
   }
-  time(&now);
-  localtime_r(&now, &timeinfo);
+  rtc_time.drift_ppb =
+      (int32_t)(rtc_time.fit_offset_us * 1000 / rtc_time.fit_span_s);
+  rtc_time.drift_samples++;
+  ESP_LOGI(TAG, "RTC offset %lld us over %lld s, drift %+ld ppb (+-%ld)",
+           offset_us, span_s, (long)rtc_time.drift_ppb,
+           (long)rtc_time.drift_dev_ppb);
+  drift_save();
+}
+
+static void time_sync_cb(struct timeval *tv)
+{
+  xEventGroupSetBits(s_wifi_event_group, TIME_SYNCED_BIT);
+}
+
+static void initialize_sntp(void)
+{
+  ESP_LOGI(TAG, "Initializing SNTP");
+  xEventGroupClearBits(s_wifi_event_group, TIME_SYNCED_BIT);
+  esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  esp_sntp_setservername(0, "pool.ntp.org");
+  sntp_set_time_sync_notification_cb(time_sync_cb);
+  esp_sntp_init();
 }
 
-esp_err_t wifi_time_manager_init(void)
+static bool obtain_time(TickType_t deadline)
 {
-  // Check if we already have valid time (RTC maintained)
-  time_t now;
-  struct tm timeinfo;
-  time(&now);
-  localtime_r(&now, &timeinfo);
+  EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, TIME_SYNCED_BIT,
+                                         pdFALSE, pdTRUE, ticks_left(deadline));
+  return bits & TIME_SYNCED_BIT;
+}
 
-  // If year is > 2024, we assume time is valid and we can skip WiFi.
-  // tm_year is years since 1900. 2025 - 1900 = 125.
-  if (timeinfo.tm_year > (2024 - 1900))
+static void sync_record(bool ok)
+{
+  rtc_state_check();
+  int64_t now = rtc_now_s();
+  if (ok)
   {
-    ESP_LOGI(TAG, "RTC time is valid (Year: %d). Skipping WiFi Sync.",
-             timeinfo.tm_year + 1900);
-    setenv("TZ", "TRT-3", 1);
-    tzset();
-    return ESP_OK;
+    // The clock ran uncorrected since the previous sync
+    if (rtc_time.synced_at_s != 0)
+      drift_update(sync_offset_us, sync_rtc_s - rtc_time.synced_at_s);
+    rtc_time.synced_at_s = now;
+    rtc_time.next_attempt_s = 0;
+    rtc_time.backoff_s = TIME_SYNC_BACKOFF_MIN_S;
+    rtc_time.failures = 0;
+    ESP_LOGI(TAG, "Time synced");
+    return;
   }
 
-  ESP_LOGI(TAG, "RTC time invalid (Year: %d). Starting WiFi Sync...",
-           timeinfo.tm_year + 1900);
+  rtc_time.next_attempt_s = now + rtc_time.backoff_s;
+  rtc_time.failures++;
+  ESP_LOGW(TAG, "Time sync failed (%lu in a row), next attempt in %lu s",
+           (unsigned long)rtc_time.failures, (unsigned long)rtc_time.backoff_s);
+  rtc_time.backoff_s = rtc_time.backoff_s * 2 > TIME_SYNC_BACKOFF_MAX_S
+                           ? TIME_SYNC_BACKOFF_MAX_S
+                           : rtc_time.backoff_s * 2;
+}
+
+#define SESSION_TIME BIT0   // Time sync due
+#define SESSION_UPLOAD BIT1 // Log upload due
+
+/*
+ * One radio session: connect, sync the time and/or upload the log, shut
+ * the radio down again. A failed connect backs off both.
+ */
+static void time_sync_task(void *arg)
+{
+  uint32_t work = (uint32_t)(uintptr_t)arg;
+  wake_trace_begin(WAKE_PHASE_TIME_CHECK);
+  TickType_t deadline =
+      xTaskGetTickCount() + pdMS_TO_TICKS(TIME_SYNC_DEADLINE_MS);
+  bool connected = false;
+  bool ok = false;
 
   // Initialize NVS (Required for WiFi)
   esp_err_t ret = nvs_flash_init();
@@ -187,20 +574,25 @@ esp_err_t wifi_time_manager_init(void)
     ESP_ERROR_CHECK(nvs_flash_erase());
     ret = nvs_flash_init();
   }
-  ESP_ERROR_CHECK(ret);
 
-  // Connect to WiFi
-  wifi_init_sta();
+  if (ret == ESP_OK)
+    drift_load();
 
-  // Init SNTP
-  initialize_sntp();
+  if (ret == ESP_OK)
+    connected = wifi_init_sta(deadline);
 
-  // Wait a bit for sync
-  obtain_time();
+  if (connected && (work & SESSION_TIME))
+  {
+    initialize_sntp();
+    ok = obtain_time(deadline);
+    esp_sntp_stop();
+    // Maybe the address was handed out again meanwhile, ask DHCP next time
+    if (!ok && lease_applied)
+      rtc_wifi.lease_valid = false;
+  }
 
-  // Set timezone
-  setenv("TZ", "TRT-3", 1);
-  tzset();
+  if (connected && (work & SESSION_UPLOAD))
+    upload_manager_run();
 
   // Kill all WiFi to save power
   ESP_LOGI(TAG, "Shutting down WiFi to save power...");
@@ -208,5 +600,135 @@ esp_err_t wifi_time_manager_init(void)
   esp_wifi_deinit();
   // esp_netif_deinit not trivial, but stopping wifi is key.
 
-  return ESP_OK;
+  if ((work & SESSION_TIME) || !connected)
+    sync_record(ok);
+  wake_trace_end(WAKE_PHASE_TIME_CHECK);
+
+  sync_task = NULL;
+  xEventGroupSetBits(s_wifi_event_group, SYNC_IDLE_BIT);
+  vTaskDelete(NULL);
+}
+
+void wifi_time_manager_set_timezone(void)
+{
+  setenv("TZ", "TRT-3", 1);
+  tzset();
+}
+
+bool wifi_time_manager_is_synced(void)
+{
+  return rtc_time.magic == TIME_RTC_MAGIC && rtc_time.synced_at_s != 0;
+}
+
+int64_t wifi_time_manager_get_error_ms(void)
+{
+  if (!wifi_time_manager_is_synced())
+    return INT64_MAX;
+  int64_t age_s = rtc_now_s() - rtc_time.synced_at_s;
+  if (age_s < 0)
+    return INT64_MAX; // Clock went backwards, can't tell
+
+  // What is left after the drift correction, or the assumed rate before
+  // there is a fit
+  int64_t ppb = TIME_DRIFT_PPM * 1000;
+  if (rtc_time.drift_samples > 1)
+    ppb = rtc_time.drift_dev_ppb > TIME_DRIFT_MIN_UNCERTAINTY_PPB
+              ? rtc_time.drift_dev_ppb
+              : TIME_DRIFT_MIN_UNCERTAINTY_PPB;
+  return age_s * ppb / 1000000;
+}
+
+void wifi_time_manager_now(struct timeval *tv)
+{
+  gettimeofday(tv, NULL);
+  if (!wifi_time_manager_is_synced() || rtc_time.drift_samples == 0)
+    return;
+  int64_t age_s = tv->tv_sec - rtc_time.synced_at_s;
+  if (age_s <= 0)
+    return;
+
+  // s * ppb / 1000 = us
+  int64_t us = tv->tv_usec + age_s * rtc_time.drift_ppb / 1000;
+  int64_t carry = us / 1000000;
+  us %= 1000000;
+  if (us < 0)
+  {
+    us += 1000000;
+    carry--;
+  }
+  tv->tv_sec += carry;
+  tv->tv_usec = us;
+}
+
+time_t wifi_time_manager_time(void)
+{
+  struct timeval tv;
+  wifi_time_manager_now(&tv);
+  return tv.tv_sec;
+}
+
+static bool backed_off(void)
+{
+  rtc_state_check();
+  return rtc_now_s() < rtc_time.next_attempt_s;
+}
+
+bool wifi_time_manager_sync_due(void)
+{
+  return !backed_off() &&
+         wifi_time_manager_get_error_ms() > TIME_MAX_ERROR_MS;
+}
+
+bool wifi_time_manager_sync_start(void)
+{
+  if (sync_task != NULL)
+    return true;
+  if (backed_off())
+    return false;
+  uint32_t work = 0;
+  if (wifi_time_manager_get_error_ms() > TIME_MAX_ERROR_MS)
+    work |= SESSION_TIME;
+  if (upload_manager_due())
+    work |= SESSION_UPLOAD;
+  if (work == 0)
+    return false;
+
+  if (s_wifi_event_group == NULL)
+  {
+    s_wifi_event_group = xEventGroupCreate();
+    if (s_wifi_event_group == NULL)
+      return false;
+  }
+
+  ESP_LOGI(TAG, "Starting radio session:%s%s (attempt %lu)",
+           work & SESSION_TIME ? " time" : "",
+           work & SESSION_UPLOAD ? " upload" : "",
+           (unsigned long)rtc_time.failures + 1);
+  xEventGroupClearBits(s_wifi_event_group, SYNC_IDLE_BIT);
+  if (xTaskCreate(time_sync_task, "time_sync", TIME_SYNC_TASK_STACK,
+                  (void *)(uintptr_t)work, tskIDLE_PRIORITY + 1,
+                  &sync_task) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create time sync task");
+    sync_task = NULL;
+    xEventGroupSetBits(s_wifi_event_group, SYNC_IDLE_BIT);
+    sync_record(false);
+    return false;
+  }
+  return true;
+}
+
+bool wifi_time_manager_sync_busy(void)
+{
+  return sync_task != NULL;
+}
+
+bool wifi_time_manager_sync_wait(int timeout_ms)
+{
+  if (s_wifi_event_group == NULL)
+    return true;
+  TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+  return xEventGroupWaitBits(s_wifi_event_group, SYNC_IDLE_BIT, pdFALSE,
+                             pdTRUE, ticks) &
+         SYNC_IDLE_BIT;
 }
@@ -1,17 +1,84 @@
 #pragma once
 
 #include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /**
- * @brief Initialize Wi-Fi (Station Mode) and synchronize time via SNTP
+ * @brief Start a WiFi session in the background if a time sync or a log
+ *        upload is due
  *
- * @return esp_err_t ESP_OK on success
+ * A sync is due when the estimated clock error is past the limit (always,
+ * before the first sync) and the backoff after failed attempts has run
+ * out. The attempt gives up after a fixed deadline and shuts the radio
+ * down again; the backoff is kept in RTC memory. Every sync measures how
+ * far the RTC drifted since the previous one and refines the drift rate,
+ * which is kept in RTC memory and NVS. A log upload
+ * (upload_manager_due()) rides on the same connection, or gets a session
+ * of its own.
+ *
+ * @return true if a session is running
+ */
+bool wifi_time_manager_sync_start(void);
+
+/**
+ * @brief Whether a time sync would be started now
+ */
+bool wifi_time_manager_sync_due(void);
+
+/**
+ * @brief Whether the session task is still running
+ */
+bool wifi_time_manager_sync_busy(void);
+
+/**
+ * @brief Wait for a running session to finish
+ *
+ * @param timeout_ms How long to wait, -1 for ever
+ * @return true if no session is running anymore
+ */
+bool wifi_time_manager_sync_wait(int timeout_ms);
+
+/**
+ * @brief Whether the RTC time comes from a successful sync
+ *
+ * Until the first sync after power-up the RTC time is not wall clock time.
+ */
+bool wifi_time_manager_is_synced(void);
+
+/**
+ * @brief Estimated error of wifi_time_manager_now(), INT64_MAX if never
+ *        synced
+ *
+ * Grows with the time since the last sync, at the uncertainty of the
+ * drift fit once there is one.
+ */
+int64_t wifi_time_manager_get_error_ms(void);
+
+/**
+ * @brief Wall clock time with the learned RTC drift taken out
+ *
+ * The system clock itself is only stepped by a sync, so BSEC and the sleep
+ * deadlines keep one uninterrupted time base; timestamps for the user
+ * (log records, the clock on screen) should come from here.
+ */
+void wifi_time_manager_now(struct timeval *tv);
+
+/**
+ * @brief wifi_time_manager_now() in seconds, like time(NULL)
+ */
+time_t wifi_time_manager_time(void);
+
+/**
+ * @brief Apply the local timezone (lost on every boot, kept by the RTC time)
  */
-esp_err_t wifi_time_manager_init(void);
+void wifi_time_manager_set_timezone(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""
+Minimal collector for the log upload of main/upload_manager.c.
+
+Accepts the chunked "HLU1" batches, appends the records to <device>.csv in
+the output directory and answers with the sequence number of the first
+record it does not have yet, which the device takes as its upload cursor.
+Records it already has are skipped, a resent batch is harmless. Sequence
+numbers start over when the device starts a new log; it then sends another
+X-Log-Epoch and the cursor starts over too.
+
+Usage: collector.py [--port 8080] [--out ./logs]
+"""
+import argparse
+import csv
+import http.server
+import json
+import os
+
+MAGIC = b"HLU1"
+FIELDS = ["seq", "timestamp", "temperature_cc", "humidity_cp", "iaq_x10",
+          "battery_mv", "pressure_pa", "gas_ohm", "iaq_accuracy", "flags"]
+
+
+def read_varint(buf, pos):
+    shift = 0
+    value = 0
+    while True:
+        if pos >= len(buf):
+            raise ValueError("truncated varint")
+        b = buf[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def decode(body):
+    """Yield one dict per record of a batch body."""
+    if body[:4] != MAGIC:
+        raise ValueError("bad magic")
+    pos = 4
+    prev = [0] * len(FIELDS)
+    while pos < len(body):
+        entry = []
+        for i in range(len(FIELDS)):
+            delta, pos = read_varint(body, pos)
+            entry.append(prev[i] + delta)
+        prev = entry
+        yield dict(zip(FIELDS, entry))
+
+
+class Collector(http.server.BaseHTTPRequestHandler):
+    out_dir = "."
+
+    def read_body(self):
+        if self.headers.get("Transfer-Encoding", "").lower() != "chunked":
+            return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        body = bytearray()
+        while True:
+            size = int(self.rfile.readline().split(b";")[0], 16)
+            if size == 0:
+                self.rfile.readline()
+                return bytes(body)
+            body += self.rfile.read(size)
+            self.rfile.readline()
+
+    def do_POST(self):
+        device = "".join(c for c in self.headers.get("X-Device", "unknown")
+                         if c.isalnum()) or "unknown"
+        state_path = os.path.join(self.out_dir, device + ".json")
+        csv_path = os.path.join(self.out_dir, device + ".csv")
+        epoch = self.headers.get("X-Log-Epoch", "")
+        try:
+            with open(state_path) as f:
+                state = json.load(f)
+            next_seq = state["next_seq"]
+            if state.get("epoch", "") != epoch:
+                self.log_message("%s: new log epoch %s, was %s", device,
+                                 epoch or "-", state.get("epoch") or "-")
+                next_seq = 0
+        except (OSError, ValueError, KeyError):
+            next_seq = 0
+
+        try:
+            records = list(decode(self.read_body()))
+        except ValueError as e:
+            self.send_error(400, str(e))
+            return
+
+        # Records before the batch are gone from the device, don't wait for
+        # them
+        next_seq = max(next_seq, int(self.headers.get("X-First-Seq", 0)))
+        new = [r for r in records if r["seq"] >= next_seq]
+        write_header = not os.path.exists(csv_path)
+        with open(csv_path, "a", newline="") as f:
+            w = csv.DictWriter(f, fieldnames=FIELDS)
+            if write_header:
+                w.writeheader()
+            w.writerows(new)
+        if new:
+            next_seq = max(r["seq"] for r in new) + 1
+        with open(state_path, "w") as f:
+            json.dump({"epoch": epoch, "next_seq": next_seq}, f)
+
+        self.log_message("%s: %d records, %d new, next %d", device,
+                         len(records), len(new), next_seq)
+        reply = str(next_seq).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(reply)))
+        self.end_headers()
+        self.wfile.write(reply)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--out", default=".")
+    args = ap.parse_args()
+    os.makedirs(args.out, exist_ok=True)
+    Collector.out_dir = args.out
+    http.server.ThreadingHTTPServer(("", args.port), Collector).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,609 @@
+/*
+ * duty_sim.c
+ *
+ * Host-side discrete-event model of the app_main sleep/wake loop.
+ *
+ * The simulator replays what main/main.c does on every wake on a virtual
+ * nanosecond clock: boot, cold/warm init, the BSEC call when next_call is
+ * due, the wait until the next call, the time sync and the final deep
+ * sleep. Every phase is charged with a duration
+ * and a current from the profile, which yields mAh/day and battery lifetime.
+ * The interval between consecutive BSEC calls is checked against the 6.25 %
+ * timing budget.
+ *
+ * Two schedulers are modelled: "legacy", the old sub-10 s "goto a" polling
+ * loop, and "hybrid", main/sleep_manager.c, which light sleeps up to the
+ * next call below the reboot break-even point and deep sleeps above it.
+ * Legacy syncs the time in the foreground on a cold boot and retries after a
+ * 10 s deep sleep; hybrid syncs in the background with an exponential
+ * backoff, main/wifi_time_manager.c.
+ *
+ * Build: cmake -S tools/duty_sim -B build/duty_sim && cmake --build build/duty_sim
+ * Usage: duty_sim [-c profile.cfg] [-d days] [-m ulp|lp|all]
+ *                 [-S legacy|hybrid|all] [-s seed] [-p key=value]...
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_S 1000000000LL
+#define BSEC_JITTER_BUDGET 0.0625
+
+/* Phases charged per wake, names match main/wake_trace.c where they exist */
+typedef enum
+{
+  PH_BOOT,        // ROM + bootloader + app startup until app_main
+  PH_INIT_COLD,   // Display init/clear and status screens on a cold boot
+  PH_INIT_WARM,   // Warm boot path
+  PH_TIME_SYNC,   // WiFi + SNTP, one attempt
+  PH_TIME_FAIL,   // "Time Sync Fail!" delay before the retry sleep
+  PH_BSEC_INIT,   // ADC, bsec2_init, config, state load, subscription
+  PH_BSEC_RUN,    // Sensor control, read and bsec_do_steps (excl. heater)
+  PH_DISPLAY,     // Frame render and send
+  PH_LOG_FLUSH,   // Staged samples written to flash
+  PH_STATE_SAVE,  // BSEC state written to NVS
+  PH_COUNT
+} phase_id_t;
+
+typedef struct
+{
+  const char *name;
+  double ms;
+  double ma;
+} phase_t;
+
+typedef struct
+{
+  const char *name;
+  double period_s;   // BSEC sample period
+  double measure_ms; // TPH conversion + heater duration
+} sim_mode_t;
+
+typedef enum
+{
+  SCHED_LEGACY, // Poll with vTaskDelay and "goto a" below min_deep_sleep_s
+  SCHED_HYBRID, // main/sleep_manager.c
+  SCHED_COUNT
+} sim_sched_t;
+
+static const char *const sched_names[SCHED_COUNT] = {"legacy", "hybrid"};
+
+typedef struct
+{
+  phase_t phase[PH_COUNT];
+  sim_mode_t ulp;
+  sim_mode_t lp;
+  double measure_ma;         // Current while the heater is on
+  double deep_sleep_ma;      // MCU + sensor in deep sleep
+  double light_sleep_ma;     // MCU in light sleep, vTaskDelay or explicit
+  double light_guard_ms;     // Hybrid: early light sleep exit, busy waited
+  double display_on_ma;      // Panel current, drawn the whole time
+  double retry_delay_ms;     // Legacy: vTaskDelay before "goto a"
+  double min_deep_sleep_s;   // Legacy: shorter sleeps take the retry path
+  double time_sync_retry_s;  // Deep sleep after a failed time sync
+  double time_sync_fail_prob;
+  double time_sync_backoff_min_s; // Hybrid: wait after the first failure
+  double time_sync_backoff_max_s; // Hybrid: doubling stops here
+  double state_save_interval_s;
+  double rtc_drift_ppm;      // Deep sleep timer error
+  double boot_jitter_ms;     // Uniform +- jitter added to PH_BOOT
+  double battery_mah;
+  int log_flush_every;       // Samples per flash burst
+  double days;
+  unsigned seed;
+} sim_config_t;
+
+typedef struct
+{
+  double charge_mas; // Charge in mA*s
+  double awake_s;
+  int64_t wakes;
+  int64_t cold_boots; // Incl. retries after a failed time sync
+  int64_t calls;
+  int64_t violations;
+  double max_deviation; // Worst relative interval error
+} sim_result_t;
+
+static sim_config_t default_config(void)
+{
+  /*
+   * Placeholder figures for an ESP32-C6 at 80 MHz with SSD1306 and BME680.
+   * Replace them with measured values, e.g. phase durations from a
+   * wake_trace dump and currents from a power analyzer.
+   */
+  sim_config_t cfg = {
+      .phase =
+          {
+              [PH_BOOT] = {"boot", 180, 22},
+              [PH_INIT_COLD] = {"init_cold", 120, 24},
+              [PH_INIT_WARM] = {"init_warm", 35, 24},
+              [PH_TIME_SYNC] = {"time_sync", 6000, 90},
+              [PH_TIME_FAIL] = {"time_fail", 5000, 22},
+              [PH_BSEC_INIT] = {"bsec_init", 90, 24},
+              [PH_BSEC_RUN] = {"bsec_run", 25, 24},
+              [PH_DISPLAY] = {"display_draw", 30, 26},
+              [PH_LOG_FLUSH] = {"log_flush", 60, 30},
+              [PH_STATE_SAVE] = {"state_save", 40, 30},
+          },
+      .ulp = {"ULP", 300, 1950},
+      .lp = {"LP", 3, 200},
+      .measure_ma = 13,
+      .deep_sleep_ma = 0.012,
+      .light_sleep_ma = 0.25,
+      .light_guard_ms = 2,
+      .display_on_ma = 1.5,
+      .retry_delay_ms = 2000,
+      .min_deep_sleep_s = 10,
+      .time_sync_retry_s = 10,
+      .time_sync_fail_prob = 0.0,
+      .time_sync_backoff_min_s = 60,
+      .time_sync_backoff_max_s = 6 * 3600,
+      .state_save_interval_s = 6 * 3600,
+      .rtc_drift_ppm = 0,
+      .boot_jitter_ms = 0,
+      .battery_mah = 1000,
+      .log_flush_every = 28,
+      .days = 7,
+      .seed = 1,
+  };
+  return cfg;
+}
+
+/* ---- Profile parsing ---- */
+
+static double *config_field(sim_config_t *cfg, const char *key)
+{
+  static const struct
+  {
+    const char *key;
+    size_t offset;
+  } fields[] = {
+#define FIELD(k, f) {k, offsetof(sim_config_t, f)}
+      FIELD("ulp.period_s", ulp.period_s),
+      FIELD("ulp.measure_ms", ulp.measure_ms),
+      FIELD("lp.period_s", lp.period_s),
+      FIELD("lp.measure_ms", lp.measure_ms),
+      FIELD("measure_ma", measure_ma),
+      FIELD("deep_sleep_ma", deep_sleep_ma),
+      FIELD("light_sleep_ma", light_sleep_ma),
+      FIELD("light_guard_ms", light_guard_ms),
+      FIELD("display_on_ma", display_on_ma),
+      FIELD("retry_delay_ms", retry_delay_ms),
+      FIELD("min_deep_sleep_s", min_deep_sleep_s),
+      FIELD("time_sync_retry_s", time_sync_retry_s),
+      FIELD("time_sync_fail_prob", time_sync_fail_prob),
+      FIELD("time_sync_backoff_min_s", time_sync_backoff_min_s),
+      FIELD("time_sync_backoff_max_s", time_sync_backoff_max_s),
+      FIELD("state_save_interval_s", state_save_interval_s),
+      FIELD("rtc_drift_ppm", rtc_drift_ppm),
+      FIELD("boot_jitter_ms", boot_jitter_ms),
+      FIELD("battery_mah", battery_mah),
+      FIELD("days", days),
+#undef FIELD
+  };
+
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+  {
+    if (strcmp(key, fields[i].key) == 0)
+      return (double *)((char *)cfg + fields[i].offset);
+  }
+
+  // Phase figures: <phase>.ms / <phase>.ma
+  const char *dot = strrchr(key, '.');
+  if (dot == NULL)
+    return NULL;
+  for (int p = 0; p < PH_COUNT; p++)
+  {
+    size_t len = strlen(cfg->phase[p].name);
+    if ((size_t)(dot - key) == len && strncmp(key, cfg->phase[p].name, len) == 0)
+    {
+      if (strcmp(dot, ".ms") == 0)
+        return &cfg->phase[p].ms;
+      if (strcmp(dot, ".ma") == 0)
+        return &cfg->phase[p].ma;
+    }
+  }
+  return NULL;
+}
+
+static bool apply_setting(sim_config_t *cfg, const char *line)
+{
+  char key[64];
+  double value;
+  if (sscanf(line, " %63[^= ] = %lf", key, &value) != 2)
+    return false;
+
+  if (strcmp(key, "log_flush_every") == 0)
+  {
+    cfg->log_flush_every = (int)value;
+    return true;
+  }
+  double *field = config_field(cfg, key);
+  if (field == NULL)
+    return false;
+  *field = value;
+  return true;
+}
+
+static bool load_profile(sim_config_t *cfg, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  char line[256];
+  int line_no = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f))
+  {
+    line_no++;
+    char *hash = strchr(line, '#');
+    if (hash)
+      *hash = '\0';
+    if (strspn(line, " \t\r\n") == strlen(line))
+      continue;
+    if (!apply_setting(cfg, line))
+    {
+      fprintf(stderr, "%s:%d: unknown setting: %s", path, line_no, line);
+      ok = false;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+/* ---- Simulation ---- */
+
+typedef struct
+{
+  const sim_config_t *cfg;
+  sim_result_t *res;
+  int64_t now_ns;
+  uint64_t rng;
+} sim_t;
+
+static double sim_random(sim_t *sim)
+{
+  // xorshift64*, reproducible across platforms
+  sim->rng ^= sim->rng >> 12;
+  sim->rng ^= sim->rng << 25;
+  sim->rng ^= sim->rng >> 27;
+  return (double)((sim->rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static void spend(sim_t *sim, double ms, double ma, bool awake)
+{
+  if (ms <= 0)
+    return;
+  sim->now_ns += (int64_t)llround(ms * NS_PER_MS);
+  sim->res->charge_mas += ms / 1000.0 * ma;
+  if (awake)
+    sim->res->awake_s += ms / 1000.0;
+}
+
+static void run_phase(sim_t *sim, phase_id_t id)
+{
+  spend(sim, sim->cfg->phase[id].ms, sim->cfg->phase[id].ma, true);
+}
+
+static void deep_sleep(sim_t *sim, int64_t duration_ns)
+{
+  double actual = (double)duration_ns * (1.0 + sim->cfg->rtc_drift_ppm * 1e-6);
+  spend(sim, actual / NS_PER_MS, sim->cfg->deep_sleep_ma, false);
+}
+
+/*
+ * Sleep length above which a reboot costs less than staying in light sleep,
+ * same model as sleep_manager_break_even_us() but from the profile figures.
+ */
+static int64_t break_even_ns(const sim_config_t *cfg)
+{
+  static const phase_id_t reboot[] = {PH_BOOT, PH_INIT_WARM, PH_BSEC_INIT};
+  double ms = 0, mas = 0;
+  for (size_t i = 0; i < sizeof(reboot) / sizeof(reboot[0]); i++)
+  {
+    ms += cfg->phase[reboot[i]].ms;
+    mas += cfg->phase[reboot[i]].ms / 1000.0 * cfg->phase[reboot[i]].ma;
+  }
+  double excess_mas = mas - ms / 1000.0 * cfg->deep_sleep_ma;
+  double delta_ma = cfg->light_sleep_ma - cfg->deep_sleep_ma;
+  if (delta_ma <= 0)
+    return 0; // Light sleep never pays off
+  return (int64_t)llround(excess_mas / delta_ma * NS_PER_S);
+}
+
+// sleep_manager_wait_until(): light sleep, then busy wait the guard
+static void light_wait_until(sim_t *sim, int64_t target_ns)
+{
+  int64_t wait_ns = target_ns - sim->now_ns;
+  if (wait_ns <= 0)
+    return;
+  double guard_ms = fmin(sim->cfg->light_guard_ms, (double)wait_ns / NS_PER_MS);
+  spend(sim, (double)wait_ns / NS_PER_MS - guard_ms, sim->cfg->light_sleep_ma,
+        false);
+  spend(sim, guard_ms, sim->cfg->phase[PH_BSEC_RUN].ma, true);
+  if (sim->now_ns < target_ns)
+    sim->now_ns = target_ns; // Rounding, the firmware waits it out too
+}
+
+static void simulate(const sim_config_t *cfg, const sim_mode_t *mode,
+                     sim_sched_t sched, sim_result_t *res)
+{
+  memset(res, 0, sizeof(*res));
+  sim_t sim = {
+      .cfg = cfg,
+      .res = res,
+      .now_ns = 0,
+      .rng = 0x9E3779B97F4A7C15ULL ^ cfg->seed,
+  };
+
+  const int64_t end_ns = (int64_t)(cfg->days * 86400.0 * NS_PER_S);
+  const int64_t period_ns = (int64_t)llround(mode->period_s * NS_PER_S);
+  const int64_t min_sleep_ns = sched == SCHED_HYBRID
+                                   ? break_even_ns(cfg)
+                                   : (int64_t)llround(cfg->min_deep_sleep_s * NS_PER_S);
+  const int64_t save_interval_ns =
+      (int64_t)llround(cfg->state_save_interval_s * NS_PER_S);
+
+  int64_t next_call = 0; // BSEC wants its first call right away
+  int64_t prev_call = -1;
+  int64_t last_save = 0;
+  int staged = 0;
+  int64_t planned_wake = -1; // Hybrid: nominal deep sleep timer expiry
+  int64_t latency_ns = -1;   // Hybrid: wake latency EMA, -1 = none yet
+  bool synced = false;       // Hybrid: time sync state, RTC memory
+  int64_t sync_end = 0;      // Hybrid: background sync runs until here
+  int64_t next_sync = 0;
+  double backoff_s = cfg->time_sync_backoff_min_s;
+  bool cold = true;
+
+  while (sim.now_ns < end_ns)
+  {
+    res->wakes++;
+    double jitter = cfg->boot_jitter_ms * (2.0 * sim_random(&sim) - 1.0);
+    spend(&sim, cfg->phase[PH_BOOT].ms + jitter, cfg->phase[PH_BOOT].ma, true);
+
+    if (cold)
+    {
+      res->cold_boots++;
+      run_phase(&sim, PH_INIT_COLD);
+      if (sched == SCHED_LEGACY)
+        run_phase(&sim, PH_TIME_SYNC);
+      if (sched == SCHED_LEGACY && sim_random(&sim) < cfg->time_sync_fail_prob)
+      {
+        // "Time Sync Fail!", 5 s on screen, then a 10 s deep sleep
+        run_phase(&sim, PH_TIME_FAIL);
+        deep_sleep(&sim, (int64_t)llround(cfg->time_sync_retry_s * NS_PER_S));
+        continue;
+      }
+    }
+    else
+    {
+      run_phase(&sim, PH_INIT_WARM);
+    }
+    run_phase(&sim, PH_BSEC_INIT);
+
+    if (sched == SCHED_HYBRID)
+    {
+      // sleep_manager_wake_ready(): fold the latency into the EMA, then wait
+      // for next_call if the wake came early
+      if (planned_wake >= 0 && !cold)
+      {
+        int64_t sample = sim.now_ns - planned_wake;
+        latency_ns = latency_ns < 0 ? sample : latency_ns + (sample - latency_ns) / 4;
+      }
+      planned_wake = -1;
+      if (next_call - sim.now_ns < min_sleep_ns)
+        light_wait_until(&sim, next_call);
+    }
+
+    // The "a:" loop of app_main
+    for (;;)
+    {
+      if (sim.now_ns >= next_call)
+      {
+        if (prev_call >= 0)
+        {
+          double deviation =
+              fabs((double)(sim.now_ns - prev_call) / period_ns - 1.0);
+          if (deviation > res->max_deviation)
+            res->max_deviation = deviation;
+          if (deviation > BSEC_JITTER_BUDGET)
+            res->violations++;
+        }
+        prev_call = sim.now_ns;
+        res->calls++;
+        next_call = sim.now_ns + period_ns;
+
+        spend(&sim, mode->measure_ms, cfg->measure_ma, true);
+        run_phase(&sim, PH_BSEC_RUN);
+
+        if (++staged >= cfg->log_flush_every)
+        {
+          run_phase(&sim, PH_LOG_FLUSH);
+          staged = 0;
+        }
+      }
+      run_phase(&sim, PH_DISPLAY);
+
+      if (sched == SCHED_HYBRID && !synced && sim.now_ns >= sync_end &&
+          sim.now_ns >= next_sync)
+      {
+        // wifi_time_manager_sync_start(): the radio draws on top of the
+        // loop, which goes on
+        const phase_t *sync = &cfg->phase[PH_TIME_SYNC];
+        sync_end = sim.now_ns + (int64_t)llround(sync->ms * NS_PER_MS);
+        res->charge_mas += sync->ms / 1000.0 * sync->ma;
+        if (sim_random(&sim) < cfg->time_sync_fail_prob)
+        {
+          next_sync = sync_end + (int64_t)llround(backoff_s * NS_PER_S);
+          backoff_s = fmin(backoff_s * 2, cfg->time_sync_backoff_max_s);
+        }
+        else
+        {
+          synced = true;
+        }
+      }
+      if (sched == SCHED_HYBRID && sync_end > sim.now_ns)
+      {
+        // wifi_time_manager_sync_wait() up to next_call, no deep sleep
+        int64_t until = sync_end < next_call ? sync_end : next_call;
+        spend(&sim, (double)(until - sim.now_ns) / NS_PER_MS,
+              cfg->light_sleep_ma, false);
+      }
+
+      if (next_call - sim.now_ns >= min_sleep_ns || sim.now_ns >= end_ns)
+        break;
+
+      if (sched == SCHED_LEGACY)
+      {
+        // vTaskDelay(2000) with auto light sleep, then goto a
+        spend(&sim, cfg->retry_delay_ms, cfg->light_sleep_ma, false);
+        continue;
+      }
+
+      // Hybrid: the state is saved on every pass, NVS is rate limited
+      if (sim.now_ns - last_save >= save_interval_ns)
+      {
+        run_phase(&sim, PH_STATE_SAVE);
+        last_save = sim.now_ns;
+      }
+      light_wait_until(&sim, next_call);
+    }
+
+    if (sim.now_ns - last_save >= save_interval_ns)
+    {
+      run_phase(&sim, PH_STATE_SAVE);
+      last_save = sim.now_ns;
+    }
+
+    int64_t sleep_ns = next_call - sim.now_ns;
+    if (sched == SCHED_HYBRID)
+    {
+      // sleep_manager_plan_deep_sleep()
+      if (latency_ns >= 0)
+        sleep_ns -= latency_ns + 3 * NS_PER_MS;
+      planned_wake = sim.now_ns + sleep_ns;
+    }
+    deep_sleep(&sim, sleep_ns);
+    cold = false;
+  }
+
+  // The panel stays lit through sleep and wake alike
+  res->charge_mas += cfg->display_on_ma * (double)sim.now_ns / NS_PER_S;
+}
+
+static void print_result(const sim_mode_t *mode, sim_sched_t sched,
+                         const sim_config_t *cfg, const sim_result_t *res)
+{
+  double days = cfg->days;
+  double mah_per_day = res->charge_mas / 3600.0 / days;
+  double avg_ma = res->charge_mas / (days * 86400.0);
+  double life_days = mah_per_day > 0 ? cfg->battery_mah / mah_per_day : INFINITY;
+  double viol_pct = res->calls > 1 ? 100.0 * res->violations / (res->calls - 1) : 0;
+
+  printf("%-4s %-6s %7.0f %9.0f %6lld %7.3f %8.3f %8.2f %9.1f %8lld %8lld (%5.1f%%) %6.1f%%\n",
+         mode->name, sched_names[sched], mode->period_s, res->wakes / days,
+         (long long)res->cold_boots,
+         100.0 * res->awake_s / (days * 86400.0), avg_ma, mah_per_day,
+         life_days, (long long)res->calls, (long long)res->violations, viol_pct,
+         100.0 * res->max_deviation);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-c profile.cfg] [-d days] [-m ulp|lp|all] "
+          "[-S legacy|hybrid|all] [-s seed] [-p key=value]...\n",
+          prog);
+}
+
+int main(int argc, char **argv)
+{
+  sim_config_t cfg = default_config();
+  const char *mode_arg = "all";
+  const char *sched_arg = "all";
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "-c") == 0 && val)
+    {
+      if (!load_profile(&cfg, val))
+        return 1;
+      i++;
+    }
+    else if (strcmp(arg, "-d") == 0 && val)
+    {
+      cfg.days = atof(val);
+      i++;
+    }
+    else if (strcmp(arg, "-m") == 0 && val)
+    {
+      mode_arg = val;
+      i++;
+    }
+    else if (strcmp(arg, "-S") == 0 && val)
+    {
+      sched_arg = val;
+      i++;
+    }
+    else if (strcmp(arg, "-s") == 0 && val)
+    {
+      cfg.seed = (unsigned)strtoul(val, NULL, 0);
+      i++;
+    }
+    else if (strcmp(arg, "-p") == 0 && val)
+    {
+      if (!apply_setting(&cfg, val))
+      {
+        fprintf(stderr, "unknown setting: %s\n", val);
+        return 1;
+      }
+      i++;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (cfg.days <= 0)
+  {
+    fprintf(stderr, "days must be positive\n");
+    return 1;
+  }
+
+  printf("Simulated %.1f days, battery %.0f mAh, hybrid break-even %.1f s\n\n",
+         cfg.days, cfg.battery_mah, (double)break_even_ns(&cfg) / NS_PER_S);
+  printf("mode sched   period  wakes/d  colds  awake%%   avg mA  mAh/day  life [d]    calls  "
+         "timing violations  worst\n");
+
+  const sim_mode_t *modes[] = {&cfg.ulp, &cfg.lp};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    if (strcmp(mode_arg, "all") != 0 && strcasecmp(mode_arg, modes[i]->name) != 0)
+      continue;
+    for (int sched = 0; sched < SCHED_COUNT; sched++)
+    {
+      if (strcmp(sched_arg, "all") != 0 &&
+          strcasecmp(sched_arg, sched_names[sched]) != 0)
+        continue;
+      sim_result_t res;
+      simulate(&cfg, modes[i], (sim_sched_t)sched, &res);
+      print_result(modes[i], (sim_sched_t)sched, &cfg, &res);
+    }
+  }
+  return 0;
+}
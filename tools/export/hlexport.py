@@ -0,0 +1,609 @@
+#!/usr/bin/env python3
+"""
+Host side of the USB export of main/export_manager.c.
+
+Asks the device for its log over the USB Serial/JTAG port, decodes the
+ts_codec blocks and writes the records as CSV or Parquet (needs pyarrow).
+Log output on the same port is skipped, frames are found by their sync
+bytes and CRC. With --state the next sequence number is kept in a JSON
+file and the next run only fetches what is new; CSV output is appended to
+then, Parquet output rewritten with the old and new rows. The state also
+keeps the log epoch: when the device started a new log (another epoch, or
+a state past its newest record) the fetch starts over at its oldest record.
+--since starts at a time instead, the device looks up the block to start
+from in its log index.
+
+"trace" fetches the wake trace of main/wake_trace.c, Chrome trace / Perfetto
+JSON for ui.perfetto.dev or chrome://tracing.
+
+"simulate" serves a synthetic log on a pseudo terminal, so the tool can be
+tried without a device; --capture also writes its answers to a file, which
+"dump --input" decodes.
+
+Usage: hlexport.py dump (--port /dev/ttyACM0 | --input capture.bin)
+                        [--from SEQ | --since TIME | --state state.json]
+                        [--csv out.csv] [--parquet out.parquet]
+       hlexport.py trace --port /dev/ttyACM0 [--out trace.json]
+       hlexport.py simulate [--records 2000] [--epoch HEX]
+                            [--capture capture.bin]
+"""
+import argparse
+import csv
+import datetime
+import json
+import math
+import os
+import random
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+SYNC = b"\xa5\x5a"
+FRAME_INFO, FRAME_BLOCK, FRAME_END, FRAME_ERROR, FRAME_TRACE = 1, 2, 3, 4, 5
+VERSION = 2
+INTS, FLOATS = 6, 2
+MAX_POINT_BYTES = (36 + 36 * INTS + 44 * FLOATS + 7) // 8
+MAX_PAYLOAD = 8 + 32 * MAX_POINT_BYTES
+IDLE_TIMEOUT_S = 10  # The device answers between samples, a few s at most
+
+FIELDS = ["seq", "timestamp", "temperature_cc", "humidity_cp", "iaq_x10",
+          "battery_mv", "pressure", "gas_ohm", "iaq_accuracy", "flags"]
+
+# Integer prefix codes of main/ts_codec.c: leading ones -> payload bits
+INT_WIDTHS = [0, 7, 9, 12, 32]
+M32 = 0xFFFFFFFF
+
+
+def s32(v):
+    v &= M32
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def zigzag(v):
+    return ((v << 1) ^ (v >> 31)) & M32
+
+
+def unzigzag(z):
+    return (z >> 1) ^ -(z & 1)
+
+
+class Decoder:
+    """Port of ts_decoder_t, yields (timestamp, ints, float bit patterns)."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+        self.prev_ts = 0
+        self.prev_delta = 0
+        self.prev_ints = [0] * INTS
+        self.prev_floats = [0] * FLOATS
+        self.lead = [0] * FLOATS
+        self.len = [0] * FLOATS
+        self.count = 0
+
+    def bits(self, n):
+        value = 0
+        for _ in range(n):
+            byte = self.pos >> 3
+            if byte >= len(self.data):
+                raise ValueError("block overrun")
+            value = (value << 1) | ((self.data[byte] >> (7 - (self.pos & 7))) & 1)
+            self.pos += 1
+        return value
+
+    def int(self):
+        ones = 0
+        while ones < 4 and self.bits(1):
+            ones += 1
+        return unzigzag(self.bits(INT_WIDTHS[ones]))
+
+    def float(self, ch):
+        if not self.bits(1):
+            return self.prev_floats[ch]
+        if self.bits(1):
+            self.lead[ch] = self.bits(5)
+            self.len[ch] = self.bits(5) + 1
+            if self.lead[ch] + self.len[ch] > 32:
+                raise ValueError("bad float window")
+        elif self.len[ch] == 0:
+            raise ValueError("float window reused before one was set")
+        shift = 32 - self.lead[ch] - self.len[ch]
+        return self.prev_floats[ch] ^ (self.bits(self.len[ch]) << shift)
+
+    def next(self):
+        v = self.int()
+        delta = 0
+        if self.count == 0:
+            ts = v & M32
+        else:
+            delta = s32(self.prev_delta + v)
+            ts = (self.prev_ts + delta) & M32
+        ints = [(self.prev_ints[i] + self.int()) & M32 for i in range(INTS)]
+        floats = [self.float(i) for i in range(FLOATS)]
+        self.prev_ts, self.prev_delta = ts, delta
+        self.prev_ints, self.prev_floats = ints, floats
+        self.count += 1
+        return ts, ints, floats
+
+
+class Encoder:
+    """Port of ts_encoder_t, only used by the simulator."""
+
+    def __init__(self):
+        self.out = bytearray()
+        self.nbits = 0
+        self.prev_ts = 0
+        self.prev_delta = 0
+        self.prev_ints = [0] * INTS
+        self.prev_floats = [0] * FLOATS
+        self.lead = [0] * FLOATS
+        self.len = [0] * FLOATS
+        self.count = 0
+
+    def put(self, value, n):
+        for i in range(n - 1, -1, -1):
+            if self.nbits & 7 == 0:
+                self.out.append(0)
+            self.out[-1] |= ((value >> i) & 1) << (7 - (self.nbits & 7))
+            self.nbits += 1
+
+    def int(self, v):
+        z = zigzag(v)
+        if z == 0:
+            self.put(0, 1)
+        elif z < 1 << 7:
+            self.put(0x2, 2)
+            self.put(z, 7)
+        elif z < 1 << 9:
+            self.put(0x6, 3)
+            self.put(z, 9)
+        elif z < 1 << 12:
+            self.put(0xE, 4)
+            self.put(z, 12)
+        else:
+            self.put(0xF, 4)
+            self.put(z, 32)
+
+    def float(self, ch, value):
+        x = value ^ self.prev_floats[ch]
+        if x == 0:
+            self.put(0, 1)
+            return
+        lead = 32 - x.bit_length()
+        trail = (x & -x).bit_length() - 1
+        if (self.len[ch] and lead >= self.lead[ch] and
+                32 - trail <= self.lead[ch] + self.len[ch]):
+            self.put(2, 2)
+            self.put(x >> (32 - self.lead[ch] - self.len[ch]), self.len[ch])
+            return
+        n = 32 - lead - trail
+        self.put(3, 2)
+        self.put(lead, 5)
+        self.put(n - 1, 5)
+        self.put(x >> trail, n)
+        self.lead[ch], self.len[ch] = lead, n
+
+    def add(self, ts, ints, floats):
+        delta = s32(ts - self.prev_ts)
+        if self.count == 0:
+            self.int(s32(ts))
+        else:
+            self.int(s32(delta - self.prev_delta))
+        for i in range(INTS):
+            self.int(s32(ints[i] - self.prev_ints[i]))
+        for i in range(FLOATS):
+            self.float(i, floats[i])
+        self.prev_delta = 0 if self.count == 0 else delta
+        self.prev_ts, self.prev_ints, self.prev_floats = ts, ints, floats
+        self.count += 1
+
+
+def to_float(bits):
+    return struct.unpack("<f", struct.pack("<I", bits))[0]
+
+
+def from_float(value):
+    return struct.unpack("<I", struct.pack("<f", value))[0]
+
+
+def record(seq, ts, ints, floats):
+    """Apply the casts of sample_from_point() in main/log_manager.c."""
+    return {
+        "seq": seq,
+        "timestamp": ts,
+        "temperature_cc": s32(ints[0] << 16) >> 16,
+        "humidity_cp": ints[1] & 0xFFFF,
+        "iaq_x10": ints[2] & 0xFFFF,
+        "battery_mv": ints[3] & 0xFFFF,
+        "pressure": to_float(floats[0]),
+        "gas_ohm": to_float(floats[1]),
+        "iaq_accuracy": ints[4] & 0xFF,
+        "flags": ints[5] & 0xFF,
+    }
+
+
+def decode_block(payload):
+    first_seq, count, _ = struct.unpack_from("<IHH", payload)
+    dec = Decoder(payload[8:])
+    for i in range(count):
+        yield record((first_seq + i) & M32, *dec.next())
+
+
+def frame(ftype, payload):
+    head = struct.pack("<BH", ftype, len(payload))
+    return SYNC + head + payload + struct.pack("<I", zlib.crc32(head + payload))
+
+
+class FrameParser:
+    """Finds frames in a byte stream that also carries console text."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.skipped = 0
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            i = self.buf.find(SYNC)
+            if i < 0:
+                keep = 1 if self.buf[-1:] == SYNC[:1] else 0
+                self.skipped += len(self.buf) - keep
+                del self.buf[:len(self.buf) - keep]
+                return
+            self.skipped += i
+            del self.buf[:i]
+            if len(self.buf) < 5:
+                return
+            ftype, length = struct.unpack_from("<BH", self.buf, 2)
+            if length > MAX_PAYLOAD:
+                self.skipped += 1
+                del self.buf[:1]
+                continue
+            if len(self.buf) < 5 + length + 4:
+                return
+            (crc,) = struct.unpack_from("<I", self.buf, 5 + length)
+            if crc != zlib.crc32(bytes(self.buf[2:5 + length])):
+                self.skipped += 1
+                del self.buf[:1]  # Sync bytes inside text or a torn frame
+                continue
+            payload = bytes(self.buf[5:5 + length])
+            del self.buf[:5 + length + 4]
+            yield ftype, payload
+
+
+class Port:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        return os.read(self.fd, 4096) if ready else b""
+
+
+def request(port, parser, line, want):
+    """Send a request line and yield frames until one of the types in want."""
+    port.write(line.encode() + b"\n")
+    deadline = time.monotonic() + IDLE_TIMEOUT_S
+    while time.monotonic() < deadline:
+        data = port.read(0.2)
+        if not data:
+            continue
+        deadline = time.monotonic() + IDLE_TIMEOUT_S
+        for ftype, payload in parser.feed(data):
+            if ftype == FRAME_ERROR:
+                (err,) = struct.unpack_from("<i", payload)
+                raise RuntimeError("device error 0x%x for %r" % (err, line))
+            yield ftype, payload
+            if ftype in want:
+                return
+    raise TimeoutError("no answer to %r" % line)
+
+
+def parse_info(payload):
+    """Return (first_seq, next_seq, staged, mac, epoch) of an INFO frame."""
+    version, = struct.unpack_from("<I", payload)
+    if version != VERSION:
+        raise RuntimeError("unsupported export version %d" % version)
+    _, first_seq, next_seq, staged, mac, _, epoch = struct.unpack_from(
+        "<IIII6sHI", payload)
+    return first_seq, next_seq, staged, mac, epoch
+
+
+def fetch(port, start, epoch=None, since=None):
+    """Return (info, records, next_seq) for everything from start on.
+
+    start belongs to the log with the given epoch, if known; a cursor into
+    another log is dropped and everything is fetched. With since, records
+    from that Unix time on are fetched instead.
+    """
+    parser = FrameParser()
+    info = None
+    for ftype, payload in request(port, parser, "HLX INFO", {FRAME_INFO}):
+        if ftype == FRAME_INFO:
+            info = parse_info(payload)
+    first_seq, next_seq, staged, mac, dev_epoch = info
+    if start is not None and epoch is not None and epoch != dev_epoch:
+        print("warning: device started a new log (epoch %08x, was %08x), "
+              "fetching it from the start" % (dev_epoch, epoch),
+              file=sys.stderr)
+        start = first_seq
+    elif start is not None and s32(start - next_seq) > 0:
+        print("warning: %d is past the newest record %d, the log was "
+              "restarted; fetching it from the start" % (start, next_seq - 1),
+              file=sys.stderr)
+        start = first_seq
+    if start is None or s32(start - first_seq) < 0:
+        start = first_seq
+    if since is not None:
+        line = "HLX EXPORT @%d" % since
+        keep = lambda r: r["timestamp"] >= since
+    else:
+        line = "HLX EXPORT %d" % start
+        keep = lambda r: s32(r["seq"] - start) >= 0
+    print("device %s: log %08x, records %d..%d (%d staged), fetching from %s" %
+          (mac.hex(), dev_epoch, first_seq, next_seq - 1, staged,
+           line.split()[2]), file=sys.stderr)
+
+    records = []
+    end = start
+    for ftype, payload in request(port, parser, line, {FRAME_END}):
+        if ftype == FRAME_BLOCK:
+            records += [r for r in decode_block(payload) if keep(r)]
+        elif ftype == FRAME_END:
+            (end,) = struct.unpack("<I", payload)
+    return info, records, end
+
+
+def decode_capture(path):
+    """Decode every frame of a raw capture, answers to any requests."""
+    parser = FrameParser()
+    records, end, epoch = [], None, None
+    with open(path, "rb") as f:
+        for ftype, payload in parser.feed(f.read()):
+            if ftype == FRAME_INFO:
+                epoch = parse_info(payload)[4]
+            elif ftype == FRAME_BLOCK:
+                records += decode_block(payload)
+            elif ftype == FRAME_END:
+                (end,) = struct.unpack("<I", payload)
+            elif ftype == FRAME_ERROR:
+                print("device error 0x%x" % struct.unpack("<i", payload),
+                      file=sys.stderr)
+    return records, end, epoch
+
+
+def write_csv(path, records, append):
+    new = not (append and os.path.exists(path))
+    with open(path, "w" if new else "a", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        if new:
+            writer.writeheader()
+        writer.writerows(records)
+
+
+def write_parquet(path, records, append):
+    try:
+        import pyarrow as pa
+        import pyarrow.parquet as pq
+    except ImportError:
+        sys.exit("--parquet needs pyarrow")
+    schema = pa.schema([
+        ("seq", pa.uint32()), ("timestamp", pa.timestamp("s", tz="UTC")),
+        ("temperature_cc", pa.int16()), ("humidity_cp", pa.uint16()),
+        ("iaq_x10", pa.uint16()), ("battery_mv", pa.uint16()),
+        ("pressure", pa.float32()), ("gas_ohm", pa.float32()),
+        ("iaq_accuracy", pa.uint8()), ("flags", pa.uint8()),
+    ])
+    table = pa.Table.from_pylist(records, schema=schema)
+    if append and os.path.exists(path):
+        table = pa.concat_tables([pq.read_table(path, schema=schema), table])
+    pq.write_table(table, path)
+
+
+def parse_time(value):
+    """Unix seconds, or an ISO 8601 time, UTC unless it has an offset."""
+    if value.isdigit():
+        return int(value)
+    t = datetime.datetime.fromisoformat(value)
+    if t.tzinfo is None:
+        t = t.replace(tzinfo=datetime.timezone.utc)
+    return int(t.timestamp())
+
+
+def dump(args):
+    state = {}
+    if args.state and os.path.exists(args.state):
+        with open(args.state) as f:
+            state = json.load(f)
+    explicit = args.start is not None or args.since is not None
+    start = args.start if explicit else state.get("next_seq")
+    # An explicit --from or --since is taken as it is
+    epoch = state.get("epoch") if not explicit else None
+
+    if args.input:
+        records, end, epoch = decode_capture(args.input)
+        if args.since is not None:
+            records = [r for r in records if r["timestamp"] >= args.since]
+        elif start is not None:
+            records = [r for r in records if s32(r["seq"] - start) >= 0]
+    else:
+        info, records, end = fetch(Port(args.port), start, epoch, args.since)
+        epoch = info[4]
+
+    seqs = [r["seq"] for r in records]
+    gaps = sum(1 for a, b in zip(seqs, seqs[1:]) if b != a + 1)
+    print("%d records%s" % (len(records), ", %d gaps" % gaps if gaps else ""),
+          file=sys.stderr)
+
+    append = args.state is not None
+    if args.csv:
+        write_csv(args.csv, records, append)
+    if args.parquet:
+        write_parquet(args.parquet, records, append)
+    if not args.csv and not args.parquet:
+        writer = csv.DictWriter(sys.stdout, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(records)
+
+    if args.state and end is not None:
+        with open(args.state, "w") as f:
+            json.dump({"epoch": epoch, "next_seq": end}, f)
+
+
+def trace(args):
+    text = bytearray()
+    length = None
+    for ftype, payload in request(Port(args.port), FrameParser(), "HLX TRACE",
+                                  {FRAME_END}):
+        if ftype == FRAME_TRACE:
+            text += payload
+        elif ftype == FRAME_END:
+            (length,) = struct.unpack("<I", payload)
+    if length != len(text):
+        raise RuntimeError("trace incomplete, %d of %d bytes" %
+                           (len(text), length))
+    events = json.loads(text)["traceEvents"]
+    wakes = sum(1 for e in events if e["ph"] == "M")
+    print("%d wakes, %d phases" % (wakes, len(events) - wakes),
+          file=sys.stderr)
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text.decode())
+
+
+def synthetic_trace(wakes=8):
+    """A wake trace like wake_trace_dump() writes it."""
+    events = []
+    for w in range(100, 100 + wakes):
+        events.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": w,
+                       "args": {"name": "wake %d (warm) t=%d" %
+                                (w, 1700000000 + 3 * w)}})
+        for name, ts, dur in [("wake", 4000, 68000), ("vbat_read", 4100, 900),
+                              ("bsec_run", 5200, 61000),
+                              ("display_draw", 66500, 4800)]:
+            events.append({"name": name, "ph": "X", "pid": 0, "tid": w,
+                           "ts": ts, "dur": dur + w})
+    return json.dumps({"displayTimeUnit": "ms",
+                       "otherData": {"firmware": "sim"},
+                       "traceEvents": events}).encode()
+
+
+def synthetic_blocks(n, block=28):
+    """Blocks of a plausible log, split like log_manager flushes them."""
+    rng = random.Random(1)
+    ts = 1700000000
+    blocks = []
+    for first in range(0, n, block):
+        enc = Encoder()
+        count = min(block, n - first)
+        for seq in range(first, first + count):
+            ts += 300 + rng.choice([0, 0, 0, 1, -1])
+            day = math.sin(seq / 288 * 2 * math.pi)
+            ints = [2150 + int(300 * day) + rng.randint(-3, 3),
+                    4500 - int(800 * day) + rng.randint(-10, 10),
+                    250 + rng.randint(-20, 20), 3950 - seq // 100, 3, 0x0F]
+            floats = [from_float(1013.25 + rng.uniform(-0.5, 0.5)),
+                      from_float(120000.0 * (1 + rng.uniform(-0.05, 0.05)))]
+            enc.add(ts & M32, [v & M32 for v in ints], floats)
+        blocks.append(struct.pack("<IHH", first, count, 0) + bytes(enc.out))
+    return blocks
+
+
+def simulate(args):
+    blocks = synthetic_blocks(args.records)
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    print("serving %d records on %s" % (args.records, os.ttyname(slave)),
+          flush=True)
+    t_max = [max(r["timestamp"] for r in decode_block(blk)) for blk in blocks]
+    trace_text = synthetic_trace()
+    capture = open(args.capture, "wb") if args.capture else None
+    info = struct.pack("<IIII6sHI", VERSION, 0, args.records, 0,
+                       bytes.fromhex("40ca63000001"), 0, args.epoch)
+
+    def send(data):
+        os.write(master, data)
+        if capture:
+            capture.write(data)
+            capture.flush()
+
+    line = b""
+    while True:
+        try:
+            data = os.read(master, 256)
+        except OSError:
+            time.sleep(0.1)  # Nobody has the terminal open
+            continue
+        line += data
+        while b"\n" in line:
+            req, line = line.split(b"\n", 1)
+            req = req.strip().decode(errors="replace")
+            send(b"I (1234) main: diff:57\r\n")  # Console noise
+            if req == "HLX INFO":
+                send(frame(FRAME_INFO, info))
+            elif req.startswith("HLX EXPORT "):
+                arg = req.split()[2]
+                if arg.startswith("@"):
+                    # Like log_manager_find_time(): the first block reaching t
+                    t = int(arg[1:])
+                    start = next((struct.unpack_from("<I", blk)[0]
+                                  for blk, tm in zip(blocks, t_max) if tm >= t),
+                                 args.records)
+                else:
+                    start = int(arg)
+                for i, blk in enumerate(blocks):
+                    first, count = struct.unpack_from("<IH", blk)
+                    if first + count > start:
+                        send(frame(FRAME_BLOCK, blk))
+                    if i % 8 == 0:
+                        send(b"W (5678) BSEC: \xa5\x5a stray bytes\r\n")
+                send(frame(FRAME_END, struct.pack("<I", args.records)))
+            elif req == "HLX TRACE":
+                for i in range(0, len(trace_text), MAX_PAYLOAD):
+                    send(frame(FRAME_TRACE, trace_text[i:i + MAX_PAYLOAD]))
+                send(frame(FRAME_END, struct.pack("<I", len(trace_text))))
+            elif req.startswith("HLX"):
+                send(frame(FRAME_ERROR, struct.pack("<i", 0x106)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("dump", help="fetch and decode the log")
+    src = p.add_mutually_exclusive_group(required=True)
+    src.add_argument("--port", help="USB Serial/JTAG tty of the device")
+    src.add_argument("--input", help="raw capture of the device answers")
+    first = p.add_mutually_exclusive_group()
+    first.add_argument("--from", dest="start", type=int,
+                       help="first sequence number to fetch")
+    first.add_argument("--since", type=parse_time,
+                       help="first time to fetch, Unix seconds or ISO 8601")
+    p.add_argument("--state", help="JSON file keeping where to go on from")
+    p.add_argument("--csv", help="CSV output, stdout without any output")
+    p.add_argument("--parquet", help="Parquet output, needs pyarrow")
+    p = sub.add_parser("trace", help="fetch the wake trace")
+    p.add_argument("--port", required=True,
+                   help="USB Serial/JTAG tty of the device")
+    p.add_argument("--out", help="JSON output, stdout without it")
+    p = sub.add_parser("simulate", help="serve a synthetic log on a pty")
+    p.add_argument("--records", type=int, default=2000)
+    p.add_argument("--capture", help="also write the answers to this file")
+    p.add_argument("--epoch", type=lambda v: int(v, 16), default=0x5EED0001,
+                   help="log epoch to report, hex")
+    args = parser.parse_args()
+    {"dump": dump, "trace": trace, "simulate": simulate}[args.cmd](args)
+
+
+if __name__ == "__main__":
+    main()
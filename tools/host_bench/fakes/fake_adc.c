@@ -0,0 +1,147 @@
+/*
+ * fake_adc.c
+ *
+ * ADC continuous mode without DMA: every read hands out a conversion frame
+ * of TYPE2 results for the configured channel, with a little noise and now
+ * and then a result from another channel, like the real pool after a
+ * flush. Calibration is the linear 12 dB line, or absent when the bench
+ * asks for an unburnt eFuse.
+ */
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_continuous.h"
+#include "fakes.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_ADC_FULL_SCALE_MV 3300
+#define FAKE_ADC_MAX_RAW 4095
+#define FAKE_ADC_NOISE 8      // Peak raw noise
+#define FAKE_ADC_STRAY_EVERY 17 // One result in this many is another channel
+
+struct fake_adc_continuous
+{
+  uint32_t frame_size;
+  uint8_t channel;
+  bool started;
+};
+
+struct fake_adc_cali
+{
+  int unused;
+};
+
+static int adc_mv = 1900; // A half full cell behind the 1:2 divider
+static bool calibrated = true;
+static uint32_t noise_state = 1;
+static uint32_t results;
+
+void fake_adc_set_mv(int mv)
+{
+  adc_mv = mv;
+}
+
+void fake_adc_set_calibrated(bool on)
+{
+  calibrated = on;
+}
+
+// LCG, the same sequence on every run
+static int noise(void)
+{
+  noise_state = noise_state * 1664525u + 1013904223u;
+  return (int)(noise_state >> 16) % (2 * FAKE_ADC_NOISE + 1) - FAKE_ADC_NOISE;
+}
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *config,
+                                    adc_continuous_handle_t *ret_handle)
+{
+  struct fake_adc_continuous *adc = calloc(1, sizeof(*adc));
+  if (adc == NULL)
+    return ESP_ERR_NO_MEM;
+  adc->frame_size = config->conv_frame_size;
+  *ret_handle = adc;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle,
+                                const adc_continuous_config_t *config)
+{
+  if (config->pattern_num != 1 ||
+      config->format != ADC_DIGI_OUTPUT_FORMAT_TYPE2)
+    return ESP_ERR_NOT_SUPPORTED;
+  handle->channel = config->adc_pattern[0].channel;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+  if (handle->started)
+    return ESP_ERR_INVALID_STATE;
+  handle->started = true;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+  if (!handle->started)
+    return ESP_ERR_INVALID_STATE;
+  handle->started = false;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_flush_pool(adc_continuous_handle_t handle)
+{
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf,
+                              uint32_t length_max, uint32_t *out_length,
+                              uint32_t timeout_ms)
+{
+  if (!handle->started)
+    return ESP_ERR_INVALID_STATE;
+
+  uint32_t len = handle->frame_size < length_max ? handle->frame_size
+                                                 : length_max;
+  len -= len % SOC_ADC_DIGI_RESULT_BYTES;
+  int raw = adc_mv * FAKE_ADC_MAX_RAW / FAKE_ADC_FULL_SCALE_MV;
+  for (uint32_t i = 0; i < len; i += SOC_ADC_DIGI_RESULT_BYTES)
+  {
+    adc_digi_output_data_t out = {.val = 0};
+    int value = raw + noise();
+    out.type2.data = value < 0                  ? 0
+                     : value > FAKE_ADC_MAX_RAW ? FAKE_ADC_MAX_RAW
+                                                : value;
+    out.type2.channel = ++results % FAKE_ADC_STRAY_EVERY == 0
+                            ? (handle->channel + 1) & 7
+                            : handle->channel;
+    out.type2.unit = 0;
+    memcpy(&buf[i], &out, sizeof(out));
+  }
+  *out_length = len;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_create_scheme_curve_fitting(
+    const adc_cali_curve_fitting_config_t *config, adc_cali_handle_t *ret_handle)
+{
+  static struct fake_adc_cali cali;
+  if (!calibrated)
+    return ESP_ERR_NOT_SUPPORTED;
+  *ret_handle = &cali;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_delete_scheme_curve_fitting(adc_cali_handle_t handle)
+{
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw,
+                                  int *voltage)
+{
+  if (handle == NULL || raw < 0 || raw > FAKE_ADC_MAX_RAW)
+    return ESP_ERR_INVALID_ARG;
+  *voltage = raw * FAKE_ADC_FULL_SCALE_MV / FAKE_ADC_MAX_RAW;
+  return ESP_OK;
+}
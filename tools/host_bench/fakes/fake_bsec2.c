@@ -0,0 +1,244 @@
+/*
+ * fake_bsec2.c
+ *
+ * The bsec2 component without the BSEC library: every bsec2_run() is a due
+ * call and hands the next step of a script to the callback, as the outputs
+ * the manager subscribed to or, for steps without an IAQ, as raw data
+ * only. The script is a built-in day of sine waves or a CSV file with one
+ * step per line:
+ *
+ *   temperature,humidity,pressure,gas_resistance,iaq,accuracy,stabilization,run_in
+ *
+ * Lines that don't start with a number are skipped. The state blob holds a
+ * magic and a generation counter, so a save only differs when the bench
+ * bumped it.
+ */
+#include "bsec2.h"
+#include "driver/i2c_master.h"
+#include "esp_timer.h"
+#include "fakes.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_BSEC_ADDRESS 0x77
+#define FAKE_BSEC_REG_CHIP_ID 0xD0
+#define FAKE_BSEC_CHIP_ID 0x61
+#define FAKE_BSEC_REG_FIELD0 0x1D // Measurement status, read on every run
+#define FAKE_BSEC_SCRIPT_MAX 4096
+#define FAKE_BSEC_BUILTIN_STEPS 288 // A day at the 300 s ULP interval
+#define FAKE_BSEC_WARMUP_STEPS 4    // Raw data only at the start
+#define FAKE_BSEC_STATE_MAGIC 0x32534246 // "FBS2"
+
+static fake_bsec_step_t script[FAKE_BSEC_SCRIPT_MAX];
+static uint32_t script_len;
+static uint32_t runs;
+static uint32_t generation;
+static i2c_master_dev_handle_t sensor;
+
+static void builtin_script(void)
+{
+  for (uint32_t i = 0; i < FAKE_BSEC_BUILTIN_STEPS; i++)
+  {
+    float day = 2.0f * (float)M_PI * i / FAKE_BSEC_BUILTIN_STEPS;
+    fake_bsec_step_t *s = &script[i];
+    s->temperature = 22.0f + 3.0f * sinf(day);
+    s->humidity = 45.0f - 10.0f * sinf(day);
+    s->pressure = 1013.0f + 2.0f * cosf(day);
+    s->gas_resistance = 120000.0f + 40000.0f * cosf(day);
+    s->iaq = i < FAKE_BSEC_WARMUP_STEPS ? -1.0f : 50.0f + 40.0f * sinf(3 * day);
+    s->accuracy = i < 32 ? 0 : i < 96 ? 1 : 3;
+    s->stabilization = i >= FAKE_BSEC_WARMUP_STEPS;
+    s->run_in = i >= 64;
+  }
+  script_len = FAKE_BSEC_BUILTIN_STEPS;
+}
+
+int fake_bsec2_load_script(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+
+  char line[256];
+  script_len = 0;
+  while (script_len < FAKE_BSEC_SCRIPT_MAX && fgets(line, sizeof(line), f))
+  {
+    fake_bsec_step_t s;
+    unsigned accuracy, stabilization, run_in;
+    if (sscanf(line, "%f,%f,%f,%f,%f,%u,%u,%u", &s.temperature, &s.humidity,
+               &s.pressure, &s.gas_resistance, &s.iaq, &accuracy,
+               &stabilization, &run_in) != 8)
+      continue;
+    s.accuracy = accuracy;
+    s.stabilization = stabilization;
+    s.run_in = run_in;
+    script[script_len++] = s;
+  }
+  fclose(f);
+  if (script_len == 0)
+  {
+    builtin_script();
+    return -1;
+  }
+  return (int)script_len;
+}
+
+const fake_bsec_step_t *fake_bsec2_step(uint32_t n)
+{
+  if (script_len == 0)
+    builtin_script();
+  return &script[n % script_len];
+}
+
+uint32_t fake_bsec2_runs(void)
+{
+  return runs;
+}
+
+void fake_bsec2_touch_state(void)
+{
+  generation++;
+}
+
+bool bsec2_init(bsec2_t *const me, void *arg, bme68x_intf_t intf)
+{
+  memset(me, 0, sizeof(*me));
+  me->intf_ptr = arg;
+  if (script_len == 0)
+    builtin_script();
+
+  if (sensor == NULL)
+  {
+    i2c_device_config_t config = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = FAKE_BSEC_ADDRESS,
+        .scl_speed_hz = 400000,
+    };
+    if (i2c_master_bus_add_device(arg, &config, &sensor) != ESP_OK)
+      return false;
+  }
+  uint8_t reg = FAKE_BSEC_REG_CHIP_ID, id = 0;
+  return i2c_master_transmit_receive(sensor, &reg, 1, &id, 1, 1000) ==
+             ESP_OK &&
+         id == FAKE_BSEC_CHIP_ID;
+}
+
+bool bsec2_set_config(bsec2_t *const me, const uint8_t *config)
+{
+  me->status = config != NULL ? BSEC_OK : -1;
+  return config != NULL;
+}
+
+bool bsec2_update_subscription(bsec2_t *const me, bsec_sensor_t *sensor_list,
+                               uint8_t n_sensors, float sample_rate)
+{
+  if (n_sensors > BSEC_NUMBER_OUTPUTS || sample_rate <= 0)
+    return false;
+  me->sample_rate = sample_rate;
+  // Outputs carry the ids in subscription order, signals are filled per run
+  me->outputs.n_outputs = n_sensors;
+  for (uint8_t i = 0; i < n_sensors; i++)
+  {
+    me->outputs.output[i].sensor_id = sensor_list[i];
+    me->outputs.output[i].signal_dimensions = 1;
+  }
+  return true;
+}
+
+void bsec2_attach_callback(bsec2_t *const me, bsec_callback_t callback)
+{
+  me->new_data_callback = callback;
+}
+
+static float output_signal(const fake_bsec_step_t *s, uint8_t id)
+{
+  switch (id)
+  {
+  case BSEC_OUTPUT_IAQ:
+  case BSEC_OUTPUT_STATIC_IAQ:
+    return s->iaq;
+  case BSEC_OUTPUT_RAW_TEMPERATURE:
+    return s->temperature + 1.5f; // Self heating, compensated below
+  case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE:
+    return s->temperature;
+  case BSEC_OUTPUT_RAW_HUMIDITY:
+    return s->humidity - 4.0f;
+  case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY:
+    return s->humidity;
+  case BSEC_OUTPUT_RAW_PRESSURE:
+    return s->pressure;
+  case BSEC_OUTPUT_RAW_GAS:
+    return s->gas_resistance;
+  case BSEC_OUTPUT_STABILIZATION_STATUS:
+    return s->stabilization;
+  case BSEC_OUTPUT_RUN_IN_STATUS:
+    return s->run_in;
+  default:
+    return 0;
+  }
+}
+
+bool bsec2_run(bsec2_t *const me)
+{
+  int64_t now_ns = esp_timer_get_time() * 1000LL;
+  if (me->sample_rate <= 0)
+    return false;
+  me->bme_conf.next_call = now_ns + (int64_t)(1e9f / me->sample_rate);
+
+  // The field data read the real library does
+  uint8_t reg = FAKE_BSEC_REG_FIELD0, field[17];
+  if (i2c_master_transmit_receive(sensor, &reg, 1, field, sizeof(field),
+                                  1000) != ESP_OK)
+  {
+    me->status = -1;
+    return false;
+  }
+
+  const fake_bsec_step_t *s = fake_bsec2_step(runs++);
+  bme68x_data_t data = {
+      .status = 0xB0, // New data, gas valid, heater stable
+      .temperature = s->temperature,
+      .pressure = s->pressure,
+      .humidity = s->humidity,
+      .gas_resistance = s->gas_resistance,
+  };
+  bsec_outputs_t outputs = me->outputs;
+  if (s->iaq < 0)
+    outputs.n_outputs = 0;
+  for (uint8_t i = 0; i < outputs.n_outputs; i++)
+  {
+    bsec_data_t *out = &outputs.output[i];
+    out->time_stamp = now_ns;
+    out->signal = output_signal(s, out->sensor_id);
+    out->accuracy = s->accuracy;
+  }
+  me->status = BSEC_OK;
+  if (me->new_data_callback != NULL)
+    me->new_data_callback(data, outputs, *me);
+  return true;
+}
+
+bool bsec2_get_state(bsec2_t *const me, uint8_t *state)
+{
+  uint32_t head[2] = {FAKE_BSEC_STATE_MAGIC, generation};
+  memcpy(state, head, sizeof(head));
+  for (size_t i = sizeof(head); i < BSEC_MAX_STATE_BLOB_SIZE; i++)
+    state[i] = (uint8_t)(i * 31 + generation);
+  return true;
+}
+
+bool bsec2_set_state(bsec2_t *const me, uint8_t *state)
+{
+  uint32_t head[2];
+  memcpy(head, state, sizeof(head));
+  if (head[0] != FAKE_BSEC_STATE_MAGIC)
+  {
+    me->status = -1;
+    return false;
+  }
+  generation = head[1];
+  me->status = BSEC_OK;
+  return true;
+}
@@ -0,0 +1,193 @@
+/*
+ * fake_esp.c
+ *
+ * Host fakes of the small ESP-IDF services: logging, error names, the ROM
+ * CRC, busy waits, esp_timer and the RTC clock. The clock replaces
+ * gettimeofday(), settimeofday() and time() at link time (--wrap), so the
+ * firmware can set it like on the device; it runs on the monotonic clock
+ * from 2026-01-01.
+ */
+#include "esp_app_desc.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "fakes.h"
+#include "nvs.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define FAKE_CLOCK_START_US (1767225600LL * 1000000LL) // 2026-01-01 00:00 UTC
+
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t clock_offset_us = FAKE_CLOCK_START_US;
+
+void fake_log_set_level(esp_log_level_t level)
+{
+  log_level = level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+  (void)tag;
+  log_level = level;
+}
+
+void fake_log_write(esp_log_level_t level, const char *tag, const char *fmt,
+                    ...)
+{
+  static const char letters[] = "NEWIDV";
+  if (level > log_level)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "%c (%lld) %s: ", letters[level],
+          (long long)(esp_timer_get_time() / 1000), tag);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_CRC:
+    return "ESP_ERR_INVALID_CRC";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  case ESP_ERR_NVS_INVALID_LENGTH:
+    return "ESP_ERR_NVS_INVALID_LENGTH";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+static uint32_t crc_table[256];
+
+static void crc_table_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+}
+
+// Same as the ROM: reflected CRC32, pre- and post-inverted
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, crc_table_init);
+
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++)
+    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+  int64_t end = esp_timer_get_time() + us;
+  while (esp_timer_get_time() < end)
+    ;
+}
+
+static int64_t monotonic_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t boot_us;
+
+__attribute__((constructor)) static void boot_time_init(void)
+{
+  boot_us = monotonic_us();
+}
+
+int64_t esp_timer_get_time(void)
+{
+  return monotonic_us() - boot_us;
+}
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+  static const esp_app_desc_t desc = {
+      .version = "host",
+      .project_name = "handheldlogger",
+  };
+  return &desc;
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+  return ESP_RST_POWERON;
+}
+
+int64_t fake_clock_now_us(void)
+{
+  pthread_mutex_lock(&clock_lock);
+  int64_t now = clock_offset_us + esp_timer_get_time();
+  pthread_mutex_unlock(&clock_lock);
+  return now;
+}
+
+void fake_clock_set_us(int64_t unix_us)
+{
+  pthread_mutex_lock(&clock_lock);
+  clock_offset_us = unix_us - esp_timer_get_time();
+  pthread_mutex_unlock(&clock_lock);
+}
+
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+  (void)tz;
+  int64_t now = fake_clock_now_us();
+  tv->tv_sec = now / 1000000LL;
+  tv->tv_usec = now % 1000000LL;
+  return 0;
+}
+
+int __wrap_settimeofday(const struct timeval *tv, const void *tz)
+{
+  (void)tz;
+  if (tv != NULL)
+    fake_clock_set_us((int64_t)tv->tv_sec * 1000000LL + tv->tv_usec);
+  return 0;
+}
+
+time_t __wrap_time(time_t *out)
+{
+  time_t now = (time_t)(fake_clock_now_us() / 1000000LL);
+  if (out != NULL)
+    *out = now;
+  return now;
+}
@@ -0,0 +1,57 @@
+/*
+ * fake_firmware.c
+ *
+ * Stand-ins for the firmware modules the benchmarked managers call into
+ * but which are not under test here: there is never an upload due, and the
+ * sparklines come from a fixed pattern instead of the rollup RTC state.
+ */
+#include "rollup_manager.h"
+#include "upload_manager.h"
+#include <math.h>
+
+#define FAKE_SPARK_GAP_EVERY 40 // Columns between missed samples
+
+bool upload_manager_due(void)
+{
+  return false;
+}
+
+esp_err_t upload_manager_run(void)
+{
+  return ESP_OK;
+}
+
+uint32_t upload_manager_get_acked_seq(void)
+{
+  return 0;
+}
+
+// A full row with a few gaps, scaled like the rollup channels
+void rollup_manager_get_spark(rollup_spark_t spark, rollup_channel_t ch,
+                              int16_t out[ROLLUP_SPARK_COLUMNS])
+{
+  float cycles = spark == ROLLUP_SPARK_7D ? 7.0f : 1.0f;
+  for (int x = 0; x < ROLLUP_SPARK_COLUMNS; x++)
+  {
+    float phase = 2.0f * (float)M_PI * cycles * x / ROLLUP_SPARK_COLUMNS;
+    float value;
+    switch (ch)
+    {
+    case ROLLUP_TEMPERATURE:
+      value = 2200 + 300 * sinf(phase);
+      break;
+    case ROLLUP_HUMIDITY:
+      value = 4500 - 1000 * sinf(phase);
+      break;
+    case ROLLUP_IAQ:
+      value = 500 + 400 * sinf(3 * phase);
+      break;
+    default:
+      value = 0;
+      break;
+    }
+    out[x] = x % FAKE_SPARK_GAP_EVERY == FAKE_SPARK_GAP_EVERY - 1
+                 ? ROLLUP_SPARK_EMPTY
+                 : (int16_t)value;
+  }
+}
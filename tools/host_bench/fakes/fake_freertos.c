@@ -0,0 +1,294 @@
+/*
+ * fake_freertos.c
+ *
+ * The FreeRTOS calls of main/ on POSIX threads. Tasks are detached threads
+ * with a notification counter; semaphores and event groups are a mutex and
+ * a condition variable each. Priorities are only remembered, the host
+ * scheduler decides. Ticks are milliseconds of the monotonic clock.
+ */
+#define _GNU_SOURCE // Recursive mutex initializer
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct fake_task
+{
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *arg;
+  UBaseType_t priority;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notified;
+};
+
+struct fake_sem
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t count;
+};
+
+struct fake_event_group
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  EventBits_t bits;
+};
+
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread struct fake_task *current_task;
+
+static void object_init(pthread_mutex_t *lock, pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(lock, NULL);
+}
+
+// Absolute monotonic deadline ticks from now
+static struct timespec deadline_of(TickType_t ticks)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t ns = (int64_t)ts.tv_nsec +
+               (int64_t)ticks * (1000000000LL / configTICK_RATE_HZ);
+  ts.tv_sec += ns / 1000000000LL;
+  ts.tv_nsec = ns % 1000000000LL;
+  return ts;
+}
+
+// Wait on cond until pred holds or the ticks ran out, lock held
+#define WAIT_UNTIL(pred, cond, lock, ticks)                                    \
+  do                                                                           \
+  {                                                                            \
+    struct timespec until_ = deadline_of(ticks);                               \
+    while (!(pred))                                                            \
+    {                                                                          \
+      if ((ticks) == portMAX_DELAY)                                            \
+        pthread_cond_wait(cond, lock);                                         \
+      else if (pthread_cond_timedwait(cond, lock, &until_) == ETIMEDOUT)       \
+        break;                                                                 \
+    }                                                                          \
+  } while (0)
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+  (void)mux;
+  pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+  (void)mux;
+  pthread_mutex_unlock(&critical_lock);
+}
+
+static struct fake_task *task_new(void)
+{
+  struct fake_task *task = calloc(1, sizeof(*task));
+  if (task != NULL)
+    object_init(&task->lock, &task->cond);
+  return task;
+}
+
+// The main thread becomes a task the first time it asks for itself
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  if (current_task == NULL)
+  {
+    current_task = task_new();
+    if (current_task != NULL)
+      current_task->thread = pthread_self();
+  }
+  return current_task;
+}
+
+static void *task_entry(void *arg)
+{
+  struct fake_task *task = arg;
+  current_task = task;
+  task->fn(task->arg);
+  return NULL; // Returning from a task is an error on FreeRTOS
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+  (void)name;
+  (void)stack;
+  struct fake_task *task = task_new();
+  if (task == NULL)
+    return pdFAIL;
+  task->fn = fn;
+  task->arg = arg;
+  task->priority = priority;
+  // The handle is out before the task runs, like on FreeRTOS
+  if (handle != NULL)
+    *handle = task;
+  if (pthread_create(&task->thread, NULL, task_entry, task) != 0)
+  {
+    free(task);
+    if (handle != NULL)
+      *handle = NULL;
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  // Only self-deletion is used; the handle may still be compared against
+  if (task == NULL || task == current_task)
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  struct timespec until = deadline_of(ticks);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+    ;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return (TickType_t)(esp_timer_get_time() / (1000000 / configTICK_RATE_HZ));
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+  if (task == NULL)
+    task = xTaskGetCurrentTaskHandle();
+  return task != NULL ? task->priority : tskIDLE_PRIORITY;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+  struct fake_task *task = xTaskGetCurrentTaskHandle();
+  pthread_mutex_lock(&task->lock);
+  WAIT_UNTIL(task->notified > 0, &task->cond, &task->lock, ticks);
+  uint32_t value = task->notified;
+  if (value > 0)
+    task->notified = clear ? 0 : value - 1;
+  pthread_mutex_unlock(&task->lock);
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  pthread_mutex_lock(&task->lock);
+  task->notified++;
+  pthread_cond_signal(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+  return pdPASS;
+}
+
+static SemaphoreHandle_t sem_new(uint32_t count)
+{
+  struct fake_sem *sem = calloc(1, sizeof(*sem));
+  if (sem == NULL)
+    return NULL;
+  object_init(&sem->lock, &sem->cond);
+  sem->count = count;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return sem_new(0);
+}
+
+// No priority inheritance and no owner check, the firmware doesn't need them
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return sem_new(1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+  pthread_mutex_lock(&sem->lock);
+  WAIT_UNTIL(sem->count > 0, &sem->cond, &sem->lock, ticks);
+  BaseType_t taken = sem->count > 0;
+  if (taken)
+    sem->count--;
+  pthread_mutex_unlock(&sem->lock);
+  return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+  pthread_mutex_lock(&sem->lock);
+  BaseType_t given = sem->count == 0;
+  if (given)
+  {
+    sem->count = 1;
+    pthread_cond_signal(&sem->cond);
+  }
+  pthread_mutex_unlock(&sem->lock);
+  return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+  free(sem);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+  struct fake_event_group *group = calloc(1, sizeof(*group));
+  if (group != NULL)
+    object_init(&group->lock, &group->cond);
+  return group;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear, BaseType_t all,
+                                TickType_t ticks)
+{
+  pthread_mutex_lock(&group->lock);
+  WAIT_UNTIL(all ? (group->bits & bits) == bits : (group->bits & bits) != 0,
+             &group->cond, &group->lock, ticks);
+  EventBits_t value = group->bits;
+  bool met = all ? (value & bits) == bits : (value & bits) != 0;
+  if (met && clear)
+    group->bits &= ~bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  pthread_mutex_lock(&group->lock);
+  group->bits |= bits;
+  EventBits_t value = group->bits;
+  pthread_cond_broadcast(&group->cond);
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  pthread_mutex_lock(&group->lock);
+  EventBits_t value = group->bits;
+  group->bits &= ~bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+  pthread_mutex_lock(&group->lock);
+  EventBits_t value = group->bits;
+  pthread_mutex_unlock(&group->lock);
+  return value;
+}
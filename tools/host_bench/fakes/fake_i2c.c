@@ -0,0 +1,223 @@
+/*
+ * fake_i2c.c
+ *
+ * An I2C master with two devices on the bus: the SSD1306 panel at 0x3C,
+ * which interprets the command stream well enough to keep its GDDRAM, and
+ * the BME680 at 0x77, which reads back zeros apart from its chip id. Every
+ * transaction is counted so the bench can tell what a frame costs on the
+ * wire.
+ */
+#include "driver/i2c_master.h"
+#include "fakes.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SSD1306_ADDRESS 0x3C
+#define BME680_ADDRESS 0x77
+#define BME680_REG_CHIP_ID 0xD0
+#define BME680_CHIP_ID 0x61
+
+#define SSD1306_PAGES 8
+#define SSD1306_COLUMNS 128
+
+struct fake_i2c_bus
+{
+  int unused;
+};
+
+struct fake_i2c_dev
+{
+  uint16_t address;
+};
+
+static struct fake_i2c_bus bus;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool fail;
+static uint32_t transactions;
+static uint32_t bytes;
+
+/* Panel state */
+static uint8_t gddram[SSD1306_PAGES * SSD1306_COLUMNS];
+static uint8_t page, column;
+static uint8_t cmd_args; // Argument bytes still owed to the last command
+
+void fake_i2c_set_fail(bool on)
+{
+  fail = on;
+}
+
+uint32_t fake_i2c_transactions(void)
+{
+  return transactions;
+}
+
+uint32_t fake_i2c_bytes(void)
+{
+  return bytes;
+}
+
+const uint8_t *fake_ssd1306_ram(void)
+{
+  return gddram;
+}
+
+static bool present(uint16_t address)
+{
+  return address == SSD1306_ADDRESS || address == BME680_ADDRESS;
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *config,
+                             i2c_master_bus_handle_t *ret_bus_handle)
+{
+  *ret_bus_handle = &bus;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle,
+                                    const i2c_device_config_t *config,
+                                    i2c_master_dev_handle_t *ret_handle)
+{
+  if (bus_handle == NULL || config == NULL)
+    return ESP_ERR_INVALID_ARG;
+  struct fake_i2c_dev *dev = calloc(1, sizeof(*dev));
+  if (dev == NULL)
+    return ESP_ERR_NO_MEM;
+  dev->address = config->device_address;
+  *ret_handle = dev;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_probe(i2c_master_bus_handle_t bus_handle,
+                           uint16_t address, int xfer_timeout_ms)
+{
+  if (fail)
+    return ESP_ERR_TIMEOUT;
+  return present(address) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// SSD1306 commands with their argument count, page addressing only
+static void ssd1306_command(uint8_t c)
+{
+  if (cmd_args > 0)
+  {
+    cmd_args--;
+    return;
+  }
+  if (c >= 0xB0 && c <= 0xB7)
+    page = c - 0xB0;
+  else if (c <= 0x0F)
+    column = (column & 0xF0) | c;
+  else if (c >= 0x10 && c <= 0x1F)
+    column = (column & 0x0F) | ((c & 0x0F) << 4);
+  else if (c == 0x21 || c == 0x22)
+    cmd_args = 2;
+  else if (c == 0x20 || c == 0x81 || c == 0x8D || c == 0xA8 || c == 0xD3 ||
+           c == 0xD5 || c == 0xD9 || c == 0xDA || c == 0xDB)
+    cmd_args = 1;
+}
+
+static void ssd1306_data(uint8_t d)
+{
+  if (column < SSD1306_COLUMNS)
+    gddram[page * SSD1306_COLUMNS + column] = d;
+  column++;
+}
+
+/*
+ * One transaction: a control byte, then commands (0x00) or data (0x40).
+ * The continuation bit (0x80) isn't used by u8x8 and isn't modelled.
+ */
+static void ssd1306_transaction(const uint8_t *buf, size_t len)
+{
+  if (len == 0)
+    return;
+  bool data = buf[0] & 0x40;
+  for (size_t i = 1; i < len; i++)
+  {
+    if (data)
+      ssd1306_data(buf[i]);
+    else
+      ssd1306_command(buf[i]);
+  }
+}
+
+static esp_err_t transfer(struct fake_i2c_dev *dev, size_t len)
+{
+  if (dev == NULL)
+    return ESP_ERR_INVALID_ARG;
+  if (fail || !present(dev->address))
+    return ESP_ERR_TIMEOUT;
+  transactions++;
+  bytes += len;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev,
+                              const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms)
+{
+  i2c_master_transmit_multi_buffer_info_t buf = {
+      .write_buffer = write_buffer,
+      .buffer_size = write_size,
+  };
+  return i2c_master_multi_buffer_transmit(dev, &buf, 1, xfer_timeout_ms);
+}
+
+esp_err_t i2c_master_multi_buffer_transmit(
+    i2c_master_dev_handle_t dev,
+    i2c_master_transmit_multi_buffer_info_t *buffer_info_array,
+    size_t array_size, int xfer_timeout_ms)
+{
+  size_t len = 0;
+  for (size_t i = 0; i < array_size; i++)
+    len += buffer_info_array[i].buffer_size;
+
+  pthread_mutex_lock(&lock);
+  esp_err_t err = transfer(dev, len);
+  if (err == ESP_OK && dev->address == SSD1306_ADDRESS)
+  {
+    // The buffers are one transaction on the wire, join them
+    uint8_t wire[1 + SSD1306_COLUMNS * 2];
+    size_t n = 0;
+    for (size_t i = 0; i < array_size && n < sizeof(wire); i++)
+    {
+      size_t part = buffer_info_array[i].buffer_size;
+      if (part > sizeof(wire) - n)
+        part = sizeof(wire) - n;
+      memcpy(&wire[n], buffer_info_array[i].write_buffer, part);
+      n += part;
+    }
+    ssd1306_transaction(wire, n);
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t dev, uint8_t *read_buffer,
+                             size_t read_size, int xfer_timeout_ms)
+{
+  pthread_mutex_lock(&lock);
+  esp_err_t err = transfer(dev, read_size);
+  pthread_mutex_unlock(&lock);
+  if (err == ESP_OK)
+    memset(read_buffer, 0, read_size);
+  return err;
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev,
+                                      const uint8_t *write_buffer,
+                                      size_t write_size, uint8_t *read_buffer,
+                                      size_t read_size, int xfer_timeout_ms)
+{
+  pthread_mutex_lock(&lock);
+  esp_err_t err = transfer(dev, write_size + read_size);
+  pthread_mutex_unlock(&lock);
+  if (err != ESP_OK)
+    return err;
+  memset(read_buffer, 0, read_size);
+  if (dev->address == BME680_ADDRESS && write_size > 0 && read_size > 0 &&
+      write_buffer[0] == BME680_REG_CHIP_ID)
+    read_buffer[0] = BME680_CHIP_ID;
+  return ESP_OK;
+}
@@ -0,0 +1,250 @@
+/*
+ * fake_nvs.c
+ *
+ * NVS in memory: a flat table of namespace/key entries that survives
+ * nvs_close() but not the process. Writes are counted so the bench can
+ * check how often the managers would wear the flash.
+ */
+#include "fakes.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <pthread.h>
+#include <string.h>
+
+#define FAKE_NVS_ENTRIES 32
+#define FAKE_NVS_VALUE_MAX 1024
+#define FAKE_NVS_HANDLES 8
+#define FAKE_NVS_NAME_MAX 16 // 15 characters and the terminator, like NVS
+
+typedef enum
+{
+  ENTRY_FREE,
+  ENTRY_U32,
+  ENTRY_BLOB,
+} entry_type_t;
+
+typedef struct
+{
+  entry_type_t type;
+  char ns[FAKE_NVS_NAME_MAX];
+  char key[FAKE_NVS_NAME_MAX];
+  size_t len;
+  uint8_t value[FAKE_NVS_VALUE_MAX];
+} nvs_entry_t;
+
+typedef struct
+{
+  bool open;
+  bool writable;
+  char ns[FAKE_NVS_NAME_MAX];
+} nvs_slot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized;
+static nvs_entry_t entries[FAKE_NVS_ENTRIES];
+static nvs_slot_t slots[FAKE_NVS_HANDLES];
+static uint32_t writes;
+
+esp_err_t nvs_flash_init(void)
+{
+  initialized = true;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+  fake_nvs_clear();
+  return ESP_OK;
+}
+
+void fake_nvs_clear(void)
+{
+  pthread_mutex_lock(&lock);
+  memset(entries, 0, sizeof(entries));
+  writes = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+uint32_t fake_nvs_writes(void)
+{
+  return writes;
+}
+
+// Handles are the slot index plus one, 0 is never valid
+static nvs_slot_t *slot_of(nvs_handle_t handle)
+{
+  if (handle == 0 || handle > FAKE_NVS_HANDLES || !slots[handle - 1].open)
+    return NULL;
+  return &slots[handle - 1];
+}
+
+static nvs_entry_t *find(const char *ns, const char *key)
+{
+  for (int i = 0; i < FAKE_NVS_ENTRIES; i++)
+  {
+    if (entries[i].type != ENTRY_FREE && strcmp(entries[i].ns, ns) == 0 &&
+        (key == NULL || strcmp(entries[i].key, key) == 0))
+      return &entries[i];
+  }
+  return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *out_handle)
+{
+  if (!initialized)
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+  if (strlen(name) >= FAKE_NVS_NAME_MAX)
+    return ESP_ERR_INVALID_ARG;
+
+  esp_err_t err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  pthread_mutex_lock(&lock);
+  // A namespace only exists once something was written to it
+  if (mode == NVS_READONLY && find(name, NULL) == NULL)
+    err = ESP_ERR_NVS_NOT_FOUND;
+  else
+  {
+    for (int i = 0; i < FAKE_NVS_HANDLES; i++)
+    {
+      if (!slots[i].open)
+      {
+        slots[i].open = true;
+        slots[i].writable = mode == NVS_READWRITE;
+        strcpy(slots[i].ns, name);
+        *out_handle = i + 1;
+        err = ESP_OK;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+  pthread_mutex_lock(&lock);
+  nvs_slot_t *slot = slot_of(handle);
+  if (slot != NULL)
+    slot->open = false;
+  pthread_mutex_unlock(&lock);
+}
+
+// Writes go straight to the table, there is nothing to commit
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  return slot_of(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+static esp_err_t get(nvs_handle_t handle, const char *key, entry_type_t type,
+                     void *out, size_t *length)
+{
+  esp_err_t err = ESP_OK;
+  pthread_mutex_lock(&lock);
+  nvs_slot_t *slot = slot_of(handle);
+  nvs_entry_t *entry = slot != NULL ? find(slot->ns, key) : NULL;
+  if (slot == NULL)
+    err = ESP_ERR_NVS_INVALID_HANDLE;
+  else if (entry == NULL)
+    err = ESP_ERR_NVS_NOT_FOUND;
+  else if (entry->type != type)
+    err = ESP_ERR_NVS_TYPE_MISMATCH;
+  else if (out == NULL)
+    *length = entry->len; // Size query
+  else if (*length < entry->len)
+  {
+    *length = entry->len;
+    err = ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  else
+  {
+    memcpy(out, entry->value, entry->len);
+    *length = entry->len;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char *key, entry_type_t type,
+                     const void *value, size_t length)
+{
+  if (strlen(key) >= FAKE_NVS_NAME_MAX || length > FAKE_NVS_VALUE_MAX)
+    return ESP_ERR_INVALID_ARG;
+
+  esp_err_t err = ESP_OK;
+  pthread_mutex_lock(&lock);
+  nvs_slot_t *slot = slot_of(handle);
+  nvs_entry_t *entry = slot != NULL ? find(slot->ns, key) : NULL;
+  if (slot == NULL)
+    err = ESP_ERR_NVS_INVALID_HANDLE;
+  else if (!slot->writable)
+    err = ESP_ERR_NVS_READ_ONLY;
+  else if (entry != NULL && entry->type == type && entry->len == length &&
+           memcmp(entry->value, value, length) == 0)
+    ; // Same value, NVS doesn't write it again either
+  else
+  {
+    for (int i = 0; entry == NULL && i < FAKE_NVS_ENTRIES; i++)
+    {
+      if (entries[i].type == ENTRY_FREE)
+        entry = &entries[i];
+    }
+    if (entry == NULL)
+      err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    else
+    {
+      entry->type = type;
+      strcpy(entry->ns, slot->ns);
+      strcpy(entry->key, key);
+      memcpy(entry->value, value, length);
+      entry->len = length;
+      writes++;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length)
+{
+  return get(handle, key, ENTRY_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length)
+{
+  return set(handle, key, ENTRY_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+  size_t length = sizeof(*out_value);
+  return get(handle, key, ENTRY_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+  return set(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  esp_err_t err = ESP_OK;
+  pthread_mutex_lock(&lock);
+  nvs_slot_t *slot = slot_of(handle);
+  nvs_entry_t *entry = slot != NULL ? find(slot->ns, key) : NULL;
+  if (slot == NULL)
+    err = ESP_ERR_NVS_INVALID_HANDLE;
+  else if (!slot->writable)
+    err = ESP_ERR_NVS_READ_ONLY;
+  else if (entry == NULL)
+    err = ESP_ERR_NVS_NOT_FOUND;
+  else
+  {
+    entry->type = ENTRY_FREE;
+    writes++;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
@@ -0,0 +1,110 @@
+/*
+ * fake_partition.c
+ *
+ * The "storage" data partition in memory, small enough that the log wraps
+ * within a bench run. Writes behave like NOR flash: they can only clear
+ * bits, an erase sets a whole sector back to 0xFF. The mapping is the
+ * buffer itself, so it sees every write at once like the cache does.
+ */
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "fakes.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_PARTITION_SECTOR 4096
+#define FAKE_PARTITION_SECTORS 8
+
+static uint8_t flash[FAKE_PARTITION_SECTOR * FAKE_PARTITION_SECTORS];
+static bool erased;
+static uint32_t erases;
+
+static const esp_partition_t storage = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = ESP_PARTITION_SUBTYPE_ANY,
+    .address = 0x110000,
+    .size = sizeof(flash),
+    .erase_size = FAKE_PARTITION_SECTOR,
+    .label = "storage",
+};
+
+static bool in_range(size_t offset, size_t size)
+{
+  return offset <= sizeof(flash) && size <= sizeof(flash) - offset;
+}
+
+void fake_partition_erase(void)
+{
+  memset(flash, 0xFF, sizeof(flash));
+  erased = true;
+}
+
+uint32_t fake_partition_erases(void)
+{
+  return erases;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+  if (type != ESP_PARTITION_TYPE_DATA || label == NULL ||
+      strcmp(label, storage.label) != 0)
+    return NULL;
+  // A new chip comes erased
+  if (!erased)
+    fake_partition_erase();
+  return &storage;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size)
+{
+  if (!in_range(src_offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, &flash[src_offset], size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size)
+{
+  if (!in_range(dst_offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  const uint8_t *p = src;
+  for (size_t i = 0; i < size; i++)
+    flash[dst_offset + i] &= p[i];
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size)
+{
+  if (!in_range(offset, size) || offset % FAKE_PARTITION_SECTOR != 0 ||
+      size % FAKE_PARTITION_SECTOR != 0)
+    return ESP_ERR_INVALID_ARG;
+  memset(&flash[offset], 0xFF, size);
+  erases += size / FAKE_PARTITION_SECTOR;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle)
+{
+  if (!in_range(offset, size))
+    return ESP_ERR_INVALID_SIZE;
+  *out_ptr = &flash[offset];
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
+
+uint32_t esp_random(void)
+{
+  return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
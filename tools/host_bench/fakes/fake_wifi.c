@@ -0,0 +1,293 @@
+/*
+ * fake_wifi.c
+ *
+ * Just enough of the WiFi station, netif, event loop and SNTP client for
+ * wifi_time_manager.c: events are delivered synchronously on the posting
+ * thread, a connect succeeds at once while the access point is "present",
+ * and SNTP answers with the RTC time plus a settable offset.
+ */
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_sntp.h"
+#include "esp_wifi.h"
+#include "fakes.h"
+#include "mbedtls/pkcs5.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+#define FAKE_EVENT_HANDLERS 8
+#define FAKE_AP_CHANNEL 6
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+struct fake_netif
+{
+  esp_netif_ip_info_t ip_info;
+  esp_netif_dns_info_t dns;
+  bool dhcp;
+};
+
+typedef struct
+{
+  esp_event_base_t base;
+  int32_t id;
+  esp_event_handler_t handler;
+  void *arg;
+} event_handler_t;
+
+static event_handler_t handlers[FAKE_EVENT_HANDLERS];
+static int n_handlers;
+static struct fake_netif sta_netif;
+
+static const uint8_t ap_bssid[6] = {0x02, 0x00, 0x5E, 0x10, 0x00, 0x01};
+static bool ap_present = true;
+static bool wifi_started;
+static wifi_config_t wifi_config;
+
+static int64_t sntp_offset_us;
+static sntp_sync_time_cb_t sntp_cb;
+
+void fake_wifi_set_ap(bool present)
+{
+  ap_present = present;
+}
+
+void fake_sntp_set_offset_us(int64_t offset_us)
+{
+  sntp_offset_us = offset_us;
+}
+
+/* Event loop */
+
+esp_err_t esp_event_loop_create_default(void)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(
+    esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg,
+    esp_event_handler_instance_t *instance)
+{
+  if (n_handlers == FAKE_EVENT_HANDLERS)
+    return ESP_ERR_NO_MEM;
+  handlers[n_handlers] = (event_handler_t){base, id, handler, arg};
+  if (instance != NULL)
+    *instance = &handlers[n_handlers];
+  n_handlers++;
+  return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data,
+                         size_t size, uint32_t ticks)
+{
+  for (int i = 0; i < n_handlers; i++)
+  {
+    if (handlers[i].base == base &&
+        (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == id))
+      handlers[i].handler(handlers[i].arg, base, id, (void *)data);
+  }
+  return ESP_OK;
+}
+
+/* netif */
+
+esp_err_t esp_netif_init(void)
+{
+  return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+  sta_netif.dhcp = true;
+  return &sta_netif;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *netif)
+{
+  netif->dhcp = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif)
+{
+  netif->dhcp = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t *netif,
+                                const esp_netif_ip_info_t *ip_info)
+{
+  if (netif->dhcp)
+    return ESP_ERR_INVALID_STATE; // Like ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED
+  netif->ip_info = *ip_info;
+  return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t *netif,
+                                 esp_netif_dns_type_t type,
+                                 esp_netif_dns_info_t *dns)
+{
+  netif->dns = *dns;
+  return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t *netif,
+                                 esp_netif_dns_type_t type,
+                                 esp_netif_dns_info_t *dns)
+{
+  *dns = netif->dns;
+  return ESP_OK;
+}
+
+uint32_t esp_ip4addr_aton(const char *addr)
+{
+  return inet_addr(addr);
+}
+
+/* WiFi station */
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+  wifi_config = *conf;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_max_tx_power(int8_t power)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+  wifi_started = true;
+  return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, 0);
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+  if (!wifi_started)
+    return ESP_OK;
+  wifi_started = false;
+  return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0, 0);
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+  if (!wifi_started)
+    return ESP_ERR_INVALID_STATE;
+
+  bool reachable =
+      ap_present &&
+      (!wifi_config.sta.bssid_set ||
+       (memcmp(wifi_config.sta.bssid, ap_bssid, sizeof(ap_bssid)) == 0 &&
+        (wifi_config.sta.channel == 0 ||
+         wifi_config.sta.channel == FAKE_AP_CHANNEL)));
+  if (!reachable)
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, 0);
+
+  wifi_event_sta_connected_t connected = {.channel = FAKE_AP_CHANNEL};
+  size_t ssid_len = strnlen((const char *)wifi_config.sta.ssid,
+                            sizeof(connected.ssid));
+  memcpy(connected.ssid, wifi_config.sta.ssid, ssid_len);
+  connected.ssid_len = ssid_len;
+  memcpy(connected.bssid, ap_bssid, sizeof(ap_bssid));
+  esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connected,
+                 sizeof(connected), 0);
+
+  ip_event_got_ip_t got_ip = {.ip_info = sta_netif.ip_info};
+  if (sta_netif.dhcp)
+  {
+    got_ip.ip_info.ip.addr = esp_ip4addr_aton("192.168.1.77");
+    got_ip.ip_info.netmask.addr = esp_ip4addr_aton("255.255.255.0");
+    got_ip.ip_info.gw.addr = esp_ip4addr_aton("192.168.1.1");
+    sta_netif.ip_info = got_ip.ip_info;
+    sta_netif.dns.ip.u_addr.ip4.addr = got_ip.ip_info.gw.addr;
+    sta_netif.dns.ip.type = ESP_IPADDR_TYPE_V4;
+  }
+  return esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip, sizeof(got_ip),
+                        0);
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+  return ESP_OK;
+}
+
+/* SNTP, one poll that answers at once */
+
+void esp_sntp_setoperatingmode(sntp_operatingmode_t mode)
+{
+}
+
+void esp_sntp_setservername(unsigned char idx, const char *server)
+{
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+  sntp_cb = callback;
+}
+
+void sntp_set_sync_status(sntp_sync_status_t status)
+{
+}
+
+void esp_sntp_init(void)
+{
+  int64_t server_us = fake_clock_now_us() + sntp_offset_us;
+  struct timeval tv = {
+      .tv_sec = server_us / 1000000,
+      .tv_usec = server_us % 1000000,
+  };
+  sntp_sync_time(&tv);
+  if (sntp_cb != NULL)
+    sntp_cb(&tv);
+}
+
+void esp_sntp_stop(void)
+{
+}
+
+/*
+ * Not PBKDF2: the bench only needs the same key for the same input, and
+ * 4096 real SHA1 rounds would only measure mbedtls.
+ */
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t md_type,
+                                  const unsigned char *password, size_t plen,
+                                  const unsigned char *salt, size_t slen,
+                                  unsigned int iteration_count,
+                                  uint32_t key_length, unsigned char *output)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < plen; i++)
+    h = (h ^ password[i]) * 16777619u;
+  for (size_t i = 0; i < slen; i++)
+    h = (h ^ salt[i]) * 16777619u;
+  for (uint32_t i = 0; i < key_length; i++)
+  {
+    h = (h ^ i) * 16777619u;
+    output[i] = h >> 24;
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+// Host stand-in for the bsec2 component: the BSEC library is replaced by a
+// script of outputs, see fake_bsec2.c
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BSEC_MAX_STATE_BLOB_SIZE 221
+#define BSEC_NUMBER_OUTPUTS 14
+#define BSEC_SAMPLE_RATE_ULP 0.0033333f
+#define BSEC_SAMPLE_RATE_LP 0.33333f
+#define BSEC_OK 0
+
+typedef enum
+{
+  BME68X_SPI_INTF,
+  BME68X_I2C_INTF,
+} bme68x_intf_t;
+
+typedef enum
+{
+  BSEC_OUTPUT_IAQ = 1,
+  BSEC_OUTPUT_STATIC_IAQ = 2,
+  BSEC_OUTPUT_CO2_EQUIVALENT = 3,
+  BSEC_OUTPUT_BREATH_VOC_EQUIVALENT = 4,
+  BSEC_OUTPUT_RAW_TEMPERATURE = 6,
+  BSEC_OUTPUT_RAW_PRESSURE = 7,
+  BSEC_OUTPUT_RAW_HUMIDITY = 8,
+  BSEC_OUTPUT_RAW_GAS = 9,
+  BSEC_OUTPUT_STABILIZATION_STATUS = 12,
+  BSEC_OUTPUT_RUN_IN_STATUS = 13,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE = 14,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY = 15,
+} bsec_virtual_sensor_t;
+
+typedef uint8_t bsec_sensor_t;
+typedef int bsec_library_return_t;
+
+typedef struct
+{
+  int64_t next_call;
+  uint32_t process_data;
+  uint16_t heater_temperature;
+  uint16_t heater_duration;
+  uint8_t run_gas;
+  uint8_t trigger_measurement;
+  uint8_t op_mode;
+} bsec_bme_settings_t;
+
+typedef struct
+{
+  int64_t time_stamp;
+  float signal;
+  uint8_t signal_dimensions;
+  uint8_t sensor_id;
+  uint8_t accuracy;
+} bsec_data_t;
+
+typedef struct
+{
+  bsec_data_t output[BSEC_NUMBER_OUTPUTS];
+  uint8_t n_outputs;
+} bsec_outputs_t;
+
+typedef struct
+{
+  uint8_t status;
+  float temperature;
+  float pressure;
+  float humidity;
+  float gas_resistance;
+} bme68x_data_t;
+
+typedef struct bsec2_s bsec2_t;
+
+typedef void (*bsec_callback_t)(const bme68x_data_t data,
+                                const bsec_outputs_t outputs, bsec2_t bsec);
+
+struct bsec2_s
+{
+  void *intf_ptr;
+  bsec_bme_settings_t bme_conf;
+  bsec_callback_t new_data_callback;
+  bsec_outputs_t outputs;
+  float sample_rate;
+  bsec_library_return_t status;
+};
+
+bool bsec2_init(bsec2_t *const me, void *arg, bme68x_intf_t intf);
+bool bsec2_run(bsec2_t *const me);
+bool bsec2_set_config(bsec2_t *const me, const uint8_t *config);
+bool bsec2_get_state(bsec2_t *const me, uint8_t *state);
+bool bsec2_set_state(bsec2_t *const me, uint8_t *state);
+bool bsec2_update_subscription(bsec2_t *const me, bsec_sensor_t *sensor_list,
+                               uint8_t n_sensors, float sample_rate);
+void bsec2_attach_callback(bsec2_t *const me, bsec_callback_t callback);
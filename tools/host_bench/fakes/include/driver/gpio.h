@@ -0,0 +1,7 @@
+#pragma once
+// Host fake of driver/gpio.h
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef int gpio_num_t;
@@ -0,0 +1,74 @@
+#pragma once
+// Host fake of driver/i2c_master.h, see fakes.h for the devices on the bus
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct fake_i2c_bus *i2c_master_bus_handle_t;
+typedef struct fake_i2c_dev *i2c_master_dev_handle_t;
+
+typedef enum
+{
+  I2C_NUM_0,
+} i2c_port_num_t;
+
+typedef enum
+{
+  I2C_CLK_SRC_DEFAULT,
+} i2c_clock_source_t;
+
+typedef struct
+{
+  i2c_port_num_t i2c_port;
+  int sda_io_num;
+  int scl_io_num;
+  i2c_clock_source_t clk_source;
+  uint8_t glitch_ignore_cnt;
+  struct
+  {
+    uint32_t enable_internal_pullup : 1;
+  } flags;
+} i2c_master_bus_config_t;
+
+typedef enum
+{
+  I2C_ADDR_BIT_LEN_7,
+  I2C_ADDR_BIT_LEN_10,
+} i2c_addr_bit_len_t;
+
+typedef struct
+{
+  i2c_addr_bit_len_t dev_addr_length;
+  uint16_t device_address;
+  uint32_t scl_speed_hz;
+  uint32_t scl_wait_us;
+} i2c_device_config_t;
+
+typedef struct
+{
+  const uint8_t *write_buffer;
+  size_t buffer_size;
+} i2c_master_transmit_multi_buffer_info_t;
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *config,
+                             i2c_master_bus_handle_t *ret_bus_handle);
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus,
+                                    const i2c_device_config_t *config,
+                                    i2c_master_dev_handle_t *ret_handle);
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev,
+                              const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms);
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t dev, uint8_t *read_buffer,
+                             size_t read_size, int xfer_timeout_ms);
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev,
+                                      const uint8_t *write_buffer,
+                                      size_t write_size, uint8_t *read_buffer,
+                                      size_t read_size, int xfer_timeout_ms);
+esp_err_t i2c_master_multi_buffer_transmit(
+    i2c_master_dev_handle_t dev,
+    i2c_master_transmit_multi_buffer_info_t *buffer_info_array,
+    size_t array_size, int xfer_timeout_ms);
+esp_err_t i2c_master_probe(i2c_master_bus_handle_t bus, uint16_t address,
+                           int xfer_timeout_ms);
@@ -0,0 +1,10 @@
+#pragma once
+// Host fake of esp_adc/adc_cali.h
+
+#include "esp_err.h"
+#include "hal/adc_types.h"
+
+typedef struct fake_adc_cali *adc_cali_handle_t;
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw,
+                                  int *voltage);
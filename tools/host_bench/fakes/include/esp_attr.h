@@ -0,0 +1,7 @@
+#pragma once
+// Host fake of esp_attr.h, RTC memory is ordinary memory that never resets
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,16 @@
+#pragma once
+// Host fake of esp_check.h
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define ESP_RETURN_ON_ERROR(x, log_tag, format, ...)                           \
+  do                                                                           \
+  {                                                                            \
+    esp_err_t err_rc_ = (x);                                                   \
+    if (err_rc_ != ESP_OK)                                                     \
+    {                                                                          \
+      ESP_LOGE(log_tag, format, ##__VA_ARGS__);                                \
+      return err_rc_;                                                          \
+    }                                                                          \
+  } while (0)
@@ -0,0 +1,20 @@
+#pragma once
+// Host fake of esp_event.h, events are delivered on the posting thread
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef const char *esp_event_base_t;
+typedef void *esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base,
+                                    int32_t id, void *data);
+
+#define ESP_EVENT_ANY_ID -1
+
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_instance_register(
+    esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg,
+    esp_event_handler_instance_t *instance);
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data,
+                         size_t size, uint32_t ticks);
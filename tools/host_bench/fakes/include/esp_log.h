@@ -0,0 +1,22 @@
+#pragma once
+// Host fake of esp_log.h, prints to stderr above the level set by the bench
+
+typedef enum
+{
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+void fake_log_write(esp_log_level_t level, const char *tag, const char *fmt,
+                    ...);
+
+#define ESP_LOGE(tag, fmt, ...) fake_log_write(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fake_log_write(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fake_log_write(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) fake_log_write(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) fake_log_write(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,77 @@
+#pragma once
+// Host fake of esp_netif.h
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include <stdint.h>
+
+typedef struct
+{
+  uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct
+{
+  esp_ip4_addr_t ip;
+  esp_ip4_addr_t netmask;
+  esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#define ESP_IPADDR_TYPE_V4 0
+
+typedef struct
+{
+  union
+  {
+    esp_ip4_addr_t ip4;
+  } u_addr;
+  uint8_t type;
+} esp_ip_addr_t;
+
+typedef struct
+{
+  esp_ip_addr_t ip;
+} esp_netif_dns_info_t;
+
+typedef enum
+{
+  ESP_NETIF_DNS_MAIN,
+  ESP_NETIF_DNS_BACKUP,
+} esp_netif_dns_type_t;
+
+typedef struct fake_netif esp_netif_t;
+
+typedef struct
+{
+  esp_netif_ip_info_t ip_info;
+} ip_event_got_ip_t;
+
+extern esp_event_base_t const IP_EVENT;
+
+enum
+{
+  IP_EVENT_STA_GOT_IP,
+};
+
+#define esp_ip4_addr1_16(a) ((uint16_t)((a)->addr & 0xff))
+#define esp_ip4_addr2_16(a) ((uint16_t)(((a)->addr >> 8) & 0xff))
+#define esp_ip4_addr3_16(a) ((uint16_t)(((a)->addr >> 16) & 0xff))
+#define esp_ip4_addr4_16(a) ((uint16_t)(((a)->addr >> 24) & 0xff))
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr)                                                         \
+  esp_ip4_addr1_16(ipaddr), esp_ip4_addr2_16(ipaddr),                          \
+      esp_ip4_addr3_16(ipaddr), esp_ip4_addr4_16(ipaddr)
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *netif);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif);
+esp_err_t esp_netif_set_ip_info(esp_netif_t *netif,
+                                const esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_set_dns_info(esp_netif_t *netif,
+                                 esp_netif_dns_type_t type,
+                                 esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_get_dns_info(esp_netif_t *netif,
+                                 esp_netif_dns_type_t type,
+                                 esp_netif_dns_info_t *dns);
+uint32_t esp_ip4addr_aton(const char *addr);
@@ -0,0 +1,6 @@
+#pragma once
+// Host fake of esp_rom_sys.h
+
+#include <stdint.h>
+
+void esp_rom_delay_us(uint32_t us);
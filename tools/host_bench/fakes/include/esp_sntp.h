@@ -0,0 +1,28 @@
+#pragma once
+// Host fake of esp_sntp.h, see fakes.h for the server time
+
+#include <sys/time.h>
+
+typedef enum
+{
+  SNTP_OPMODE_POLL,
+} sntp_operatingmode_t;
+
+typedef enum
+{
+  SNTP_SYNC_STATUS_RESET,
+  SNTP_SYNC_STATUS_COMPLETED,
+  SNTP_SYNC_STATUS_IN_PROGRESS,
+} sntp_sync_status_t;
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void esp_sntp_setoperatingmode(sntp_operatingmode_t mode);
+void esp_sntp_setservername(unsigned char idx, const char *server);
+void esp_sntp_init(void);
+void esp_sntp_stop(void);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_set_sync_status(sntp_sync_status_t status);
+
+// Supplied by the application, like the weak default in the real client
+void sntp_sync_time(struct timeval *tv);
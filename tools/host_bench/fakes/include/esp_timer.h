@@ -0,0 +1,6 @@
+#pragma once
+// Host fake of esp_timer.h, microseconds since the process started
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,94 @@
+#pragma once
+// Host fake of esp_wifi.h, see fakes.h for the access point
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  WIFI_MODE_NULL,
+  WIFI_MODE_STA,
+} wifi_mode_t;
+
+typedef enum
+{
+  WIFI_IF_STA,
+} wifi_interface_t;
+
+typedef enum
+{
+  WIFI_AUTH_OPEN,
+  WIFI_AUTH_WEP,
+  WIFI_AUTH_WPA_PSK,
+  WIFI_AUTH_WPA2_PSK,
+} wifi_auth_mode_t;
+
+typedef enum
+{
+  WIFI_FAST_SCAN,
+  WIFI_ALL_CHANNEL_SCAN,
+} wifi_scan_method_t;
+
+typedef enum
+{
+  WIFI_STORAGE_FLASH,
+  WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef struct
+{
+  int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() {0}
+
+typedef struct
+{
+  uint8_t ssid[32];
+  uint8_t password[64];
+  wifi_scan_method_t scan_method;
+  bool bssid_set;
+  uint8_t bssid[6];
+  uint8_t channel;
+  struct
+  {
+    wifi_auth_mode_t authmode;
+  } threshold;
+} wifi_sta_config_t;
+
+typedef union
+{
+  wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct
+{
+  uint8_t ssid[32];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t channel;
+} wifi_event_sta_connected_t;
+
+extern esp_event_base_t const WIFI_EVENT;
+
+enum
+{
+  WIFI_EVENT_STA_START = 2,
+  WIFI_EVENT_STA_STOP = 3,
+  WIFI_EVENT_STA_CONNECTED = 4,
+  WIFI_EVENT_STA_DISCONNECTED = 5,
+};
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_set_max_tx_power(int8_t power);
@@ -0,0 +1,54 @@
+#pragma once
+// Controls of the host fakes, for the bench only
+
+#include "esp_log.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Logging */
+void fake_log_set_level(esp_log_level_t level);
+
+/* RTC clock behind gettimeofday(), settimeofday() and time() */
+void fake_clock_set_us(int64_t unix_us);
+int64_t fake_clock_now_us(void);
+
+/* NVS */
+void fake_nvs_clear(void);
+uint32_t fake_nvs_writes(void);
+
+/* Flash: the "storage" partition, 8 sectors of 4 KB */
+void fake_partition_erase(void);
+uint32_t fake_partition_erases(void); // Sectors erased
+
+/* I2C: SSD1306 at 0x3C and BME680 at 0x77 answer, the panel keeps its RAM */
+void fake_i2c_set_fail(bool fail);
+uint32_t fake_i2c_transactions(void);
+uint32_t fake_i2c_bytes(void);
+const uint8_t *fake_ssd1306_ram(void); // 8 pages of 128 columns
+
+/* ADC: battery voltage at the pin, before the divider */
+void fake_adc_set_mv(int mv);
+void fake_adc_set_calibrated(bool calibrated);
+
+/* WiFi and SNTP */
+void fake_wifi_set_ap(bool present);
+void fake_sntp_set_offset_us(int64_t offset_us); // Server minus RTC
+
+/* Scripted BSEC */
+typedef struct
+{
+  float temperature;
+  float humidity;
+  float pressure;
+  float gas_resistance;
+  float iaq;         // Below 0: the step has no BSEC outputs, only raw data
+  uint8_t accuracy;
+  uint8_t stabilization;
+  uint8_t run_in;
+} fake_bsec_step_t;
+
+int fake_bsec2_load_script(const char *path);
+const fake_bsec_step_t *fake_bsec2_step(uint32_t n);
+uint32_t fake_bsec2_runs(void);
+void fake_bsec2_touch_state(void);
@@ -0,0 +1,7 @@
+#pragma once
+// Host fake of nvs_flash.h
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
@@ -0,0 +1,2 @@
+#pragma once
+// Host fake of the generated sdkconfig.h, the firmware defaults apply
@@ -0,0 +1,732 @@
+/*
+ * host_bench.c
+ *
+ * Host build of main/bme680_manager.c, log_manager.c, u8g2_manager.c,
+ * vbat_driver.c and wifi_time_manager.c, unchanged, on top of the fakes in
+ * fakes/: FreeRTOS on pthreads, NVS and the log partition in memory, an I2C
+ * bus with an SSD1306 that keeps its GDDRAM, the ADC, WiFi/SNTP and a
+ * scripted BSEC. The real i2c_bus_manager.c arbitrates the bus and the real
+ * u8g2 draws.
+ *
+ * A run first goes through a wake the way app_main does and checks the
+ * results against the fakes: the data in latest_data is the script step,
+ * the panel shows the u8g2 buffer after every frame (also after a bus
+ * error), a time sync sets the clock, state saves reach NVS only when
+ * due and never before the stored state was loaded. The log is filled until it wraps and its range queries and time
+ * lookups are checked against the records read back. Then it times the hot
+ * paths:
+ *
+ *   bme680_read    parsing the BSEC outputs into latest_data
+ *   bsec_run       bme680_manager_run(), bus claim, callback and parse
+ *   draw_ui        u8g2_manager_draw_ui() with a changing reading, frame sent
+ *   draw_history   u8g2_manager_draw_history(), frame sent
+ *   i2c_byte_cb    the u8x8 byte callback recording one full frame, as
+ *                  u8x8 calls it, without sending it
+ *   state_save     bme680_manager_save_state(true) with a changed state
+ *   state_load     bme68x_load_state() from RTC memory
+ *   vbat_read      vbat_driver_read(), burst of 64 samples and trimmed mean
+ *
+ * Every benchmark runs a few rounds and reports the best one in ns per
+ * call. The output is also the baseline format: with -b, a benchmark more
+ * than the tolerance slower than the baseline fails the run, for CI.
+ *
+ * Build: cmake -S tools/host_bench -B build/host_bench && cmake --build build/host_bench
+ *        (u8g2 is fetched, or -DU8G2_DIR=<u8g2 checkout> to build offline)
+ * Usage: host_bench [-n iterations] [-f filter] [-b baseline] [-t tolerance%]
+ *                   [-s script.csv] [-v]
+ * Exit:  0 ok, 1 a check failed, 2 slower than the baseline
+ */
+#include "bme680_manager.h"
+#include "common_data.h"
+#include "fakes.h"
+#include "i2c_bus_manager.h"
+#include "log_manager.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "u8g2.h"
+#include "u8g2_manager.h"
+#include "vbat_driver.h"
+#include "wifi_time_manager.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 5
+#define BENCH_DEFAULT_ITERATIONS 2000
+#define BENCH_DEFAULT_TOLERANCE 25.0 // Percent over the baseline
+#define BENCH_BASELINE_MAX 32
+#define BENCH_SMOKE_RUNS 8 // BSEC steps checked, past the raw-only warm-up
+
+#define PANEL_BYTES 1024 // 8 pages of 128 columns
+#define PANEL_ROWS 8
+#define PANEL_COLUMNS 128
+#define U8X8_DATA_CHUNK 24 // Bytes per data transfer in u8x8_cad_ssd13xx_fast_i2c
+
+#define NS_PER_S 1000000000LL
+
+/*
+ * u8g2_manager.c keeps its u8g2_t and byte callback to itself, the setup
+ * call is wrapped (-Wl,--wrap in CMakeLists.txt) to get at both.
+ */
+static u8g2_t *panel_u8g2;
+static u8x8_msg_cb panel_byte_cb;
+
+void __real_u8g2_Setup_ssd1306_i2c_128x64_noname_f(u8g2_t *u8g2,
+                                                   const u8g2_cb_t *rotation,
+                                                   u8x8_msg_cb byte_cb,
+                                                   u8x8_msg_cb gpio_and_delay_cb);
+
+void __wrap_u8g2_Setup_ssd1306_i2c_128x64_noname_f(u8g2_t *u8g2,
+                                                   const u8g2_cb_t *rotation,
+                                                   u8x8_msg_cb byte_cb,
+                                                   u8x8_msg_cb gpio_and_delay_cb)
+{
+  panel_u8g2 = u8g2;
+  panel_byte_cb = byte_cb;
+  __real_u8g2_Setup_ssd1306_i2c_128x64_noname_f(u8g2, rotation, byte_cb,
+                                                gpio_and_delay_cb);
+}
+
+static int failures;
+static bool verbose;
+
+#define CHECK(cond, ...)                                                       \
+  do                                                                           \
+  {                                                                            \
+    if (!(cond))                                                               \
+    {                                                                          \
+      printf("# FAIL %s:%d: ", __FILE__, __LINE__);                            \
+      printf(__VA_ARGS__);                                                     \
+      printf("\n");                                                            \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static bool near(float a, float b)
+{
+  return fabsf(a - b) <= 1e-3f * (fabsf(b) > 1.0f ? fabsf(b) : 1.0f);
+}
+
+static bool panel_matches(void)
+{
+  u8g2_manager_wait_idle();
+  return memcmp(fake_ssd1306_ram(), u8g2_GetBufferPtr(panel_u8g2),
+                PANEL_BYTES) == 0;
+}
+
+static void draw_latest(void)
+{
+  u8g2_manager_draw_ui(latest_data.battery_voltage_mv, latest_data.temperature,
+                       latest_data.humidity, latest_data.iaq,
+                       latest_data.iaq_accuracy);
+}
+
+// latest_data against the script step the last run handed out
+static void check_step(uint32_t run)
+{
+  const fake_bsec_step_t *s = fake_bsec2_step(run);
+  CHECK(latest_data.valid, "run %u: no data", run);
+  CHECK(near(latest_data.temperature, s->temperature),
+        "run %u: temperature %.2f, script %.2f", run, latest_data.temperature,
+        s->temperature);
+  CHECK(near(latest_data.humidity, s->humidity),
+        "run %u: humidity %.2f, script %.2f", run, latest_data.humidity,
+        s->humidity);
+  CHECK(near(latest_data.pressure, s->pressure),
+        "run %u: pressure %.2f, script %.2f", run, latest_data.pressure,
+        s->pressure);
+  CHECK(near(latest_data.gas_resistance, s->gas_resistance),
+        "run %u: gas %.0f, script %.0f", run, latest_data.gas_resistance,
+        s->gas_resistance);
+  if (s->iaq < 0)
+  {
+    CHECK(!latest_data.is_bsec, "run %u: raw step taken as BSEC output", run);
+    return;
+  }
+  CHECK(latest_data.is_bsec, "run %u: BSEC step taken as raw data", run);
+  CHECK(near(latest_data.iaq, s->iaq), "run %u: IAQ %.1f, script %.1f", run,
+        latest_data.iaq, s->iaq);
+  CHECK(latest_data.iaq_accuracy == s->accuracy,
+        "run %u: accuracy %d, script %u", run, latest_data.iaq_accuracy,
+        s->accuracy);
+  CHECK(latest_data.stabilization_status == s->stabilization &&
+            latest_data.run_in_status == s->run_in,
+        "run %u: status %d/%d, script %u/%u", run,
+        latest_data.stabilization_status, latest_data.run_in_status,
+        s->stabilization, s->run_in);
+}
+
+static bool nvs_bsec_state(uint8_t *blob, bool write)
+{
+  nvs_handle_t h;
+  size_t len = BSEC_MAX_STATE_BLOB_SIZE;
+  if (nvs_flash_init() != ESP_OK ||
+      nvs_open("bsec_storage", NVS_READWRITE, &h) != ESP_OK)
+    return false;
+  esp_err_t err = write ? nvs_set_blob(h, "bsec_state", blob, len)
+                        : nvs_get_blob(h, "bsec_state", blob, &len);
+  nvs_close(h);
+  return err == ESP_OK;
+}
+
+/*
+ * One wake as app_main does it, with the results checked against what the
+ * fakes were set up with. Leaves every manager initialised for the
+ * benchmarks.
+ */
+static void smoke(void)
+{
+  wifi_time_manager_set_timezone();
+
+  CHECK(u8g2_manager_init(false) == ESP_OK, "display init failed");
+  static const uint8_t blank[PANEL_BYTES];
+  CHECK(memcmp(fake_ssd1306_ram(), blank, PANEL_BYTES) == 0,
+        "panel not cleared by the cold init");
+
+  fake_adc_set_mv(1900);
+  CHECK(vbat_driver_init() == ESP_OK, "vbat init failed");
+  CHECK(vbat_driver_read() == ESP_OK, "vbat read failed");
+  CHECK(abs(latest_data.battery_voltage_mv - 3800) <= 20,
+        "battery %d mV, expected ~3800", latest_data.battery_voltage_mv);
+
+  // Power-on with the clock unset: the state load waits for a sync. A sync
+  // before the first run must not let the fresh state replace the
+  // calibrated one in NVS.
+  static bsec2_t state_bsec;
+  uint8_t calibrated[BSEC_MAX_STATE_BLOB_SIZE], blob[BSEC_MAX_STATE_BLOB_SIZE];
+  fake_bsec2_touch_state();
+  bsec2_get_state(&state_bsec, calibrated);
+  CHECK(nvs_bsec_state(calibrated, true), "calibrated state not stored");
+  fake_bsec2_touch_state(); // What a fresh BSEC would hand out
+  int64_t synced_us = fake_clock_now_us();
+  fake_clock_set_us(0);
+  CHECK(bme680_manager_init(i2c_bus_manager_get_handle()) == ESP_OK,
+        "BSEC init failed");
+  fake_clock_set_us(synced_us);
+  uint32_t writes = fake_nvs_writes();
+  bme680_manager_save_state(false);
+  CHECK(fake_nvs_writes() == writes, "fresh state written over the NVS one");
+  CHECK(nvs_bsec_state(blob, false) &&
+            memcmp(blob, calibrated, sizeof(blob)) == 0,
+        "calibrated state in NVS lost");
+  bsec2_get_state(&state_bsec, blob);
+  CHECK(memcmp(blob, calibrated, sizeof(blob)) == 0,
+        "calibrated state not loaded before the save");
+
+  for (int i = 0; i < BENCH_SMOKE_RUNS; i++)
+  {
+    CHECK(bme680_manager_run() == ESP_OK, "BSEC run failed");
+    check_step(fake_bsec2_runs() - 1);
+  }
+  bme680_manager_run_start();
+  CHECK(bme680_manager_run_join() == ESP_OK, "background BSEC run failed");
+  check_step(fake_bsec2_runs() - 1);
+
+  // A first frame, then one that only differs in a few tiles
+  uint32_t before = fake_i2c_bytes();
+  draw_latest();
+  CHECK(panel_matches(), "panel differs from the frame buffer");
+  uint32_t first = fake_i2c_bytes() - before;
+  latest_data.temperature += 1.0f;
+  before = fake_i2c_bytes();
+  draw_latest();
+  CHECK(panel_matches(), "panel differs after a partial update");
+  uint32_t partial = fake_i2c_bytes() - before;
+  CHECK(partial < first, "partial update sent %u bytes, first frame %u",
+        partial, first);
+  if (verbose)
+    printf("# frame on the bus: first %u bytes, one value changed %u bytes\n",
+           first, partial);
+
+  u8g2_manager_draw_history(ROLLUP_SPARK_24H);
+  CHECK(panel_matches(), "panel differs after the history screen");
+
+  // A lost frame must be sent in full on the next draw
+  fake_i2c_set_fail(true);
+  draw_latest();
+  u8g2_manager_wait_idle();
+  fake_i2c_set_fail(false);
+  latest_data.humidity += 1.0f;
+  draw_latest();
+  CHECK(panel_matches(), "panel not recovered after a bus error");
+
+  // First sync: no cache, full scan and DHCP
+  int64_t offset_us = 250000;
+  fake_sntp_set_offset_us(offset_us);
+  int64_t expect_us = fake_clock_now_us() + offset_us;
+  CHECK(wifi_time_manager_sync_due(), "sync not due on a cold boot");
+  CHECK(wifi_time_manager_sync_start(), "sync not started");
+  CHECK(wifi_time_manager_sync_wait(5000), "sync did not finish");
+  CHECK(wifi_time_manager_is_synced(), "time not synced");
+  CHECK(llabs(fake_clock_now_us() - expect_us) < 1000000,
+        "clock %lld us off the server", (long long)(fake_clock_now_us() - expect_us));
+  CHECK(!wifi_time_manager_sync_due(), "sync still due right after one");
+
+  // Ten hours later the error limit is passed, the cached AP is used
+  fake_clock_set_us(fake_clock_now_us() + 10LL * 3600 * 1000000);
+  CHECK(wifi_time_manager_sync_due(), "sync not due after 10 h");
+  CHECK(wifi_time_manager_sync_start() && wifi_time_manager_sync_wait(5000),
+        "second sync did not finish");
+  CHECK(wifi_time_manager_get_error_ms() < 2000, "error %lld ms after a sync",
+        (long long)wifi_time_manager_get_error_ms());
+
+  // State: forced saves reach NVS once per change, unforced ones stay in RTC
+  writes = fake_nvs_writes();
+  fake_bsec2_touch_state();
+  bme680_manager_save_state(true);
+  CHECK(fake_nvs_writes() == writes + 1, "forced save not written to NVS");
+  bme680_manager_save_state(true);
+  CHECK(fake_nvs_writes() == writes + 1, "unchanged state written again");
+  fake_bsec2_touch_state();
+  bme680_manager_save_state(false);
+  CHECK(fake_nvs_writes() == writes + 1, "state written before the interval");
+}
+
+/*
+ * The log on an in-memory partition: enough samples that it wraps, then
+ * range queries and time lookups against a brute force over the records
+ * read back. Random ranges cut through blocks and sectors, so the edge
+ * blocks are decoded, whole sectors come from their seals and the head
+ * sector from RTC memory.
+ */
+#define LOG_CHECK_SAMPLES 4000
+#define LOG_CHECK_STEP_S 300
+#define LOG_CHECK_QUERIES 500
+#define LOG_CHECK_STAGED 5
+
+static log_record_t log_records[LOG_CHECK_SAMPLES];
+static log_iter_t log_iter;
+
+// Channel value as summary_add() in log_manager.c takes it
+static int16_t log_sum_value(const log_sample_t *s, int ch)
+{
+  float v;
+  switch (ch)
+  {
+  case LOG_SUM_TEMPERATURE:
+    return s->temperature_cc;
+  case LOG_SUM_HUMIDITY:
+    v = s->humidity_cp;
+    break;
+  case LOG_SUM_IAQ:
+    v = s->iaq_x10;
+    break;
+  default:
+    if (!isfinite(s->pressure))
+      return 0;
+    v = s->pressure * 10.0f;
+    break;
+  }
+  return v >= 32767.0f ? 32767 : (int16_t)lroundf(v);
+}
+
+static void log_brute_query(uint32_t n, uint32_t t_from, uint32_t t_to,
+                            log_summary_t *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->t_min = UINT32_MAX;
+  for (int ch = 0; ch < LOG_SUM_CHANNELS; ch++)
+  {
+    out->min[ch] = INT16_MAX;
+    out->max[ch] = INT16_MIN;
+  }
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const log_sample_t *s = &log_records[i].sample;
+    if (s->timestamp < t_from || s->timestamp >= t_to)
+      continue;
+    if (s->timestamp < out->t_min)
+      out->t_min = s->timestamp;
+    if (s->timestamp > out->t_max)
+      out->t_max = s->timestamp;
+    if (!(s->flags & LOG_FLAG_VALID))
+      continue;
+    for (int ch = 0; ch < LOG_SUM_CHANNELS; ch++)
+    {
+      int16_t v = log_sum_value(s, ch);
+      if (v < out->min[ch])
+        out->min[ch] = v;
+      if (v > out->max[ch])
+        out->max[ch] = v;
+      out->sum[ch] += v;
+    }
+    out->count++;
+  }
+}
+
+static void log_check_query(uint32_t n, uint32_t t_from, uint32_t t_to)
+{
+  log_summary_t got, want;
+  CHECK(log_manager_query(t_from, t_to, &got) == ESP_OK,
+        "query [%u, %u) failed", t_from, t_to);
+  log_brute_query(n, t_from, t_to, &want);
+  CHECK(got.count == want.count && got.t_min == want.t_min &&
+            got.t_max == want.t_max,
+        "query [%u, %u): %u samples in [%u, %u], expected %u in [%u, %u]",
+        t_from, t_to, got.count, got.t_min, got.t_max, want.count,
+        want.t_min, want.t_max);
+  for (int ch = 0; ch < LOG_SUM_CHANNELS && want.count > 0; ch++)
+    CHECK(got.min[ch] == want.min[ch] && got.max[ch] == want.max[ch] &&
+              got.sum[ch] == want.sum[ch],
+          "query [%u, %u) channel %d: %d..%d sum %d, expected %d..%d sum %d",
+          t_from, t_to, ch, got.min[ch], got.max[ch], (int)got.sum[ch],
+          want.min[ch], want.max[ch], (int)want.sum[ch]);
+}
+
+static void log_check(void)
+{
+  fake_partition_erase();
+  CHECK(log_manager_init() == ESP_OK, "log init failed");
+
+  latest_data_t d = latest_data;
+  int64_t start_us = fake_clock_now_us();
+  for (uint32_t i = 0; i < LOG_CHECK_SAMPLES; i++)
+  {
+    fake_clock_set_us(start_us + (int64_t)i * LOG_CHECK_STEP_S * 1000000LL);
+    d.temperature = 21.0f + 4.0f * sinf(i * 0.02f);
+    d.humidity = 45.0f + (float)(i % 37);
+    d.iaq = 50.0f + (float)(i % 211);
+    d.pressure = 1000.0f + (float)(i % 29) * 0.7f;
+    d.valid = i % 13 != 0;
+    CHECK(log_manager_append(&d) == ESP_OK, "append %u failed", i);
+  }
+  CHECK(log_manager_flush() == ESP_OK, "flush failed");
+
+  uint32_t first_seq, next_seq;
+  log_manager_get_range(&first_seq, &next_seq);
+  CHECK(next_seq == LOG_CHECK_SAMPLES, "next_seq %u after %u samples",
+        next_seq, LOG_CHECK_SAMPLES);
+  CHECK(first_seq > 0, "log did not wrap, %u erases",
+        fake_partition_erases());
+
+  uint32_t n = 0;
+  CHECK(log_manager_iter_init(&log_iter, 0) == ESP_OK, "iter init failed");
+  while (n < LOG_CHECK_SAMPLES &&
+         log_manager_iter_next(&log_iter, &log_records[n]) == ESP_OK)
+    n++;
+  CHECK(n == next_seq - first_seq && log_records[0].seq == first_seq,
+        "read %u records from %u, log holds %u..%u", n, log_records[0].seq,
+        first_seq, next_seq - 1);
+  if (n == 0)
+    return;
+
+  uint32_t t_lo = log_records[0].sample.timestamp;
+  uint32_t t_hi = log_records[n - 1].sample.timestamp;
+  uint32_t span = t_hi - t_lo;
+  log_check_query(n, 0, UINT32_MAX);
+  log_check_query(n, t_lo, t_hi + 1);
+  log_check_query(n, 0, t_lo);
+  log_check_query(n, t_hi + 1, UINT32_MAX);
+  log_check_query(n, t_hi, t_hi + 1); // Head sector only
+  srand(7);
+  for (int i = 0; i < LOG_CHECK_QUERIES; i++)
+  {
+    uint32_t a = t_lo - 1000 + (uint32_t)rand() % (span + 2000);
+    uint32_t len = i % 4 == 0 ? (uint32_t)rand() % 2000
+                              : (uint32_t)rand() % (span + 1000);
+    log_check_query(n, a, a + len);
+  }
+
+  // The oldest block reaching t starts at seq, earlier ones are all older
+  for (int i = 0; i < LOG_CHECK_QUERIES; i++)
+  {
+    uint32_t t = t_lo + (uint32_t)rand() % (span + 1);
+    uint32_t seq;
+    CHECK(log_manager_find_time(t, &seq) == ESP_OK, "find_time %u failed", t);
+    uint32_t at = seq - first_seq;
+    bool ok = at < n;
+    for (uint32_t k = 0; ok && k < at; k++)
+      ok = log_records[k].sample.timestamp < t;
+    bool reached = false;
+    for (uint32_t k = at; ok && k < n && k < at + LOG_BLOCK_MAX_SAMPLES; k++)
+      reached |= log_records[k].sample.timestamp >= t;
+    CHECK(ok && reached, "find_time %u gave %u", t, seq);
+  }
+  uint32_t seq;
+  CHECK(log_manager_find_time(t_hi + 1, &seq) == ESP_ERR_NOT_FOUND,
+        "find_time past the newest sample found %u", seq);
+
+  // Staged samples count before they reach flash
+  uint32_t t_staged = t_hi + LOG_CHECK_STEP_S;
+  d.valid = true;
+  for (uint32_t i = 0; i < LOG_CHECK_STAGED; i++)
+  {
+    fake_clock_set_us((int64_t)(t_staged + i * LOG_CHECK_STEP_S) * 1000000LL);
+    CHECK(log_manager_append(&d) == ESP_OK, "staged append %u failed", i);
+  }
+  log_summary_t staged;
+  CHECK(log_manager_query(t_staged - 1, UINT32_MAX, &staged) == ESP_OK &&
+            staged.count == LOG_CHECK_STAGED,
+        "%u staged samples found, expected %u", staged.count,
+        LOG_CHECK_STAGED);
+  CHECK(log_manager_get_staged_count() == LOG_CHECK_STAGED,
+        "%u samples staged, expected %u", log_manager_get_staged_count(),
+        LOG_CHECK_STAGED);
+}
+
+/* Benchmarks */
+
+static bsec2_t bench_bsec; // Only for bme68x_load_state()
+
+static void op_bme680_read(uint32_t i)
+{
+  bme680_manager_read();
+}
+
+static void op_bsec_run(uint32_t i)
+{
+  bme680_manager_run();
+}
+
+static void op_draw_ui(uint32_t i)
+{
+  u8g2_manager_draw_ui(3700 + i % 100, 20.0f + (i % 50) * 0.1f,
+                       40.0f + (i % 30) * 0.1f, 50.0f + i % 200, 3);
+  u8g2_manager_wait_idle();
+}
+
+static void op_draw_history(uint32_t i)
+{
+  u8g2_manager_draw_history(i & 1 ? ROLLUP_SPARK_7D : ROLLUP_SPARK_24H);
+  u8g2_manager_wait_idle();
+}
+
+static void byte_cb_transfer(u8x8_t *u8x8, uint8_t control,
+                             const uint8_t *data, uint8_t len, bool per_byte)
+{
+  panel_byte_cb(u8x8, U8X8_MSG_BYTE_START_TRANSFER, 0, NULL);
+  panel_byte_cb(u8x8, U8X8_MSG_BYTE_SEND, 1, &control);
+  if (per_byte)
+  {
+    for (uint8_t j = 0; j < len; j++)
+      panel_byte_cb(u8x8, U8X8_MSG_BYTE_SEND, 1, (void *)&data[j]);
+  }
+  else
+    panel_byte_cb(u8x8, U8X8_MSG_BYTE_SEND, len, (void *)data);
+  panel_byte_cb(u8x8, U8X8_MSG_BYTE_END_TRANSFER, 0, NULL);
+}
+
+// What u8x8 hands the callback for u8g2_SendBuffer(), recorded, not sent
+static void op_i2c_byte_cb(uint32_t i)
+{
+  u8x8_t *u8x8 = u8g2_GetU8x8(panel_u8g2);
+  const uint8_t *frame = u8g2_GetBufferPtr(panel_u8g2);
+  for (uint8_t row = 0; row < PANEL_ROWS; row++)
+  {
+    const uint8_t cmd[] = {0x10, 0x00, (uint8_t)(0xB0 | row)};
+    byte_cb_transfer(u8x8, 0x00, cmd, sizeof(cmd), true);
+    const uint8_t *data = frame + row * PANEL_COLUMNS;
+    for (int col = 0; col < PANEL_COLUMNS; col += U8X8_DATA_CHUNK)
+    {
+      int len = PANEL_COLUMNS - col < U8X8_DATA_CHUNK ? PANEL_COLUMNS - col
+                                                      : U8X8_DATA_CHUNK;
+      byte_cb_transfer(u8x8, 0x40, data + col, len, false);
+    }
+  }
+  u8g2_manager_wait_idle(); // Nothing is in flight, this drops the lists
+}
+
+static void op_state_save(uint32_t i)
+{
+  fake_bsec2_touch_state();
+  bme680_manager_save_state(true);
+}
+
+static void op_state_load(uint32_t i)
+{
+  bme68x_load_state(&bench_bsec);
+}
+
+static void op_vbat_read(uint32_t i)
+{
+  vbat_driver_read();
+}
+
+typedef struct
+{
+  const char *name;
+  void (*op)(uint32_t i);
+  uint32_t scale; // Iterations relative to -n, for the slow ones
+} bench_t;
+
+static const bench_t benches[] = {
+    {"bme680_read", op_bme680_read, 100},
+    {"bsec_run", op_bsec_run, 10},
+    {"draw_ui", op_draw_ui, 1},
+    {"draw_history", op_draw_history, 1},
+    {"i2c_byte_cb", op_i2c_byte_cb, 10},
+    {"state_save", op_state_save, 1},
+    {"state_load", op_state_load, 10},
+    {"vbat_read", op_vbat_read, 1},
+};
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static double run_bench(const bench_t *b, uint32_t iterations)
+{
+  // One round untimed to warm the caches and settle the tasks
+  for (uint32_t i = 0; i < iterations / 10 + 1; i++)
+    b->op(i);
+
+  double best = 0;
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    int64_t start = now_ns();
+    for (uint32_t i = 0; i < iterations; i++)
+      b->op(i);
+    double ns = (double)(now_ns() - start) / iterations;
+    if (round == 0 || ns < best)
+      best = ns;
+  }
+  return best;
+}
+
+typedef struct
+{
+  char name[32];
+  double ns;
+} baseline_t;
+
+static baseline_t baseline[BENCH_BASELINE_MAX];
+static int n_baseline;
+
+// Same format as the output, '#' lines are comments
+static bool load_baseline(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  char line[128];
+  while (n_baseline < BENCH_BASELINE_MAX && fgets(line, sizeof(line), f))
+  {
+    baseline_t *b = &baseline[n_baseline];
+    unsigned iterations;
+    if (line[0] != '#' &&
+        sscanf(line, "%31s %u %lf", b->name, &iterations, &b->ns) == 3)
+      n_baseline++;
+  }
+  fclose(f);
+  return true;
+}
+
+static const baseline_t *find_baseline(const char *name)
+{
+  for (int i = 0; i < n_baseline; i++)
+  {
+    if (strcmp(baseline[i].name, name) == 0)
+      return &baseline[i];
+  }
+  return NULL;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-f filter] [-b baseline] "
+          "[-t tolerance%%] [-s script.csv] [-v]\n",
+          prog);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+  const char *filter = NULL;
+  double tolerance = BENCH_DEFAULT_TOLERANCE;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "-n") == 0 && val)
+    {
+      iterations = (uint32_t)strtoul(val, NULL, 0);
+      i++;
+    }
+    else if (strcmp(arg, "-f") == 0 && val)
+    {
+      filter = val;
+      i++;
+    }
+    else if (strcmp(arg, "-b") == 0 && val)
+    {
+      if (!load_baseline(val))
+        return 1;
+      i++;
+    }
+    else if (strcmp(arg, "-t") == 0 && val)
+    {
+      tolerance = atof(val);
+      i++;
+    }
+    else if (strcmp(arg, "-s") == 0 && val)
+    {
+      if (fake_bsec2_load_script(val) < 0)
+      {
+        fprintf(stderr, "no steps in %s\n", val);
+        return 1;
+      }
+      i++;
+    }
+    else if (strcmp(arg, "-v") == 0)
+      verbose = true;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (iterations == 0)
+  {
+    fprintf(stderr, "iterations must be positive\n");
+    return 1;
+  }
+
+  // The checks provoke warnings on purpose, only show them with -v
+  fake_log_set_level(verbose ? ESP_LOG_INFO : ESP_LOG_ERROR);
+  smoke();
+  log_check();
+  if (failures > 0)
+  {
+    printf("# %d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("# checks passed\n");
+
+  // The paths under test log on every call
+  fake_log_set_level(ESP_LOG_ERROR);
+  bool regressed = false;
+  printf("# benchmark iterations ns/op\n");
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+  {
+    const bench_t *b = &benches[i];
+    if (filter != NULL && strstr(b->name, filter) == NULL)
+      continue;
+    uint32_t n = iterations * b->scale;
+    double ns = run_bench(b, n);
+    printf("%-14s %9u %12.1f", b->name, n, ns);
+
+    const baseline_t *base = find_baseline(b->name);
+    if (base != NULL)
+    {
+      double change = 100.0 * (ns - base->ns) / base->ns;
+      bool slow = change > tolerance;
+      printf("  # %+.1f%%%s", change, slow ? " REGRESSION" : "");
+      regressed |= slow;
+    }
+    printf("\n");
+  }
+  return regressed ? 2 : 0;
+}